@@ -1,30 +1,258 @@
-import { Visitor, Pitch, Expr, File_header, Rhythm, Tune } from "./Expr"
+import {
+  Visitor,
+  Annotation,
+  BarLine,
+  Chord,
+  Comment,
+  Decoration,
+  Expr,
+  File_header,
+  File_structure,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  Lyric_section,
+  MultiMeasureRest,
+  Music_code,
+  Note,
+  Nth_repeat,
+  Pitch,
+  Rest,
+  Rhythm,
+  Slur_group,
+  Symbol,
+  Tune,
+  Tune_Body,
+  Tune_header,
+  Tuplet,
+  YSPACER,
+} from "./Expr"
 import Token from "./token"
 import { TokenType } from "./types"
+import { Writer } from "./Writer"
 
-/* export class AstPrinter implements Visitor<string> {
-  print(expr: Expr): string {
-    return expr.accept(this)
+// comments and field values keep the CR of CRLF line breaks,
+// while the printer writes its own line breaks
+const stripCR = (text: string) => text.replace(/\r(?=\n|$)/g, "")
+
+/**
+ * Prints the AST back to canonical ABC text.
+ *
+ * The printer streams its output into a `Writer`
+ * and normalizes the layout as it goes:
+ * - header lines are ordered X:, T:, other fields, K:
+ * - runs of whitespace in the music are collapsed to a single space,
+ * and leading/trailing whitespace on music lines is dropped
+ * - bar lines are surrounded by exactly one space
+ * - tunes are separated by exactly one empty line
+ * - line breaks are LF
+ */
+export class AstPrinter implements Visitor<void> {
+  private out: Writer
+  private pendingSpace = false
+  private atLineStart = true
+  constructor(out: Writer) {
+    this.out = out
+  }
+
+  print(expr: Expr | Token) {
+    if (expr instanceof Token) {
+      this.printToken(expr)
+    } else {
+      expr.accept(this)
+    }
+  }
+
+  /**
+   * writes a chunk of text,
+   * preceded by the space requested since the last write.
+   */
+  private emit(text: string) {
+    if (this.pendingSpace) {
+      this.out.write(" ")
+      this.pendingSpace = false
+    }
+    this.out.write(text)
+    this.atLineStart = false
+  }
+  private space() {
+    if (!this.atLineStart) this.pendingSpace = true
+  }
+  private newline() {
+    this.pendingSpace = false
+    this.atLineStart = true
+    this.out.write("\n")
   }
 
-  private parenthesize(name: string, ...exprs: Array<Expr>) {
-    let builder = `(${name}`
-    exprs.forEach((expr) => (builder += ` ${expr.accept<string>(this)}`))
-    builder += ")"
-    return builder
+  private printToken(token: Token) {
+    switch (token.type) {
+      case TokenType.WHITESPACE:
+        this.space()
+        break
+      case TokenType.EOL:
+        this.newline()
+        break
+      case TokenType.ANTISLASH_EOL:
+        // a continuation ends its line, like a line break
+        this.pendingSpace = false
+        this.emit("\\")
+        this.newline()
+        break
+      case TokenType.COMMENT:
+      case TokenType.STYLESHEET_DIRECTIVE:
+        this.emit(stripCR(token.lexeme))
+        break
+      default:
+        this.emit(token.lexeme)
+    }
+  }
+
+  visitFileStructureExpr(expr: File_structure) {
+    if (expr.file_header) {
+      expr.file_header.accept(this)
+    }
+    expr.tune.forEach((tune, index) => {
+      if (index > 0 || expr.file_header) this.newline()
+      tune.accept(this)
+    })
+  }
+  visitFileHeaderExpr(expr: File_header) {
+    const text = stripCR(expr.text).replace(/\s+$/, "")
+    if (text.length === 0) return
+    this.emit(text)
+    this.newline()
+  }
+  visitTuneExpr(expr: Tune) {
+    expr.tune_header.accept(this)
+    if (expr.tune_body) {
+      expr.tune_body.accept(this)
+      if (!this.atLineStart) this.newline()
+    }
+  }
+  visitTuneHeaderExpr(expr: Tune_header) {
+    const byKey = (key: string) =>
+      expr.info_lines.filter((line) => line.key.lexeme === key)
+    const others = expr.info_lines.filter(
+      (line) => !/^[XTK]:$/.test(line.key.lexeme)
+    )
+    const ordered = byKey("X:").concat(byKey("T:"), others, byKey("K:"))
+    for (const line of ordered) {
+      line.accept(this)
+      this.newline()
+    }
+  }
+  visitInfoLineExpr(expr: Info_line) {
+    this.emit(expr.key.lexeme)
+    const [text, comment] = expr.value
+    const value = text ? stripCR(text.lexeme).trim() : ""
+    if (value.length > 0) this.emit(value)
+    if (comment) {
+      if (value.length > 0) this.space()
+      this.emit(stripCR(comment.lexeme))
+    }
+  }
+  visitLyricSectionExpr(expr: Lyric_section) {
+    for (const line of expr.info_lines) {
+      line.accept(this)
+      this.newline()
+    }
+  }
+  visitCommentExpr(expr: Comment) {
+    this.emit(stripCR(expr.text))
+  }
+  visitTuneBodyExpr(expr: Tune_Body) {
+    for (const element of expr.sequence) {
+      this.print(element)
+    }
+  }
+  visitMusicCodeExpr(expr: Music_code) {
+    for (const element of expr.contents) {
+      this.print(element)
+    }
+  }
+  visitBarLineExpr(expr: BarLine) {
+    this.space()
+    this.emit(expr.barline.lexeme)
+    this.space()
+  }
+  visitNthRepeatExpr(expr: Nth_repeat) {
+    // numbers split from `|1` or `:|2` tokens
+    // stay glued to their bar line
+    if (expr.repeat.type === TokenType.NUMBER) this.pendingSpace = false
+    this.emit(expr.repeat.lexeme)
+  }
+  visitAnnotationExpr(expr: Annotation) {
+    this.emit(expr.text.lexeme)
+  }
+  visitDecorationExpr(expr: Decoration) {
+    this.emit(expr.decoration.lexeme)
+  }
+  visitSymbolExpr(expr: Symbol) {
+    this.emit(expr.symbol.lexeme)
+  }
+  visitTupletExpr(expr: Tuplet) {
+    this.emit(expr.p.lexeme)
+    const [first, second] = expr.separators
+    if (first && first.type === TokenType.COLON_DBL) {
+      this.emit(first.lexeme + (expr.r ? expr.r.lexeme : ""))
+      return
+    }
+    if (first || expr.q || expr.r) {
+      this.emit(":" + (expr.q ? expr.q.lexeme : ""))
+    }
+    if (second || expr.r) this.emit(":" + (expr.r ? expr.r.lexeme : ""))
+  }
+  visitYSpacerExpr(expr: YSPACER) {
+    this.emit(expr.ySpacer.lexeme)
+    if (expr.number) this.emit(expr.number.lexeme)
+  }
+  visitInlineFieldExpr(expr: Inline_field) {
+    this.emit("[")
+    this.emit(expr.field.lexeme)
+    for (const token of expr.text) this.emit(token.lexeme)
+    this.emit("]")
+  }
+  visitChordExpr(expr: Chord) {
+    this.emit("[")
+    for (const element of expr.contents) {
+      this.print(element)
+    }
+    this.emit("]")
+    if (expr.rhythm) expr.rhythm.accept(this)
+  }
+  visitGraceGroupExpr(expr: Grace_group) {
+    this.emit(expr.isAccacciatura ? "{/" : "{")
+    for (const note of expr.notes) note.accept(this)
+    this.emit("}")
+  }
+  visitSlurGroupExpr(expr: Slur_group) {
+    this.emit("(")
+    for (const element of expr.contents) {
+      this.print(element)
+    }
+    this.emit(")")
+  }
+  visitNoteExpr(expr: Note) {
+    expr.pitch.accept(this)
+    if (expr.rhythm) expr.rhythm.accept(this)
+    if (expr.tie) this.emit("-")
   }
   visitPitchExpr(expr: Pitch) {
-    return `(Pitch ${expr.alteration?.lexeme} ${expr.noteLetter.lexeme} ${expr.octave?.lexeme})`
+    if (expr.alteration) this.emit(expr.alteration.lexeme)
+    this.emit(expr.noteLetter.lexeme)
+    if (expr.octave) this.emit(expr.octave.lexeme)
   }
-  visitFileHeaderExpr(expr: File_header): string {
-    return `(File_header ${expr.text})`
+  visitRestExpr(expr: Rest) {
+    this.emit(expr.rest.lexeme)
   }
-  visitTuneExpr(expr: Tune): string {
-    return `(Tune ${expr.tune_header.accept(expr.tune_header)} ${expr.body.accept(this)})`
+  visitMultiMeasureRestExpr(expr: MultiMeasureRest) {
+    this.emit(expr.rest.lexeme)
+    if (expr.length) this.emit(expr.length.lexeme)
   }
-  visitRhythmExpr(expr: Rhythm): string {
-    return `(Rhythm ${expr.value.accept(this)})`
+  visitRhythmExpr(expr: Rhythm) {
+    if (expr.numerator) this.emit(expr.numerator.lexeme)
+    if (expr.separator) this.emit(expr.separator.lexeme)
+    if (expr.denominator) this.emit(expr.denominator.lexeme)
+    if (expr.broken) this.emit(expr.broken.lexeme)
   }
-  //, visitRhythmExpr, visitLyricSectionExpr, visitRestExpr
 }
- */
@@ -0,0 +1,264 @@
+import { resolveDurations, TuneDurations } from "./Duration"
+import {
+  Annotation,
+  BarLine,
+  Chord,
+  Expr,
+  Info_line,
+  Inline_field,
+  MultiMeasureRest,
+  Note,
+  Rest,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue } from "./fields"
+import { toNumber } from "./rational"
+import Token from "./token"
+
+export type Bar = {
+  // index of the bar's first element in the tune's body,
+  // or of the slur the bar starts in
+  start: number
+  // source offset of the bar's first note
+  offset: number
+  // onset and length of the bar, in whole notes
+  time: number
+  duration: number
+}
+
+/**
+ * Returns the index of the last value that is at most `value`,
+ * or -1 if they are all greater.
+ */
+const lastAtMost = (
+  values: Int32Array | Float64Array,
+  length: number,
+  value: number
+) => {
+  let low = 0
+  let high = length
+  while (low < high) {
+    const middle = (low + high) >>> 1
+    if (values[middle] <= value) low = middle + 1
+    else high = middle
+  }
+  return low - 1
+}
+
+/**
+ * The bars of one voice.
+ * Bar `n` starts at body index `starts[n]`, source offset `offsets[n]`
+ * and time `times[n]`, and `times[length]` is the end of the voice.
+ */
+export class VoiceBars {
+  name: string
+  length: number
+  starts: Int32Array
+  offsets: Int32Array
+  times: Float64Array
+  constructor(
+    name: string,
+    starts: Array<number>,
+    offsets: Array<number>,
+    times: Array<number>
+  ) {
+    this.name = name
+    this.length = starts.length
+    this.starts = Int32Array.from(starts)
+    this.offsets = Int32Array.from(offsets)
+    this.times = Float64Array.from(times)
+  }
+
+  barAt(n: number): Bar | undefined {
+    if (n < 0 || n >= this.length) return undefined
+    return {
+      start: this.starts[n],
+      offset: this.offsets[n],
+      time: this.times[n],
+      duration: this.times[n + 1] - this.times[n],
+    }
+  }
+
+  /**
+   * Returns the bar containing the source offset,
+   * or -1 if the offset comes before the first bar.
+   */
+  barAtOffset(offset: number) {
+    return lastAtMost(this.offsets, this.length, offset)
+  }
+
+  /**
+   * Returns the bar playing at the given time,
+   * or -1 if the time is out of the voice.
+   */
+  barAtTime(time: number) {
+    if (time < 0 || time >= this.times[this.length]) return -1
+    return lastAtMost(this.times, this.length, time)
+  }
+}
+
+/**
+ * The bars of each voice of a tune,
+ * the voices listed in the order they are declared.
+ */
+export class BarIndex {
+  voices: Array<VoiceBars>
+  constructor(voices: Array<VoiceBars>) {
+    this.voices = voices
+  }
+  voice(name: string) {
+    return this.voices.find((voice) => voice.name === name)
+  }
+  barAt(n: number, voice = 0) {
+    return this.voices[voice].barAt(n)
+  }
+  barAtOffset(offset: number, voice = 0) {
+    return this.voices[voice].barAtOffset(offset)
+  }
+  barAtTime(time: number, voice = 0) {
+    return this.voices[voice].barAtTime(time)
+  }
+}
+
+const isTimed = (element: Expr | Token) =>
+  element instanceof Note ||
+  element instanceof Chord ||
+  element instanceof MultiMeasureRest
+
+/**
+ * Source offset of the first token of a timed element.
+ */
+const firstOffset = (element: Expr | Token): number => {
+  if (element instanceof Token) return element.offset
+  if (element instanceof Note) {
+    const pitch = element.pitch
+    return pitch instanceof Rest
+      ? pitch.rest.offset
+      : (pitch.alteration || pitch.noteLetter).offset
+  }
+  if (element instanceof MultiMeasureRest) return element.rest.offset
+  if (element instanceof Annotation) return element.text.offset
+  if (element instanceof Chord) {
+    // the opening bracket isn't kept, it comes right before the contents
+    const first = element.contents[0]
+    return first ? firstOffset(first) - 1 : -1
+  }
+  return -1
+}
+
+type Voice = {
+  name: string
+  open: boolean
+  // index where the next bar starts
+  next: number
+  time: number
+  starts: Array<number>
+  offsets: Array<number>
+  times: Array<number>
+}
+
+/**
+ * Walks the body once, following the voice changes,
+ * and opens a bar at the first note after each bar line.
+ */
+class BarIndexer {
+  private durations: TuneDurations
+  private voices: Array<Voice> = []
+  // notes before the first voice field open a voice of their own
+  private voice: Voice | undefined
+
+  constructor(tune: Tune) {
+    this.durations = resolveDurations(tune)
+  }
+
+  index(tune: Tune) {
+    for (const line of tune.tune_header.info_lines) {
+      if (fieldName(line) === "V") this.voiceNamed(fieldValue(line))
+    }
+    this.voice = this.voices[0]
+    const sequence = tune.tune_body ? tune.tune_body.sequence : []
+    sequence.forEach((element, i) => this.element(element, i))
+    if (this.voices.length === 0) this.voiceNamed("")
+    return new BarIndex(
+      this.voices.map(
+        (voice) =>
+          new VoiceBars(
+            voice.name,
+            voice.starts,
+            voice.offsets,
+            voice.times.concat(voice.time)
+          )
+      )
+    )
+  }
+
+  /**
+   * Reads an element found at index `i` of the body.
+   * Slurs are read through, as bar lines may fall within them:
+   * a bar opening inside a slur starts at the slur's index.
+   */
+  private element(element: Expr | Token, i: number, nested = false) {
+    if (element instanceof Slur_group) {
+      for (const content of element.contents) this.element(content, i, true)
+    } else if (element instanceof BarLine) {
+      if (!this.voice) return
+      this.voice.open = false
+      this.voice.next = nested ? i : i + 1
+    } else if (
+      (element instanceof Info_line || element instanceof Inline_field) &&
+      fieldName(element) === "V"
+    ) {
+      this.voice = this.voiceNamed(fieldValue(element))
+      if (!this.voice.open) this.voice.next = nested ? i : i + 1
+    } else if (isTimed(element)) {
+      const voice = this.voice || (this.voice = this.voiceNamed(""))
+      if (!voice.open) {
+        voice.open = true
+        voice.starts.push(voice.next)
+        voice.offsets.push(firstOffset(element))
+        voice.times.push(voice.time)
+      }
+      voice.time += this.duration(element)
+    }
+  }
+
+  private duration(element: Expr | Token): number {
+    if (element instanceof Token) return 0
+    const duration = this.durations.durationOf(element)
+    return duration ? toNumber(duration) : 0
+  }
+
+  private voiceNamed(value: string) {
+    const name = value.split(/\s/)[0]
+    let voice = this.voices.find((voice) => voice.name === name)
+    if (!voice) {
+      voice = {
+        name,
+        open: false,
+        next: 0,
+        time: 0,
+        starts: [],
+        offsets: [],
+        times: [],
+      }
+      this.voices.push(voice)
+    }
+    return voice
+  }
+}
+
+const cache = new WeakMap<Tune, BarIndex>()
+
+/**
+ * Returns the bars of the tune's voices.
+ * The index is built in a single pass on first use, then cached per tune.
+ */
+export const indexBars = (tune: Tune): BarIndex => {
+  let index = cache.get(tune)
+  if (!index) {
+    index = new BarIndexer(tune).index(tune)
+    cache.set(tune, index)
+  }
+  return index
+}
@@ -0,0 +1,324 @@
+import { cpus } from "os"
+import { extname, join } from "path"
+import { Worker } from "worker_threads"
+import { resize } from "./buffers"
+import { Tune } from "./Expr"
+import { voiceMelodies } from "./MelodyIndex"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { mix } from "./sketches"
+import { splitTunes } from "./tunes"
+
+export type DedupOptions = {
+  // hash functions per signature, split into `bands` bands for LSH
+  hashes?: number
+  bands?: number
+  // note transitions per shingle
+  shingle?: number
+  // estimated similarity from which two tunes are duplicates
+  threshold?: number
+  // sketching threads, 0 to sketch on the calling thread
+  workers?: number
+  // tunes sent to a worker at once
+  batch?: number
+}
+
+const defaults = (options: DedupOptions) => ({
+  hashes: options.hashes ?? 64,
+  bands: options.bands ?? 16,
+  shingle: options.shingle ?? 3,
+  threshold: options.threshold ?? 0.8,
+  workers: options.workers ?? Math.max(1, cpus().length - 1),
+  batch: options.batch ?? 64,
+})
+
+const EMPTY = 0xffffffff
+
+const clamp = (value: number, limit: number) =>
+  Math.max(-limit, Math.min(limit, value))
+
+/**
+ * Shingles of a tune's melodies: hashes of runs of note transitions,
+ * each transition being the interval and the ratio of the durations,
+ * so they don't depend on the key nor on the unit note length.
+ */
+export const shingles = (tune: Tune, size = 3): Set<number> => {
+  const set = new Set<number>()
+  for (const { pitches, durations } of voiceMelodies(tune)) {
+    const transitions: Array<number> = []
+    for (let i = 1; i < pitches.length; i++) {
+      const interval = clamp(pitches[i] - pitches[i - 1], 24)
+      // in half octaves of duration
+      const ratio =
+        durations[i] > 0 && durations[i - 1] > 0
+          ? clamp(Math.round(2 * Math.log2(durations[i] / durations[i - 1])), 6)
+          : 0
+      transitions.push((interval + 24) * 13 + ratio + 6)
+    }
+    for (let start = 0; start + size <= transitions.length; start++) {
+      let hash = 0x811c9dc5
+      for (let i = start; i < start + size; i++) {
+        hash = Math.imul(hash ^ transitions[i], 0x01000193)
+      }
+      set.add(hash >>> 0)
+    }
+  }
+  return set
+}
+
+/**
+ * MinHash signature of the tune's shingles:
+ * the minimum of each hash function over the set.
+ * Tunes without shingles have a signature of `EMPTY` values.
+ */
+export const sketchTune = (tune: Tune, options: DedupOptions = {}) => {
+  const { hashes, shingle } = defaults(options)
+  const seeds = seedsFor(hashes)
+  const signature = new Uint32Array(hashes).fill(EMPTY)
+  for (const value of shingles(tune, shingle)) {
+    for (let i = 0; i < hashes; i++) {
+      const hash = mix(value ^ seeds[i])
+      if (hash < signature[i]) signature[i] = hash
+    }
+  }
+  return signature
+}
+
+// one seed per hash function, the same in every thread
+let seeds = new Uint32Array(0)
+const seedsFor = (hashes: number) => {
+  if (seeds.length < hashes) {
+    seeds = new Uint32Array(hashes)
+    for (let i = 0; i < hashes; i++) {
+      seeds[i] = mix(Math.imul(0x9e3779b9, i + 1))
+    }
+  }
+  return seeds
+}
+
+/**
+ * Sketches the first tune of the source.
+ */
+export const sketchSource = (source: string, options: DedupOptions = {}) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  if (!ast || ast.tune.length === 0) {
+    return new Uint32Array(defaults(options).hashes).fill(EMPTY)
+  }
+  return sketchTune(ast.tune[0], options)
+}
+
+/**
+ * Finds near duplicates among signatures added one at a time.
+ *
+ * Signatures are cut into bands, and tunes sharing a band's values
+ * land in the same bucket: only those are compared,
+ * so adding a tune doesn't cost a comparison with every other.
+ * Only the first tune of each group of duplicates is kept in the buckets.
+ */
+export class Deduplicator {
+  private hashes: number
+  private rows: number
+  private threshold: number
+  private buckets: Array<Map<number, Array<number>>> = []
+  // signatures of the kept tunes, and their numbers
+  private kept = new Uint32Array(0)
+  private keptIds: Array<number> = []
+  count = 0
+
+  constructor(options: DedupOptions = {}) {
+    const { hashes, bands, threshold } = defaults(options)
+    this.hashes = hashes
+    this.rows = Math.max(1, Math.floor(hashes / bands))
+    this.threshold = threshold
+    for (let band = 0; band * this.rows < hashes; band++) {
+      this.buckets.push(new Map())
+    }
+  }
+
+  /**
+   * Numbers the tune and returns the number of the earlier tune
+   * it duplicates, or -1.
+   */
+  add(signature: Uint32Array): number {
+    const id = this.count++
+    if (signature[0] === EMPTY) return -1
+    const keys = this.buckets.map((_, band) => this.bandKey(signature, band))
+    let best = -1
+    let bestSimilarity = this.threshold
+    const compared = new Set<number>()
+    keys.forEach((key, band) => {
+      for (const slot of this.buckets[band].get(key) || []) {
+        if (compared.has(slot)) continue
+        compared.add(slot)
+        const similarity = this.similarity(signature, slot)
+        if (similarity >= bestSimilarity) {
+          best = slot
+          bestSimilarity = similarity
+        }
+      }
+    })
+    if (best !== -1) return this.keptIds[best]
+
+    const slot = this.keptIds.push(id) - 1
+    if ((slot + 1) * this.hashes > this.kept.length) {
+      const size = Math.max(this.hashes * 64, this.kept.length * 2)
+      this.kept = resize(this.kept, size)
+    }
+    this.kept.set(signature, slot * this.hashes)
+    keys.forEach((key, band) => {
+      const bucket = this.buckets[band].get(key)
+      if (bucket) bucket.push(slot)
+      else this.buckets[band].set(key, [slot])
+    })
+    return -1
+  }
+
+  private bandKey(signature: Uint32Array, band: number) {
+    let hash = 0x811c9dc5
+    const end = Math.min(this.hashes, (band + 1) * this.rows)
+    for (let i = band * this.rows; i < end; i++) {
+      hash = Math.imul(hash ^ signature[i], 0x01000193)
+    }
+    return hash >>> 0
+  }
+
+  // share of equal values, an estimate of the shingles' Jaccard index
+  private similarity(signature: Uint32Array, slot: number) {
+    const start = slot * this.hashes
+    let equal = 0
+    for (let i = 0; i < this.hashes; i++) {
+      if (this.kept[start + i] === signature[i]) equal++
+    }
+    return equal / this.hashes
+  }
+}
+
+// batches sent to a worker, by number
+type Pending = Map<
+  number,
+  { resolve: (signatures: Uint32Array) => void; reject: (error: Error) => void }
+>
+
+/**
+ * Worker threads sketching batches of tune sources.
+ * Each batch goes to the worker with the fewest batches pending.
+ */
+class SketchPool {
+  private workers: Array<Worker> = []
+  private pending: Array<Pending> = []
+  // why each worker stopped, once it has
+  private stopped: Array<Error | null> = []
+  private next = 0
+
+  constructor(size: number, options: DedupOptions) {
+    const file = join(__dirname, `DedupWorker${extname(__filename)}`)
+    // under ts-node, the workers need its loader as well
+    const execArgv =
+      extname(__filename) === ".ts" ? ["-r", "ts-node/register"] : undefined
+    for (let i = 0; i < size; i++) {
+      const worker = new Worker(file, { workerData: options, execArgv })
+      const pending: Pending = new Map()
+      worker.on("message", ({ id, signatures }) => {
+        pending.get(id)!.resolve(signatures)
+        pending.delete(id)
+      })
+      const stop = (error: Error) => {
+        this.stopped[i] = this.stopped[i] || error
+        for (const batch of pending.values()) batch.reject(error)
+        pending.clear()
+      }
+      worker.on("error", stop)
+      // workers can also exit without an error, e.g. from `process.exit()`
+      worker.on("exit", (code) =>
+        stop(new Error(`sketch worker exited with code ${code}`))
+      )
+      this.workers.push(worker)
+      this.pending.push(pending)
+      this.stopped.push(null)
+    }
+  }
+
+  sketch(sources: Array<string>): Promise<Uint32Array> {
+    let w = 0
+    for (let i = 1; i < this.workers.length; i++) {
+      if (this.pending[i].size < this.pending[w].size) w = i
+    }
+    const id = this.next++
+    const stopped = this.stopped[w]
+    if (stopped) return Promise.reject(stopped)
+    return new Promise((resolve, reject) => {
+      this.pending[w].set(id, { resolve, reject })
+      this.workers[w].postMessage({ id, sources })
+    })
+  }
+
+  close() {
+    return Promise.all(this.workers.map((worker) => worker.terminate()))
+  }
+}
+
+/**
+ * Deduplicates an archive in one pass,
+ * yielding every tune in order with its offset in the archive
+ * and the number of the earlier tune it duplicates, or -1.
+ *
+ * Tunes are sketched in batches by a pool of workers,
+ * while the calling thread buckets the signatures as they come back.
+ */
+export async function* findDuplicates(
+  source: string,
+  options: DedupOptions = {}
+): AsyncGenerator<{ id: number; offset: number; duplicateOf: number }> {
+  const settings = defaults(options)
+  const deduplicator = new Deduplicator(settings)
+  const pool =
+    settings.workers > 0 ? new SketchPool(settings.workers, settings) : null
+  const sketch = (sources: Array<string>) => {
+    if (pool) return pool.sketch(sources)
+    const signatures = new Uint32Array(sources.length * settings.hashes)
+    sources.forEach((tune, i) => {
+      signatures.set(sketchSource(tune, settings), i * settings.hashes)
+    })
+    return Promise.resolve(signatures)
+  }
+  // batches in flight, in archive order
+  const queue: Array<{
+    offsets: Array<number>
+    sketched: Promise<Uint32Array>
+  }> = []
+  const limit = Math.max(1, settings.workers * 2)
+  let sources: Array<string> = []
+  let offsets: Array<number> = []
+  async function* drain(until: number) {
+    while (queue.length > until) {
+      const batch = queue.shift()!
+      const signatures = await batch.sketched
+      for (let i = 0; i < batch.offsets.length; i++) {
+        const signature = signatures.subarray(
+          i * settings.hashes,
+          (i + 1) * settings.hashes
+        )
+        const id = deduplicator.count
+        const duplicateOf = deduplicator.add(signature)
+        yield { id, offset: batch.offsets[i], duplicateOf }
+      }
+    }
+  }
+
+  try {
+    for (const chunk of splitTunes(source)) {
+      if (!chunk.source.startsWith("X:")) continue
+      sources.push(chunk.source)
+      offsets.push(chunk.offset)
+      if (sources.length < settings.batch) continue
+      queue.push({ offsets, sketched: sketch(sources) })
+      sources = []
+      offsets = []
+      yield* drain(limit - 1)
+    }
+    if (sources.length > 0) queue.push({ offsets, sketched: sketch(sources) })
+    yield* drain(0)
+  } finally {
+    if (pool) await pool.close()
+  }
+}
@@ -0,0 +1,18 @@
+import { parentPort, workerData } from "worker_threads"
+import { DedupOptions, sketchSource } from "./Dedup"
+
+/**
+ * Sketches the batches of tunes sent by the `findDuplicates` pool,
+ * and sends their signatures back end to end.
+ */
+const options: DedupOptions = workerData
+parentPort!.on(
+  "message",
+  ({ id, sources }: { id: number; sources: Array<string> }) => {
+    const sketches = sources.map((source) => sketchSource(source, options))
+    const length = sketches.length > 0 ? sketches[0].length : 0
+    const signatures = new Uint32Array(sketches.length * length)
+    sketches.forEach((sketch, i) => signatures.set(sketch, i * length))
+    parentPort!.postMessage({ id, signatures }, [signatures.buffer])
+  }
+)
@@ -0,0 +1,268 @@
+import {
+  Chord,
+  Expr,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  MultiMeasureRest,
+  Note,
+  Rhythm,
+  Slur_group,
+  Tune,
+  Tuplet,
+} from "./Expr"
+import { fieldName, fieldValue, headerValue } from "./fields"
+import { multiply, ONE, Rational, rational, ZERO } from "./rational"
+import Token from "./token"
+
+export type Meter = { numerator: number; denominator: number }
+
+/**
+ * Parses the value of an `M:` field.
+ * Returns null for free meter (`M:none` or an empty field).
+ * Compound numerators such as `2+3/8` are summed.
+ */
+export const parseMeter = (value: string): Meter | null => {
+  const text = value.trim()
+  if (text === "C") return { numerator: 4, denominator: 4 }
+  if (text === "C|") return { numerator: 2, denominator: 2 }
+  const match = /^\(?([\d+ ]+)\)?\s*\/\s*(\d+)/.exec(text)
+  if (!match) return null
+  let numerator = 0
+  for (const part of match[1].split("+")) numerator += Number(part) || 0
+  const denominator = Number(match[2])
+  if (!numerator || !denominator) return null
+  return { numerator, denominator }
+}
+
+/**
+ * Parses the value of an `L:` field, e.g. `1/8`.
+ */
+export const parseUnitLength = (value: string): Rational | null => {
+  const match = /^(\d+)(?:\s*\/\s*(\d+))?/.exec(value.trim())
+  if (!match) return null
+  const num = Number(match[1])
+  const den = match[2] ? Number(match[2]) : 1
+  if (!num || !den) return null
+  return rational(num, den)
+}
+
+/**
+ * When a tune has no `L:` field,
+ * meters below 3/4 default to sixteenth notes, others to eighth notes.
+ */
+export const defaultUnitLength = (meter: Meter | null): Rational => {
+  if (meter && meter.numerator / meter.denominator < 0.75) {
+    return rational(1, 16)
+  }
+  return rational(1, 8)
+}
+
+export const meterLength = (meter: Meter | null): Rational =>
+  meter ? rational(meter.numerator, meter.denominator) : ONE
+
+/**
+ * Multiplier written in a rhythm, relative to the unit note length.
+ * `/` halves the length, `//` quarters it, `3/2` multiplies it by 1.5.
+ * Broken rhythms are left out, they depend on the neighbouring note.
+ */
+export const rhythmValue = (rhythm?: Rhythm): Rational => {
+  if (!rhythm) return ONE
+  const num = rhythm.numerator ? Number(rhythm.numerator.lexeme) : 1
+  let den = 1
+  if (rhythm.separator) {
+    const slashes = rhythm.separator.lexeme.length
+    den = rhythm.denominator
+      ? Number(rhythm.denominator.lexeme) * 2 ** (slashes - 1)
+      : 2 ** slashes
+  }
+  return rational(num, den)
+}
+
+/**
+ * Returns the factors applied to both sides of a broken rhythm:
+ * `a>b` lengthens `a` by half and shortens `b` by half,
+ * `a>>b` uses 7/4 and 1/4, `a<b` swaps them.
+ */
+export const brokenFactors = (
+  broken: Token
+): { first: Rational; second: Rational } => {
+  const short = rational(1, 2 ** broken.lexeme.length)
+  const long = rational(2 * short.den - 1, short.den)
+  return broken.lexeme.charAt(0) === ">"
+    ? { first: long, second: short }
+    : { first: short, second: long }
+}
+
+/**
+ * Factor applied to the notes of a tuplet, `q/p`.
+ * Without `q`, duplets, quadruplets and octuplets take the time of 3,
+ * triplets and sextuplets the time of 2,
+ * and odd tuplets the time of 3 in compound meters, of 2 otherwise.
+ */
+export const tupletFactor = (tuplet: Tuplet, meter: Meter | null): Rational => {
+  const p = Number(tuplet.p.lexeme.substring(1))
+  if (!p) return ONE
+  let q: number
+  if (tuplet.q) {
+    q = Number(tuplet.q.lexeme)
+  } else if (p === 2 || p === 4 || p === 8) {
+    q = 3
+  } else if (p === 3 || p === 6) {
+    q = 2
+  } else {
+    const compound =
+      meter !== null && meter.numerator % 3 === 0 && meter.numerator > 3
+    q = compound ? 3 : 2
+  }
+  return rational(q, p)
+}
+
+export type DurationElement = Note | Chord | MultiMeasureRest
+
+/**
+ * Durations of a tune's notes, chords and rests,
+ * in fractions of a whole note.
+ *
+ * Elements are listed in the order of the tune's body,
+ * and each duration is stored as a reduced fraction
+ * in the `numerators` and `denominators` arrays, at the element's index.
+ * Notes of grace groups are listed with a zero duration.
+ */
+export class TuneDurations {
+  elements: Array<DurationElement>
+  numerators: Int32Array
+  denominators: Int32Array
+  private index: Map<Expr, number>
+  constructor(
+    elements: Array<DurationElement>,
+    numerators: Array<number>,
+    denominators: Array<number>
+  ) {
+    this.elements = elements
+    this.numerators = Int32Array.from(numerators)
+    this.denominators = Int32Array.from(denominators)
+    this.index = new Map()
+    elements.forEach((element, i) => this.index.set(element, i))
+  }
+  get length() {
+    return this.elements.length
+  }
+  duration(i: number): Rational {
+    return { num: this.numerators[i], den: this.denominators[i] }
+  }
+  indexOf(element: Expr) {
+    const i = this.index.get(element)
+    return i === undefined ? -1 : i
+  }
+  durationOf(element: Expr): Rational | undefined {
+    const i = this.index.get(element)
+    return i === undefined ? undefined : this.duration(i)
+  }
+}
+
+/**
+ * Walks a tune once, tracking the unit note length and the meter
+ * from the header, the body's fields and the inline fields.
+ */
+class DurationResolver {
+  private unit: Rational = rational(1, 8)
+  private meter: Meter | null = null
+  // factor left by a broken rhythm, for the next note
+  private broken: Rational | null = null
+  private elements: Array<DurationElement> = []
+  private numerators: Array<number> = []
+  private denominators: Array<number> = []
+
+  resolve(tune: Tune) {
+    const info_lines = tune.tune_header.info_lines
+    const meter = headerValue(info_lines, "M")
+    this.meter = meter === undefined ? null : parseMeter(meter)
+    const unit = headerValue(info_lines, "L")
+    this.unit =
+      (unit !== undefined && parseUnitLength(unit)) ||
+      defaultUnitLength(this.meter)
+    if (tune.tune_body) {
+      for (const element of tune.tune_body.sequence) this.element(element)
+    }
+    return new TuneDurations(this.elements, this.numerators, this.denominators)
+  }
+
+  private element(element: Expr | Token) {
+    if (element instanceof Note) {
+      this.timed(element, element.rhythm, rhythmValue(element.rhythm))
+    } else if (element instanceof Chord) {
+      const first = element.contents.find(
+        (content): content is Note => content instanceof Note
+      )
+      const written = multiply(
+        rhythmValue(first?.rhythm),
+        rhythmValue(element.rhythm)
+      )
+      this.timed(element, element.rhythm, written)
+    } else if (element instanceof MultiMeasureRest) {
+      const bars = element.length ? Number(element.length.lexeme) : 1
+      this.record(element, multiply(rational(bars), meterLength(this.meter)))
+    } else if (element instanceof Grace_group) {
+      for (const note of element.notes) this.record(note, ZERO)
+    } else if (element instanceof Slur_group) {
+      for (const content of element.contents) this.element(content)
+    } else if (
+      element instanceof Info_line ||
+      element instanceof Inline_field
+    ) {
+      this.field(element)
+    }
+  }
+
+  private timed(
+    element: Note | Chord,
+    rhythm: Rhythm | undefined,
+    written: Rational
+  ) {
+    let duration = multiply(written, this.unit)
+    if (element.tuplet) {
+      duration = multiply(duration, tupletFactor(element.tuplet, this.meter))
+    }
+    if (this.broken) {
+      duration = multiply(duration, this.broken)
+      this.broken = null
+    }
+    if (rhythm && rhythm.broken) {
+      const factors = brokenFactors(rhythm.broken)
+      duration = multiply(duration, factors.first)
+      this.broken = factors.second
+    }
+    this.record(element, duration)
+  }
+
+  private record(element: DurationElement, duration: Rational) {
+    this.elements.push(element)
+    this.numerators.push(duration.num)
+    this.denominators.push(duration.den)
+  }
+
+  private field(field: Info_line | Inline_field) {
+    const name = fieldName(field)
+    if (name === "L") {
+      this.unit = parseUnitLength(fieldValue(field)) || this.unit
+    } else if (name === "M") {
+      this.meter = parseMeter(fieldValue(field))
+    }
+  }
+}
+
+const cache = new WeakMap<Tune, TuneDurations>()
+
+/**
+ * Returns the durations of the tune's notes, chords and rests.
+ * Results are cached per tune.
+ */
+export const resolveDurations = (tune: Tune): TuneDurations => {
+  let durations = cache.get(tune)
+  if (!durations) {
+    durations = new DurationResolver().resolve(tune)
+    cache.set(tune, durations)
+  }
+  return durations
+}
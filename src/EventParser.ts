@@ -0,0 +1,731 @@
+import { parserError } from "./error"
+import { SymbolTable } from "./Symbols"
+import Token from "./token"
+import { TokenType } from "./types"
+
+/*
+ * Events passed to the handlers.
+ * Each kind of event is a single object, updated before each call:
+ * handlers should copy the values they keep,
+ * the objects being overwritten by the next event of their kind.
+ */
+
+export type TuneEvent = {
+  // value of the `X:` field
+  reference: string
+  offset: number
+  line: number
+}
+
+export type FieldEvent = {
+  // letter of the field, e.g. `K`
+  name: string
+  // text of the field, without its key nor its comment
+  value: string
+  // written in brackets in the music, e.g. `[K:G]`
+  inline: boolean
+  offset: number
+  line: number
+}
+
+export type NoteEvent = {
+  // `^`, `_`, `=`, `^^`, `__` or empty
+  alteration: string
+  // note letter, `z` or `x` for rests
+  letter: string
+  rest: boolean
+  // octave marks, e.g. `,,` or `'`
+  octave: string
+  // multiplier of the unit note length, as written
+  numerator: number
+  denominator: number
+  // `>` or `<` signs of a broken rhythm
+  broken: string
+  tie: boolean
+  // in a chord, or a grace note
+  chord: boolean
+  grace: boolean
+  offset: number
+  line: number
+}
+
+export type ChordEvent = {
+  // notes in the chord
+  notes: number
+  numerator: number
+  denominator: number
+  broken: string
+  offset: number
+  line: number
+}
+
+export type TextEvent = {
+  text: string
+  offset: number
+  line: number
+}
+
+export type DecorationEvent = {
+  // as written, e.g. `!trill!`, `.` or `T`
+  text: string
+  // decoration a redefinable symbol stands for, e.g. `!trill!` for `T`
+  symbol: string
+  offset: number
+  line: number
+}
+
+export type TupletEvent = {
+  p: number
+  // 0 when not written
+  q: number
+  r: number
+  offset: number
+  line: number
+}
+
+export type RestEvent = {
+  // `Z` or `X`
+  text: string
+  // bars, 1 when not written
+  bars: number
+  offset: number
+  line: number
+}
+
+export type ErrorEvent = {
+  message: string
+  // token the error was found at
+  lexeme: string
+  offset: number
+  line: number
+}
+
+/**
+ * Callbacks of the event parser, all optional.
+ * Chords call `onChordStart`, `onNote` for each note, then `onChord`
+ * once their rhythm is read. Grace groups and slurs frame their contents.
+ */
+export interface ParserHandler {
+  onTuneStart?(event: TuneEvent): void
+  onTuneEnd?(event: TuneEvent): void
+  onInfoLine?(event: FieldEvent): void
+  onComment?(event: TextEvent): void
+  onNote?(event: NoteEvent): void
+  onChordStart?(event: ChordEvent): void
+  onChord?(event: ChordEvent): void
+  onBarLine?(event: TextEvent): void
+  // numbers of an ending, e.g. `1` of `|1` or `[1`
+  onNthRepeat?(event: TextEvent): void
+  onAnnotation?(event: TextEvent): void
+  onDecoration?(event: DecorationEvent): void
+  onGraceStart?(event: TextEvent): void
+  onGraceEnd?(event: TextEvent): void
+  onSlurStart?(event: TextEvent): void
+  onSlurEnd?(event: TextEvent): void
+  onTuplet?(event: TupletEvent): void
+  onMultiMeasureRest?(event: RestEvent): void
+  onLineBreak?(event: TextEvent): void
+  // without this handler, errors are reported as the parser does
+  onError?(event: ErrorEvent): void
+}
+
+const isAlteration = (type: TokenType) =>
+  type === TokenType.SHARP ||
+  type === TokenType.SHARP_DBL ||
+  type === TokenType.FLAT ||
+  type === TokenType.FLAT_DBL ||
+  type === TokenType.NATURAL
+
+/**
+ * Parses the tokens of an archive into calls to the handler,
+ * instead of building a tree.
+ *
+ * It follows the grammar of the `Parser`, and recovers from errors
+ * the same way, but allocates no `Expr`:
+ * the events are a fixed set of objects reused from one call to the next,
+ * so archives stream through with next to no garbage.
+ */
+export class EventParser {
+  private tokens: Array<Token>
+  private current = 0
+  private handler: ParserHandler
+  private symbols = new SymbolTable()
+  // symbols redefined in the file header
+  private header = new SymbolTable()
+  private tuneEvent: TuneEvent = { reference: "", offset: 0, line: 0 }
+  private field: FieldEvent = {
+    name: "",
+    value: "",
+    inline: false,
+    offset: 0,
+    line: 0,
+  }
+  private note: NoteEvent = {
+    alteration: "",
+    letter: "",
+    rest: false,
+    octave: "",
+    numerator: 1,
+    denominator: 1,
+    broken: "",
+    tie: false,
+    chord: false,
+    grace: false,
+    offset: 0,
+    line: 0,
+  }
+  private chordEvent: ChordEvent = {
+    notes: 0,
+    numerator: 1,
+    denominator: 1,
+    broken: "",
+    offset: 0,
+    line: 0,
+  }
+  private text: TextEvent = { text: "", offset: 0, line: 0 }
+  private decoration: DecorationEvent = {
+    text: "",
+    symbol: "",
+    offset: 0,
+    line: 0,
+  }
+  private tupletEvent: TupletEvent = { p: 0, q: 0, r: 0, offset: 0, line: 0 }
+  private restEvent: RestEvent = { text: "", bars: 1, offset: 0, line: 0 }
+  private errorEvent: ErrorEvent = {
+    message: "",
+    lexeme: "",
+    offset: 0,
+    line: 0,
+  }
+  // rhythm read by `rhythm()`
+  private numerator = 1
+  private denominator = 1
+  private broken = ""
+
+  constructor(tokens: Array<Token>, handler: ParserHandler) {
+    this.tokens = tokens
+    this.handler = handler
+  }
+
+  /**
+   * Parses the whole file.
+   * Returns false if it stopped at an error outside of a tune body.
+   */
+  parse() {
+    try {
+      this.file_structure()
+      return true
+    } catch {
+      return false
+    }
+  }
+
+  private file_structure() {
+    while (!this.isAtEnd()) {
+      const pkd = this.peek()
+      if (this.current === 0 && pkd.lexeme !== "X:") this.file_header()
+      else if (pkd.type === TokenType.LETTER_COLON) this.tune()
+      // empty lines separating the tunes
+      else if (pkd.type === TokenType.EOL) this.advance()
+      else throw this.error(pkd, "Expected a tune or file header")
+    }
+  }
+
+  // skipped up to the first tune, but for its `U:` fields
+  private file_header() {
+    let line = ""
+    while (!this.isAtEnd() && this.peek().lexeme !== "X:") {
+      const token = this.advance()
+      if (token.type === TokenType.EOL) {
+        this.headerField(line)
+        line = ""
+      } else if (token.type !== TokenType.COMMENT) {
+        line += token.lexeme
+      }
+    }
+    this.headerField(line)
+  }
+
+  private headerField(line: string) {
+    if (line.startsWith("U:")) this.header.define(line.substring(2))
+  }
+
+  private tune() {
+    this.symbols = this.header.copy()
+    const start = this.peek()
+    this.tuneEvent.reference = ""
+    this.tuneEvent.offset = start.offset
+    this.tuneEvent.line = start.line
+    let started = false
+    while (!this.isAtEnd()) {
+      if (this.peek().type === TokenType.LETTER_COLON) {
+        this.info_line()
+        if (!started) {
+          // the tune starts once its `X:` line is read
+          if (this.field.name === "X") {
+            this.tuneEvent.reference = this.field.value
+          }
+          this.handler.onTuneStart?.(this.tuneEvent)
+          started = true
+        }
+        this.handler.onInfoLine?.(this.field)
+      } else if (
+        this.peek().type === TokenType.EOL &&
+        this.peekNext().type === TokenType.LETTER_COLON
+      ) {
+        this.advance()
+      } else {
+        break
+      }
+    }
+    if (!started) this.handler.onTuneStart?.(this.tuneEvent)
+    this.advance()
+    if (!this.check(TokenType.EOL) && !this.isAtEnd()) this.tune_body()
+    this.handler.onTuneEnd?.(this.tuneEvent)
+  }
+
+  /**
+   * Reads an info line into the field event.
+   */
+  private info_line() {
+    const key = this.peek()
+    this.advance()
+    let value = ""
+    let comment = false
+    while (!this.isAtEnd()) {
+      if (
+        this.peek().type === TokenType.EOL &&
+        this.peekNext().type !== TokenType.PLUS_COLON
+      ) {
+        break
+      }
+      if (this.peek().type === TokenType.COMMENT) comment = true
+      if (!comment) value += this.peek().lexeme
+      this.advance()
+    }
+    this.setField(key, value.trim(), false)
+  }
+
+  private setField(key: Token, value: string, inline: boolean) {
+    const field = this.field
+    field.name = key.lexeme.charAt(0)
+    field.value = value
+    field.inline = inline
+    field.offset = key.offset
+    field.line = key.line
+    if (field.name === "U") this.symbols.define(value)
+  }
+
+  private tune_body() {
+    while (!this.isAtEnd()) {
+      try {
+        const type = this.peek().type
+        if (type === TokenType.COMMENT) {
+          this.emitText(this.handler.onComment, this.peek())
+          this.advance()
+        } else if (type === TokenType.LETTER_COLON) {
+          this.info_line()
+          this.handler.onInfoLine?.(this.field)
+        } else if (
+          type === TokenType.EOL &&
+          this.peekNext().type === TokenType.EOL
+        ) {
+          break
+        } else {
+          this.music_content()
+        }
+      } catch {
+        this.synchronize()
+      }
+    }
+  }
+
+  private music_content() {
+    const token = this.peek()
+    const handler = this.handler
+    switch (token.type) {
+      case TokenType.EOL:
+        this.emitText(handler.onLineBreak, token)
+        this.advance()
+        break
+      case TokenType.DOLLAR:
+      case TokenType.RESERVED_CHAR:
+      case TokenType.WHITESPACE:
+      case TokenType.ANTISLASH_EOL:
+        this.advance()
+        break
+      case TokenType.BARLINE:
+      case TokenType.BAR_COLON:
+      case TokenType.BAR_DBL:
+      case TokenType.BAR_RIGHTBRKT:
+      case TokenType.COLON_BAR:
+      case TokenType.COLON_DBL:
+      case TokenType.LEFTBRKT_BAR:
+        this.emitText(handler.onBarLine, token)
+        this.advance()
+        break
+      case TokenType.STRING:
+        this.emitText(handler.onAnnotation, token)
+        this.advance()
+        break
+      case TokenType.DOT:
+      case TokenType.TILDE:
+        if (!this.isDecoration()) {
+          throw this.error(
+            token,
+            "Unexpected token: " +
+              token.lexeme +
+              "\nline " +
+              token.line +
+              "\n decorations should be followed by a note"
+          )
+        }
+        this.emitDecoration(token, this.symbols.resolve(token.lexeme))
+        this.advance()
+        break
+      case TokenType.FLAT:
+      case TokenType.FLAT_DBL:
+      case TokenType.NATURAL:
+      case TokenType.NOTE_LETTER:
+      case TokenType.SHARP:
+      case TokenType.SHARP_DBL:
+        this.parse_note(false, false)
+        break
+      case TokenType.LEFT_BRACE:
+        this.grace_group()
+        break
+      case TokenType.BAR_DIGIT:
+      case TokenType.COLON_BAR_DIGIT:
+        // the bar line and the ending's number are a single token
+        const bar = token.type === TokenType.BAR_DIGIT ? 1 : 2
+        this.emitText(handler.onBarLine, token, token.lexeme.substring(0, bar))
+        this.emitText(
+          handler.onNthRepeat,
+          token,
+          token.lexeme.substring(bar),
+          bar
+        )
+        this.advance()
+        break
+      case TokenType.LEFTBRKT_NUMBER:
+        this.emitText(handler.onNthRepeat, token, token.lexeme.substring(1), 1)
+        this.advance()
+        break
+      case TokenType.LEFTBRKT:
+        if (this.peekNext().type === TokenType.LETTER_COLON) {
+          this.inline_field()
+        } else {
+          this.chord()
+        }
+        break
+      case TokenType.LEFTPAREN:
+        this.slurGroup()
+        break
+      case TokenType.LEFTPAREN_NUMBER:
+        this.tuplet_marker()
+        break
+      case TokenType.SYMBOL:
+        this.emitDecoration(token, "")
+        this.advance()
+        break
+      case TokenType.LETTER:
+        if (token.lexeme === "y") {
+          this.advance()
+          if (this.check(TokenType.NUMBER)) this.advance()
+        } else if (this.isDecoration()) {
+          this.emitDecoration(token, this.symbols.resolve(token.lexeme))
+          this.advance()
+        } else if (this.isMultiMeasureRest()) {
+          this.multiMeasureRest()
+        } else if (this.isRest()) {
+          this.parse_note(false, false)
+        } else {
+          throw this.error(token, "Unexpected token after letter")
+        }
+        break
+      default:
+        throw this.error(token, "Unexpected token in music code")
+    }
+  }
+
+  /**
+   * `(p`, `(p:q`, `(p:q:r` or `(p::r`
+   */
+  private tuplet_marker() {
+    const token = this.peek()
+    const tuplet = this.tupletEvent
+    tuplet.p = Number(token.lexeme.substring(1))
+    tuplet.q = 0
+    tuplet.r = 0
+    tuplet.offset = token.offset
+    tuplet.line = token.line
+    this.advance()
+    if (this.check(TokenType.COLON)) {
+      this.advance()
+      if (this.check(TokenType.NUMBER)) tuplet.q = Number(this.advance().lexeme)
+      if (this.check(TokenType.COLON)) {
+        this.advance()
+        if (this.check(TokenType.NUMBER)) {
+          tuplet.r = Number(this.advance().lexeme)
+        }
+      }
+    } else if (this.check(TokenType.COLON_DBL)) {
+      this.advance()
+      if (this.check(TokenType.NUMBER)) tuplet.r = Number(this.advance().lexeme)
+    }
+    this.handler.onTuplet?.(tuplet)
+  }
+
+  private chord() {
+    const start = this.peek()
+    const chord = this.chordEvent
+    chord.notes = 0
+    chord.offset = start.offset
+    chord.line = start.line
+    chord.numerator = 1
+    chord.denominator = 1
+    chord.broken = ""
+    this.handler.onChordStart?.(chord)
+    this.advance()
+    let notes = 0
+    while (!this.isAtEnd() && !this.check(TokenType.RIGHT_BRKT)) {
+      if (this.check(TokenType.STRING)) {
+        this.emitText(this.handler.onAnnotation, this.peek())
+        this.advance()
+      } else {
+        this.parse_note(true, false)
+        notes++
+      }
+    }
+    this.consume(this.peek().type, "Expected a right bracket")
+    this.rhythm()
+    // handlers may have read the start event in between
+    chord.notes = notes
+    chord.offset = start.offset
+    chord.line = start.line
+    chord.numerator = this.numerator
+    chord.denominator = this.denominator
+    chord.broken = this.broken
+    this.handler.onChord?.(chord)
+  }
+
+  private inline_field() {
+    this.advance()
+    const key = this.peek()
+    this.advance()
+    let value = ""
+    while (!this.isAtEnd() && !this.check(TokenType.RIGHT_BRKT)) {
+      value += this.peek().lexeme
+      this.advance()
+    }
+    this.consume(this.peek().type, "Expected a right bracket")
+    this.setField(key, value.trim(), true)
+    this.handler.onInfoLine?.(this.field)
+  }
+
+  private grace_group() {
+    const start = this.peek()
+    this.advance()
+    const acciaccatura = this.check(TokenType.SLASH)
+    this.emitText(this.handler.onGraceStart, start, acciaccatura ? "{/" : "{")
+    if (acciaccatura) this.advance()
+    while (!this.isAtEnd() && !this.check(TokenType.RIGHT_BRACE)) {
+      this.parse_note(false, true)
+    }
+    const end = this.peek()
+    this.consume(TokenType.RIGHT_BRACE, "expected a right brace")
+    this.emitText(this.handler.onGraceEnd, end)
+  }
+
+  private slurGroup() {
+    this.emitText(this.handler.onSlurStart, this.peek())
+    this.advance()
+    while (!this.isAtEnd() && !this.check(TokenType.RIGHT_PAREN)) {
+      this.music_content()
+    }
+    const end = this.peek()
+    this.consume(TokenType.RIGHT_PAREN, "expected a right parenthesis")
+    this.emitText(this.handler.onSlurEnd, end)
+  }
+
+  private parse_note(chord: boolean, grace: boolean) {
+    const start = this.peek()
+    const note = this.note
+    note.alteration = ""
+    note.octave = ""
+    note.rest = false
+    if (isAlteration(start.type) || start.type === TokenType.NOTE_LETTER) {
+      if (isAlteration(start.type)) note.alteration = this.advance().lexeme
+      if (!this.check(TokenType.NOTE_LETTER)) {
+        throw this.error(this.peek(), "Expected a note letter")
+      }
+      note.letter = this.advance().lexeme
+      if (this.check(TokenType.COMMA) || this.check(TokenType.APOSTROPHE)) {
+        note.octave = this.advance().lexeme
+      }
+    } else if (this.isRest()) {
+      note.letter = this.advance().lexeme
+      note.rest = true
+    } else {
+      throw this.error(start, "Unexpected token in note")
+    }
+    this.rhythm()
+    note.tie = false
+    if (this.check(TokenType.MINUS)) {
+      note.tie = true
+      this.advance()
+    }
+    note.numerator = this.numerator
+    note.denominator = this.denominator
+    note.broken = this.broken
+    note.chord = chord
+    note.grace = grace
+    note.offset = start.offset
+    note.line = start.line
+    this.handler.onNote?.(note)
+  }
+
+  private multiMeasureRest() {
+    const token = this.advance()
+    const rest = this.restEvent
+    rest.text = token.lexeme
+    rest.bars = 1
+    rest.offset = token.offset
+    rest.line = token.line
+    if (this.check(TokenType.NUMBER)) rest.bars = Number(this.advance().lexeme)
+    this.handler.onMultiMeasureRest?.(rest)
+  }
+
+  /**
+   * Reads an optional rhythm into `numerator`, `denominator` and `broken`,
+   * the way `rhythmValue` reads a `Rhythm`.
+   */
+  private rhythm() {
+    this.numerator = 1
+    this.denominator = 1
+    this.broken = ""
+    if (this.check(TokenType.NUMBER)) {
+      this.numerator = Number(this.advance().lexeme)
+    }
+    if (this.check(TokenType.SLASH)) {
+      const slashes = this.advance().lexeme.length
+      this.denominator = this.check(TokenType.NUMBER)
+        ? Number(this.advance().lexeme) * 2 ** (slashes - 1)
+        : 2 ** slashes
+    }
+    if (this.check(TokenType.GREATER) || this.check(TokenType.LESS)) {
+      this.broken = this.advance().lexeme
+    }
+  }
+
+  private emitText(
+    callback: ((event: TextEvent) => void) | undefined,
+    token: Token,
+    text = token.lexeme,
+    skip = 0
+  ) {
+    if (!callback) return
+    this.text.text = text
+    this.text.offset = token.offset + skip
+    this.text.line = token.line
+    callback.call(this.handler, this.text)
+  }
+
+  private emitDecoration(token: Token, symbol = "") {
+    if (!this.handler.onDecoration) return
+    const decoration = this.decoration
+    decoration.text = token.lexeme
+    decoration.symbol = symbol
+    decoration.offset = token.offset
+    decoration.line = token.line
+    this.handler.onDecoration(decoration)
+  }
+
+  private isDecoration() {
+    const token = this.peek()
+    if (
+      token.type !== TokenType.DOT &&
+      token.type !== TokenType.TILDE &&
+      !(token.type === TokenType.LETTER && this.symbols.has(token.lexeme))
+    ) {
+      return false
+    }
+    const next = this.peekNext()
+    return (
+      isAlteration(next.type) ||
+      next.type === TokenType.NOTE_LETTER ||
+      this.hasRestAttributes(next)
+    )
+  }
+
+  private isMultiMeasureRest() {
+    const token = this.peek()
+    return (
+      token.type === TokenType.LETTER &&
+      (token.lexeme === "Z" || token.lexeme === "X")
+    )
+  }
+
+  private isRest() {
+    return this.hasRestAttributes(this.peek())
+  }
+
+  private hasRestAttributes(token: Token) {
+    return (
+      token.type === TokenType.LETTER &&
+      (token.lexeme === "z" || token.lexeme === "x")
+    )
+  }
+
+  private consume(type: TokenType, message: string): Token {
+    if (this.check(type)) return this.advance()
+    throw this.error(this.peek(), message)
+  }
+
+  private error(token: Token, message: string): Error {
+    if (this.handler.onError) {
+      const error = this.errorEvent
+      error.message = message
+      error.lexeme = token.lexeme
+      error.offset = token.offset
+      error.line = token.line
+      this.handler.onError(error)
+    } else {
+      parserError(token, message)
+    }
+    return new Error()
+  }
+
+  private synchronize() {
+    this.advance()
+    while (!this.isAtEnd()) {
+      if (
+        this.previous().type === TokenType.EOL ||
+        this.previous().type === TokenType.BARLINE
+      )
+        return
+      this.advance()
+    }
+  }
+
+  private check(type: TokenType) {
+    if (this.isAtEnd()) return false
+    return this.peek().type === type
+  }
+  private advance(): Token {
+    if (!this.isAtEnd()) this.current++
+    return this.previous()
+  }
+  private isAtEnd(): boolean {
+    return this.peek().type === TokenType.EOF
+  }
+  private peek(): Token {
+    return this.tokens[this.current]
+  }
+  private peekNext(): Token {
+    return this.tokens[this.current + 1]
+  }
+  private previous(): Token {
+    return this.tokens[this.current - 1]
+  }
+}
@@ -27,6 +27,7 @@ export interface Visitor<R> {
   visitBarLineExpr(expr: BarLine): R
   visitMusicCodeExpr(expr: Music_code): R
   visitSlurGroupExpr(expr: Slur_group): R
+  visitTupletExpr(expr: Tuplet): R
 }
 
 export abstract class Expr {
@@ -102,7 +103,8 @@ export class Info_line extends Expr {
         result,
         null,
         tokens[0].line,
-        tokens[0].position
+        tokens[0].position,
+        tokens[0].offset
       )
     )
     if (tokens[index].type === TokenType.COMMENT) {
@@ -150,6 +152,8 @@ export type tune_body_code = Comment | Info_line | music_code
 export class Tune extends Expr {
   tune_header: Tune_header
   tune_body?: Tune_Body
+  // set by the parser, hash of the tune's tokens without their layout
+  fingerprint = ""
   constructor(tune_header: Tune_header, tune_body?: Tune_Body) {
     super()
     this.tune_header = tune_header
@@ -196,6 +200,8 @@ export class Note extends Expr {
   pitch: Pitch | Rest
   rhythm?: Rhythm
   tie?: boolean
+  // set by the parser on the notes a tuplet spans
+  tuplet?: Tuplet
   constructor(pitch: Pitch | Rest, rhythm?: Rhythm, tie?: boolean) {
     super()
     this.pitch = pitch
@@ -256,6 +262,7 @@ export class Inline_field extends Expr {
 export class Chord extends Expr {
   contents: Array<Note | Token | Annotation>
   rhythm?: Rhythm
+  tuplet?: Tuplet
   constructor(contents: Array<Note | Token | Annotation>, rhythm?: Rhythm) {
     super()
     this.contents = contents
@@ -266,6 +273,35 @@ export class Chord extends Expr {
   }
 }
 
+/**
+ * Tuplet marker, `(p:q:r`: put `p` notes into the time of `q`
+ * for the next `r` notes.
+ * `q` and `r` are optional, `r` defaulting to `p`
+ * and `q` depending on `p` and the meter.
+ * The colons are kept as written, as in `(3:` or `(3::`,
+ * for the marker to print back the same.
+ */
+export class Tuplet extends Expr {
+  p: Token
+  q?: Token
+  r?: Token
+  // `:` and `:` tokens, or a single `::`
+  separators: Array<Token>
+  constructor(p: Token, q?: Token, r?: Token, separators: Array<Token> = []) {
+    super()
+    this.p = p
+    this.q = q
+    this.r = r
+    this.separators = separators
+  }
+  get notes() {
+    return this.r ? Number(this.r.lexeme) : Number(this.p.lexeme.substring(1))
+  }
+  accept<R>(visitor: Visitor<R>): R {
+    return visitor.visitTupletExpr(this)
+  }
+}
+
 export class Nth_repeat extends Expr {
   repeat: Token
   constructor(repeat: Token) {
@@ -324,6 +360,7 @@ export type music_code =
   | Symbol
   | MultiMeasureRest
   | Slur_group
+  | Tuplet
 
 export class Music_code extends Expr {
   contents: Array<music_code>
@@ -348,9 +385,12 @@ export class Slur_group extends Expr {
 }
 export class Decoration extends Expr {
   decoration: Token
-  constructor(decoration: Token) {
+  // decoration the symbol stands for, e.g. `!trill!` for `T`
+  symbol?: string
+  constructor(decoration: Token, symbol?: string) {
     super()
     this.decoration = decoration
+    this.symbol = symbol
   }
   accept<R>(visitor: Visitor<R>): R {
     return visitor.visitDecorationExpr(this)
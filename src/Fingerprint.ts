@@ -0,0 +1,151 @@
+import Token from "./token"
+import { TokenType } from "./types"
+
+// tokens that only lay the source out
+const isLayout = (type: TokenType) =>
+  type === TokenType.WHITESPACE ||
+  type === TokenType.EOL ||
+  type === TokenType.ANTISLASH_EOL ||
+  type === TokenType.COMMENT
+
+const isBarLine = (type: TokenType) =>
+  type === TokenType.BARLINE ||
+  type === TokenType.BAR_COLON ||
+  type === TokenType.BAR_DBL ||
+  type === TokenType.BAR_DIGIT ||
+  type === TokenType.BAR_RIGHTBRKT ||
+  type === TokenType.COLON_BAR ||
+  type === TokenType.COLON_BAR_DIGIT ||
+  type === TokenType.COLON_DBL ||
+  type === TokenType.LEFTBRKT_BAR
+
+// stands for any run of layout tokens between two significant ones
+const GAP = -1
+
+/**
+ * Structural hash of a tune, fed with its tokens as they are parsed.
+ *
+ * Comments are left out, and each run of spaces, line breaks and comments
+ * counts as a single gap, so reformatting a tune keeps its fingerprint.
+ * Gaps next to a bar line or right after a field's key don't count,
+ * since the formatter adds and removes those.
+ * The fields heading the tune are hashed sorted by key,
+ * so that reordering them doesn't change the hash either.
+ * They run up to the first line that isn't a field or a comment:
+ * the parser ends the header at a comment line,
+ * but the formatter doesn't move fields across it.
+ * The `X:` line is left out, so renumbering tunes doesn't change it.
+ * Significant tokens are hashed by kind and lexeme,
+ * the spaces inside free text collapsed.
+ * Two FNV-1a lanes with different seeds give a 64 bit value.
+ */
+export class Fingerprint {
+  private low = 0
+  private high = 0
+  private gap = false
+  private empty = true
+  // kind of the last significant token
+  private last = TokenType.EOL
+  private lineStart = true
+  // the last significant token is the key starting a field
+  private key = false
+  // tokens of each field heading the tune, until the first other line
+  private fields: Array<Array<Token>> | null = []
+
+  constructor() {
+    this.reset()
+  }
+
+  reset() {
+    this.low = 0x811c9dc5
+    this.high = 0x050c5d1f
+    this.gap = false
+    this.empty = true
+    this.last = TokenType.EOL
+    this.lineStart = true
+    this.key = false
+    this.fields = []
+  }
+
+  add(token: Token) {
+    if (this.fields === null) {
+      this.hash(token)
+      return
+    }
+    if (this.lineStart && !isLayout(token.type)) {
+      if (token.type === TokenType.LETTER_COLON) {
+        this.fields.push([])
+      } else if (token.type !== TokenType.PLUS_COLON) {
+        // the music starts
+        this.endHeader()
+        this.hash(token)
+        return
+      }
+    }
+    if (token.type === TokenType.EOL) this.lineStart = true
+    else if (!isLayout(token.type)) this.lineStart = false
+    if (this.fields.length > 0) this.fields[this.fields.length - 1].push(token)
+  }
+
+  private endHeader() {
+    if (this.fields === null) return
+    const fields = this.fields.filter((field) => field[0].lexeme !== "X:")
+    this.fields = null
+    // the sort is stable, fields sharing a key keep their order
+    fields.sort((a, b) =>
+      a[0].lexeme < b[0].lexeme ? -1 : a[0].lexeme > b[0].lexeme ? 1 : 0
+    )
+    for (const field of fields) {
+      this.gap = false
+      this.lineStart = true
+      for (const token of field) this.hash(token)
+    }
+    this.gap = false
+    this.lineStart = true
+  }
+
+  /**
+   * Returns the hash as 16 hexadecimal digits.
+   */
+  digest() {
+    // a tune without a body
+    this.endHeader()
+    const hex = (value: number) => (value >>> 0).toString(16).padStart(8, "0")
+    return hex(this.high) + hex(this.low)
+  }
+
+  private hash(token: Token) {
+    if (isLayout(token.type)) {
+      this.gap = true
+      if (token.type === TokenType.EOL) this.lineStart = true
+      return
+    }
+    if (
+      this.gap &&
+      !this.empty &&
+      !this.key &&
+      !isBarLine(this.last) &&
+      !isBarLine(token.type)
+    ) {
+      this.mix(GAP)
+    }
+    this.gap = false
+    this.empty = false
+    this.key = token.type === TokenType.LETTER_COLON && this.lineStart
+    this.lineStart = false
+    this.last = token.type
+    this.mix(token.type)
+    const lexeme =
+      token.type === TokenType.STRING
+        ? token.lexeme.replace(/\s+/g, " ").trim()
+        : token.lexeme
+    for (let i = 0; i < lexeme.length; i++) this.mix(lexeme.charCodeAt(i))
+    this.mix(GAP - 1)
+  }
+
+  private mix(value: number) {
+    this.low = Math.imul(this.low ^ (value & 0xffff), 0x01000193)
+    this.high = Math.imul(this.high ^ (value & 0xffff), 0x01000193)
+    this.high = Math.imul(this.high ^ (this.high >>> 15), 0x2c1b3c6d)
+  }
+}
@@ -0,0 +1,251 @@
+import { AstPrinter } from "./AstPrinter"
+import { getError, setError } from "./error"
+import { File_structure } from "./Expr"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { CheckWriter, Mismatch, StringBuilder, Writer } from "./Writer"
+
+const parseSource = (source: string): File_structure | null => {
+  setError(false)
+  const tokens = new Scanner(source).scanTokens()
+  const ast = new Parser(tokens, source).parse()
+  // the parser skips over the tokens it can't make sense of,
+  // printing such an AST would drop parts of the source.
+  if (!ast || getError()) return null
+  return ast
+}
+
+/**
+ * Formats the source into the writer.
+ * Returns false if the source contains errors,
+ * in which case nothing is written.
+ */
+export const formatTo = (source: string, out: Writer): boolean => {
+  const ast = parseSource(source)
+  if (!ast) return false
+  new AstPrinter(out).print(ast)
+  return true
+}
+
+/**
+ * Returns the canonical formatting of the source,
+ * or null if the source contains errors.
+ */
+export const format = (source: string): string | null => {
+  const builder = new StringBuilder()
+  if (!formatTo(source, builder)) return null
+  return builder.toString()
+}
+
+export type CheckResult =
+  | { formatted: true }
+  | { formatted: false; offset: number; line: number; column: number }
+  | { formatted: false; error: true }
+
+/**
+ * Checks whether the source is already formatted.
+ * Printing stops at the first difference,
+ * which gets reported as an offset and a 1-based line and column.
+ */
+export const check = (source: string): CheckResult => {
+  const ast = parseSource(source)
+  if (!ast) return { formatted: false, error: true }
+  const writer = new CheckWriter(source)
+  try {
+    new AstPrinter(writer).print(ast)
+    writer.end()
+  } catch (e) {
+    if (!(e instanceof Mismatch)) throw e
+    const before = source.substring(0, e.offset)
+    const lineStart = before.lastIndexOf("\n") + 1
+    return {
+      formatted: false,
+      offset: e.offset,
+      line: before.split("\n").length,
+      column: e.offset - lineStart + 1,
+    }
+  }
+  return { formatted: true }
+}
+
+export type TextEdit = { start: number; end: number; text: string }
+
+/**
+ * Applies edits sorted by offset and not overlapping,
+ * all offsets referring to the original source.
+ */
+export const applyEdits = (source: string, edits: Array<TextEdit>) => {
+  const chunks: Array<string> = []
+  let position = 0
+  for (const edit of edits) {
+    chunks.push(source.substring(position, edit.start), edit.text)
+    position = edit.end
+  }
+  chunks.push(source.substring(position))
+  return chunks.join("")
+}
+
+const isSpace = (code: number) =>
+  code === 32 || code === 9 || code === 10 || code === 13
+
+const differs = (
+  a: string,
+  aFrom: number,
+  aTo: number,
+  b: string,
+  bFrom: number,
+  bTo: number
+) =>
+  aTo - aFrom !== bTo - bFrom ||
+  a.substring(aFrom, aTo) !== b.substring(bFrom, bTo)
+
+/**
+ * Lists the edits that turn `original` into `formatted`.
+ *
+ * Since the printer only changes the whitespace of the music,
+ * both texts are walked side by side and each differing whitespace run
+ * becomes its own edit.
+ * Whatever else differs (e.g. reordered header lines)
+ * is replaced by a single edit, between the matching head and tail.
+ * `base` is added to the edits' offsets.
+ */
+export const textEdits = (
+  original: string,
+  formatted: string,
+  base = 0
+): Array<TextEdit> => {
+  const edits: Array<TextEdit> = []
+  let i = 0
+  let j = 0
+  while (true) {
+    let wi = i
+    let wj = j
+    while (wi < original.length && isSpace(original.charCodeAt(wi))) wi++
+    while (wj < formatted.length && isSpace(formatted.charCodeAt(wj))) wj++
+    const atEnd = wi === original.length && wj === formatted.length
+    if (
+      !atEnd &&
+      (wi === original.length ||
+        wj === formatted.length ||
+        original.charCodeAt(wi) !== formatted.charCodeAt(wj))
+    ) {
+      break
+    }
+    if (differs(original, i, wi, formatted, j, wj)) {
+      edits.push({
+        start: base + i,
+        end: base + wi,
+        text: formatted.substring(j, wj),
+      })
+    }
+    if (atEnd) return edits
+    i = wi + 1
+    j = wj + 1
+  }
+
+  // walk back from the ends, down to the first difference
+  const tail: Array<TextEdit> = []
+  let k = original.length
+  let l = formatted.length
+  while (true) {
+    let wk = k
+    let wl = l
+    while (wk > i && isSpace(original.charCodeAt(wk - 1))) wk--
+    while (wl > j && isSpace(formatted.charCodeAt(wl - 1))) wl--
+    if (
+      wk === i ||
+      wl === j ||
+      original.charCodeAt(wk - 1) !== formatted.charCodeAt(wl - 1)
+    ) {
+      break
+    }
+    if (differs(original, wk, k, formatted, wl, l)) {
+      tail.push({
+        start: base + wk,
+        end: base + k,
+        text: formatted.substring(wl, l),
+      })
+    }
+    k = wk - 1
+    l = wl - 1
+  }
+  edits.push({
+    start: base + i,
+    end: base + k,
+    text: formatted.substring(j, l),
+  })
+  return edits.concat(tail.reverse())
+}
+
+/**
+ * Returns the offset of the line following the last empty line
+ * at or before `offset`, or 0 if there is none.
+ * Line breaks are either LF or CRLF.
+ */
+const blankLineBefore = (source: string, offset: number) => {
+  let i = source.lastIndexOf("\n", offset)
+  while (i > 0) {
+    let j = i - 1
+    if (source.charCodeAt(j) === 13) j--
+    if (j >= 0 && source.charCodeAt(j) === 10) return i + 1
+    i = source.lastIndexOf("\n", i - 1)
+  }
+  return 0
+}
+
+/**
+ * Returns the offset of the first empty line at or after `offset`,
+ * or the length of the source if there is none.
+ */
+const blankLineAfter = (source: string, offset: number) => {
+  let i = source.indexOf("\n", offset)
+  while (i !== -1) {
+    let j = i + 1
+    if (source.charCodeAt(j) === 13) j++
+    if (source.charCodeAt(j) === 10) return i + 1
+    i = source.indexOf("\n", i + 1)
+  }
+  return source.length
+}
+
+/**
+ * Formats the lines covered by the `start`-`end` offsets range,
+ * and returns the edits to apply to the source.
+ *
+ * Only the tune around the range gets parsed and printed:
+ * tunes are delimited by empty lines in the source,
+ * so the cost doesn't depend on the size of the document.
+ * Edits that touch the range's lines are returned whole,
+ * even where they reach past them, the others are left out.
+ * Line breaks are printed as CRLF when the tune uses them.
+ */
+export const formatRange = (
+  source: string,
+  range: { start: number; end: number }
+): Array<TextEdit> => {
+  const start = Math.max(0, Math.min(range.start, range.end))
+  const end = Math.min(source.length, Math.max(range.start, range.end))
+
+  const segmentStart = start > 0 ? blankLineBefore(source, start) : 0
+  const segmentEnd = blankLineAfter(source, end)
+  if (segmentEnd <= segmentStart) return []
+
+  const segment = source.substring(segmentStart, segmentEnd)
+  let formatted = format(segment)
+  if (formatted === null) return []
+  // the printer writes LF line breaks, and strips the CRs
+  // the scanner leaves in comments: convert them once to the document's
+  const lineEnd = segment.indexOf("\n")
+  if (lineEnd > 0 && segment.charCodeAt(lineEnd - 1) === 13) {
+    formatted = formatted.replace(/\n/g, "\r\n")
+  }
+
+  const linesStart = start > 0 ? source.lastIndexOf("\n", start - 1) + 1 : 0
+  const lineBreak = source.indexOf("\n", end)
+  const linesEnd = lineBreak === -1 ? source.length : lineBreak + 1
+  return textEdits(segment, formatted, segmentStart).filter((edit) =>
+    edit.start === edit.end
+      ? edit.start >= linesStart && edit.start <= linesEnd
+      : edit.start < linesEnd && edit.end > linesStart
+  )
+}
@@ -0,0 +1,189 @@
+import { Annotation } from "./Expr"
+import { LETTERS, SEMITONES } from "./Key"
+
+// qualities of a chord symbol's triad
+export const MAJOR = 0
+export const MINOR = 1
+export const DIMINISHED = 2
+export const AUGMENTED = 3
+export const SUSPENDED2 = 4
+export const SUSPENDED4 = 5
+export const POWER = 6
+
+// pitch classes of each quality's triad, above the root
+const TRIADS = [
+  (1 << 0) | (1 << 4) | (1 << 7),
+  (1 << 0) | (1 << 3) | (1 << 7),
+  (1 << 0) | (1 << 3) | (1 << 6),
+  (1 << 0) | (1 << 4) | (1 << 8),
+  (1 << 0) | (1 << 2) | (1 << 7),
+  (1 << 0) | (1 << 5) | (1 << 7),
+  (1 << 0) | (1 << 7),
+]
+
+/**
+ * A decoded chord symbol, e.g. `Am7` or `G/B`.
+ * Pitch classes are numbered from C = 0,
+ * and `intervals` has bit `i` set for each pitch class `i` semitones
+ * above the root, extensions and alterations included.
+ */
+export type ChordSymbol = {
+  root: number
+  // spelling of the root, the letter from C = 0
+  letter: number
+  alteration: number
+  quality: number
+  intervals: number
+  // pitch class of the bass, -1 without a `/` bass note
+  bass: number
+  bassLetter: number
+  bassAlteration: number
+}
+
+const accidental = (text: string, position: number) =>
+  text.charAt(position) === "#" ? 1 : text.charAt(position) === "b" ? -1 : 0
+
+// words of a chord's quality, longest first so `maj` wins over `m`
+const WORDS =
+  /^(?:maj|min|dim|aug|sus|add|ma(?!dd)|mi|M|m|-|\+|o|°|ø|Δ|[#b]|\d+|[(),])/
+
+// semitones above the root of a degree of the major scale
+const degreeInterval = (degree: number) => SEMITONES[(degree - 1) % 7]
+
+/**
+ * Decodes the text of a chord symbol,
+ * returning null when it isn't one, e.g. for `Fine` or `D.C.`.
+ */
+export const parseChordSymbol = (text: string): ChordSymbol | null => {
+  const letter = LETTERS.indexOf(text.charAt(0))
+  if (letter === -1) return null
+  const alteration = accidental(text, 1)
+  let position = alteration === 0 ? 1 : 2
+  const slash = text.indexOf("/", position)
+  const end = slash === -1 ? text.length : slash
+
+  let quality = MAJOR
+  let seventh = -1
+  let intervals = 0
+  // `7`, `9`... following `maj`
+  let major = false
+  let alteredFifth = false
+  let pending = ""
+  while (position < end) {
+    const match = WORDS.exec(text.substring(position, end))
+    if (!match) return null
+    const word = match[0]
+    position += word.length
+    if (word === "m" || word === "mi" || word === "min" || word === "-") {
+      quality = MINOR
+    } else if (word === "dim" || word === "o" || word === "°") {
+      quality = DIMINISHED
+      if (seventh === -1) seventh = -2
+    } else if (word === "ø") {
+      quality = DIMINISHED
+      seventh = 10
+    } else if (word === "aug" || word === "+") {
+      quality = AUGMENTED
+    } else if (word === "maj" || word === "ma" || word === "M") {
+      major = true
+    } else if (word === "Δ") {
+      major = true
+      seventh = 11
+    } else if (word === "sus") {
+      quality = SUSPENDED4
+      pending = "sus"
+      continue
+    } else if (word === "add" || word === "#" || word === "b") {
+      pending = word
+      continue
+    } else if (/^\d/.test(word)) {
+      const degree = Number(word)
+      if (degree < 1 || degree > 13) return null
+      if (pending === "sus") {
+        if (degree === 2) quality = SUSPENDED2
+        else if (degree !== 4) return null
+      } else if (pending === "#" || pending === "b") {
+        const shift = pending === "#" ? 1 : -1
+        if (degree === 5) alteredFifth = true
+        intervals |= 1 << (degreeInterval(degree) + shift + 12) % 12
+      } else if (pending === "add") {
+        intervals |= 1 << degreeInterval(degree)
+      } else if (degree === 5 && position === end && seventh === -1) {
+        quality = POWER
+      } else if (degree === 6) {
+        intervals |= 1 << 9
+      } else if (degree >= 7 && degree % 2 === 1 && degree <= 13) {
+        if (seventh === -2) seventh = 9
+        else seventh = major ? 11 : 10
+        // lower extensions are implied
+        for (let implied = 9; implied <= degree; implied += 2) {
+          intervals |= 1 << degreeInterval(implied)
+        }
+      } else {
+        return null
+      }
+    }
+    pending = ""
+  }
+  if (pending !== "" && pending !== "sus") return null
+
+  // an altered fifth replaces the triad's
+  intervals |= alteredFifth ? TRIADS[quality] & ~(1 << 7) : TRIADS[quality]
+  if (seventh >= 0) intervals |= 1 << seventh
+
+  let bass = -1
+  let bassLetter = -1
+  let bassAlteration = 0
+  if (slash !== -1) {
+    bassLetter = LETTERS.indexOf(text.charAt(slash + 1))
+    bassAlteration = accidental(text, slash + 2)
+    const length = bassAlteration === 0 ? 2 : 3
+    if (bassLetter === -1 || slash + length !== text.length) return null
+    bass = (SEMITONES[bassLetter] + bassAlteration + 12) % 12
+  }
+  return {
+    root: (SEMITONES[letter] + alteration + 12) % 12,
+    letter,
+    alteration,
+    quality,
+    intervals,
+    bass,
+    bassLetter,
+    bassAlteration,
+  }
+}
+
+/**
+ * Chord symbols decoded so far, shared by every tune:
+ * a corpus only uses a few hundred distinct symbols.
+ * Texts that aren't chords are left out, and the table is cleared
+ * once it holds `MAX_SYMBOLS`, so it can't grow without bounds.
+ */
+const symbols = new Map<string, ChordSymbol>()
+const MAX_SYMBOLS = 4096
+
+/**
+ * Returns the decoded chord symbol, decoding each distinct text once.
+ * The records are shared and frozen.
+ */
+export const chordSymbol = (text: string): ChordSymbol | null => {
+  let symbol = symbols.get(text)
+  if (symbol === undefined) {
+    const parsed = parseChordSymbol(text)
+    if (!parsed) return null
+    if (symbols.size >= MAX_SYMBOLS) symbols.clear()
+    symbol = Object.freeze(parsed)
+    symbols.set(text, symbol)
+  }
+  return symbol
+}
+
+/**
+ * Returns the chord symbol of an annotation, such as `"Am7"`.
+ * Annotations placed with `^`, `_`, `<`, `>` or `@` are text, not chords.
+ */
+export const annotationChord = (annotation: Annotation) => {
+  const lexeme = annotation.text.lexeme
+  if (/^"[\^_<>@]/.test(lexeme)) return null
+  return chordSymbol(lexeme.substring(1, lexeme.length - 1))
+}
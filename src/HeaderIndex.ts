@@ -0,0 +1,427 @@
+import { TextDecoder, TextEncoder } from "util"
+import { Tune_header } from "./Expr"
+import { fieldName, fieldValue } from "./fields"
+import { decodePostings, intersect, PostingList } from "./postings"
+import { parseHeaders } from "./tunes"
+
+// indexed fields: title, composer, origin and rhythm
+export const INDEXED_FIELDS = "TCOR"
+
+const MAGIC = 0x48434241 // "ABCH"
+const VERSION = 2
+const HEADER_SIZE = 32
+
+/**
+ * Lower cases the text, strips its accents
+ * and turns punctuation into single spaces.
+ */
+export const normalize = (text: string) =>
+  text
+    .normalize("NFD")
+    .replace(/[\u0300-\u036f]/g, "")
+    .toLowerCase()
+    .replace(/[^0-9a-z\u00df-\uffff]+/g, " ")
+    .trim()
+
+/**
+ * Distinct trigrams of the text,
+ * each packed into a number, 16 bits per character.
+ */
+const trigramsOf = (text: string): Array<number> => {
+  const grams = new Set<number>()
+  for (let i = 0; i + 3 <= text.length; i++) {
+    grams.add(
+      text.charCodeAt(i) * 0x100000000 +
+        text.charCodeAt(i + 1) * 0x10000 +
+        text.charCodeAt(i + 2)
+    )
+  }
+  return Array.from(grams)
+}
+
+// padded, so that the starts and ends of texts make trigrams of their own
+const trigrams = (normalized: string) => trigramsOf(` ${normalized} `)
+
+export type HeaderMatch = {
+  tune: number
+  // letter of the field, e.g. `T`
+  field: string
+  text: string
+  // from 0 to 1, higher first
+  score: number
+}
+
+export type SearchOptions = {
+  // letters of the fields to search, all of them by default
+  fields?: string
+  // match by trigram similarity rather than by substring
+  fuzzy?: boolean
+  // least similarity of fuzzy matches
+  similarity?: number
+  limit?: number
+}
+
+/**
+ * Trigram index over the `T:`, `C:`, `O:` and `R:` fields of an archive.
+ *
+ * Field values are interned: entry `e` gives the text
+ * `strings[entryStrings[e]]` to field `INDEXED_FIELDS[entryFields[e]]`
+ * of tune `entryTunes[e]`.
+ * Trigram `grams[g]` is found in the strings whose numbers are encoded
+ * in `postings` from `postingStarts[g]`, `postingCounts[g]` of them.
+ * The arrays are laid out as they are stored by `serialize`.
+ */
+export class HeaderIndex {
+  strings: Array<string>
+  tuneOffsets: Float64Array
+  entryTunes: Int32Array
+  entryStrings: Int32Array
+  entryFields: Uint8Array
+  grams: Float64Array
+  postingStarts: Uint32Array
+  postingCounts: Uint32Array
+  postings: Uint8Array
+  private normalized: Array<string>
+  // entries of each string, from `stringEntryStarts[s]`
+  private stringEntryStarts: Int32Array
+  private stringEntries: Int32Array
+  // shared overlap counts of the fuzzy search
+  private overlaps: Uint16Array
+  constructor(
+    strings: Array<string>,
+    tuneOffsets: Float64Array,
+    entryTunes: Int32Array,
+    entryStrings: Int32Array,
+    entryFields: Uint8Array,
+    grams: Float64Array,
+    postingStarts: Uint32Array,
+    postingCounts: Uint32Array,
+    postings: Uint8Array
+  ) {
+    this.strings = strings
+    this.tuneOffsets = tuneOffsets
+    this.entryTunes = entryTunes
+    this.entryStrings = entryStrings
+    this.entryFields = entryFields
+    this.grams = grams
+    this.postingStarts = postingStarts
+    this.postingCounts = postingCounts
+    this.postings = postings
+    this.normalized = strings.map(normalize)
+    this.overlaps = new Uint16Array(strings.length)
+
+    this.stringEntryStarts = new Int32Array(strings.length + 1)
+    for (const s of entryStrings) this.stringEntryStarts[s + 1]++
+    for (let s = 0; s < strings.length; s++) {
+      this.stringEntryStarts[s + 1] += this.stringEntryStarts[s]
+    }
+    const next = this.stringEntryStarts.slice(0, strings.length)
+    this.stringEntries = new Int32Array(entryStrings.length)
+    entryStrings.forEach((s, e) => (this.stringEntries[next[s]++] = e))
+  }
+
+  get tunes() {
+    return this.tuneOffsets.length
+  }
+
+  /**
+   * Returns the entries matching the query, best first:
+   * by default the entries containing it, whole words first,
+   * or with `fuzzy`, the entries sharing most of its trigrams.
+   */
+  search(query: string, options: SearchOptions = {}): Array<HeaderMatch> {
+    const { fields = INDEXED_FIELDS, limit = 20 } = options
+    const normalized = normalize(query)
+    if (normalized === "") return []
+    const scored = options.fuzzy
+      ? this.fuzzy(normalized, options.similarity ?? 0.3)
+      : this.substring(normalized)
+
+    const matches: Array<HeaderMatch> = []
+    for (const { string, score } of scored) {
+      const end = this.stringEntryStarts[string + 1]
+      for (let i = this.stringEntryStarts[string]; i < end; i++) {
+        const e = this.stringEntries[i]
+        const field = INDEXED_FIELDS.charAt(this.entryFields[e])
+        if (fields.indexOf(field) === -1) continue
+        const tune = this.entryTunes[e]
+        matches.push({ tune, field, text: this.strings[string], score })
+      }
+    }
+    matches.sort((a, b) => b.score - a.score || a.tune - b.tune)
+    return matches.slice(0, limit)
+  }
+
+  private substring(query: string) {
+    let candidates: Uint32Array | null = null
+    // unpadded, as the query may start or end inside a word
+    for (const gram of trigramsOf(query)) {
+      const ids = this.lookup(gram)
+      candidates = candidates ? intersect(candidates, ids) : ids
+      if (candidates.length === 0) return []
+    }
+    const scored: Array<{ string: number; score: number }> = []
+    const check = (string: number) => {
+      const text = this.normalized[string]
+      const at = text.indexOf(query)
+      if (at === -1) return
+      // whole text, then word starts, then anywhere,
+      // shorter texts first within each rank
+      const start = at === 0 || text.charAt(at - 1) === " "
+      const rank = text === query ? 3 : start ? 2 : 1
+      const ratio = query.length / text.length
+      scored.push({ string, score: (rank + ratio) / 4 })
+    }
+    if (candidates) {
+      for (const string of candidates) check(string)
+    } else {
+      // queries too short for a trigram
+      for (let string = 0; string < this.strings.length; string++) {
+        check(string)
+      }
+    }
+    return scored
+  }
+
+  private fuzzy(query: string, similarity: number) {
+    const grams = trigrams(query)
+    const touched: Array<number> = []
+    for (const gram of grams) {
+      for (const string of this.lookup(gram)) {
+        if (this.overlaps[string]++ === 0) touched.push(string)
+      }
+    }
+    const scored: Array<{ string: number; score: number }> = []
+    for (const string of touched) {
+      const overlap = this.overlaps[string]
+      this.overlaps[string] = 0
+      // Jaccard index of the trigram sets,
+      // a padded text having about as many trigrams as characters
+      const size = this.normalized[string].length
+      const score = overlap / (grams.length + size - overlap)
+      if (score >= similarity) scored.push({ string, score })
+    }
+    return scored
+  }
+
+  private lookup(gram: number): Uint32Array {
+    let low = 0
+    let high = this.grams.length
+    while (low < high) {
+      const middle = (low + high) >>> 1
+      if (this.grams[middle] < gram) low = middle + 1
+      else high = middle
+    }
+    if (low === this.grams.length || this.grams[low] !== gram) {
+      return new Uint32Array(0)
+    }
+    return decodePostings(
+      this.postings,
+      this.postingStarts[low],
+      this.postingCounts[low]
+    )
+  }
+
+  /**
+   * Returns the index as bytes: a header of counts,
+   * then the arrays from the widest items to the narrowest,
+   * so each is aligned for reading in place.
+   * The strings are stored as UTF-8 one after the other,
+   * found by the offsets where each ends.
+   */
+  serialize(): Uint8Array {
+    const encoder = new TextEncoder()
+    const encoded = this.strings.map((string) => encoder.encode(string))
+    const stringEnds = new Uint32Array(encoded.length)
+    let end = 0
+    encoded.forEach((bytes, s) => {
+      end += bytes.byteLength
+      stringEnds[s] = end
+    })
+    const strings = new Uint8Array(end)
+    encoded.forEach((bytes, s) => {
+      strings.set(bytes, stringEnds[s] - bytes.byteLength)
+    })
+    const sizes = [
+      this.grams.byteLength,
+      this.tuneOffsets.byteLength,
+      this.postingStarts.byteLength,
+      this.postingCounts.byteLength,
+      this.entryTunes.byteLength,
+      this.entryStrings.byteLength,
+      stringEnds.byteLength,
+      this.entryFields.byteLength,
+      this.postings.byteLength,
+      strings.byteLength,
+    ]
+    let size = HEADER_SIZE
+    for (const bytes of sizes) size += bytes
+    const buffer = new Uint8Array(size)
+    const header = new Uint32Array(buffer.buffer, 0, HEADER_SIZE / 4)
+    header.set([
+      MAGIC,
+      VERSION,
+      this.strings.length,
+      this.tuneOffsets.length,
+      this.entryTunes.length,
+      this.grams.length,
+      this.postings.byteLength,
+      strings.byteLength,
+    ])
+    let offset = HEADER_SIZE
+    for (const array of [
+      this.grams,
+      this.tuneOffsets,
+      this.postingStarts,
+      this.postingCounts,
+      this.entryTunes,
+      this.entryStrings,
+      stringEnds,
+      this.entryFields,
+      this.postings,
+      strings,
+    ]) {
+      buffer.set(
+        new Uint8Array(array.buffer, array.byteOffset, array.byteLength),
+        offset
+      )
+      offset += array.byteLength
+    }
+    return buffer
+  }
+
+  /**
+   * Reads an index written by `serialize`,
+   * viewing the arrays in place when the bytes are aligned.
+   * Returns null if the bytes aren't an index.
+   */
+  static deserialize(bytes: Uint8Array): HeaderIndex | null {
+    if (bytes.byteLength < HEADER_SIZE) return null
+    if (bytes.byteOffset % 8 !== 0) bytes = bytes.slice()
+    const header = new Uint32Array(bytes.buffer, bytes.byteOffset, 8)
+    if (header[0] !== MAGIC || header[1] !== VERSION) return null
+    const [, , strings, tunes, entries, grams, postings, text] = header
+    let offset = bytes.byteOffset + HEADER_SIZE
+    const view = <T>(
+      Type: new (buffer: ArrayBufferLike, offset: number, length: number) => T,
+      length: number,
+      itemSize: number
+    ) => {
+      const array = new Type(bytes.buffer, offset, length)
+      offset += length * itemSize
+      return array
+    }
+    const gramKeys = view(Float64Array, grams, 8)
+    const tuneOffsets = view(Float64Array, tunes, 8)
+    const postingStarts = view(Uint32Array, grams, 4)
+    const postingCounts = view(Uint32Array, grams, 4)
+    const entryTunes = view(Int32Array, entries, 4)
+    const entryStrings = view(Int32Array, entries, 4)
+    const stringEnds = view(Uint32Array, strings, 4)
+    const entryFields = view(Uint8Array, entries, 1)
+    const postingBytes = view(Uint8Array, postings, 1)
+    const textBytes = view(Uint8Array, text, 1)
+    const decoder = new TextDecoder()
+    const values: Array<string> = []
+    for (let s = 0; s < strings; s++) {
+      const start = s === 0 ? 0 : stringEnds[s - 1]
+      values.push(decoder.decode(textBytes.subarray(start, stringEnds[s])))
+    }
+    return new HeaderIndex(
+      values,
+      tuneOffsets,
+      entryTunes,
+      entryStrings,
+      entryFields,
+      gramKeys,
+      postingStarts,
+      postingCounts,
+      postingBytes
+    )
+  }
+}
+
+/**
+ * Collects the indexed fields of tunes, interning their values,
+ * and builds the trigram postings of the distinct values.
+ */
+export class HeaderIndexBuilder {
+  private strings: Array<string> = []
+  private stringIds = new Map<string, number>()
+  private tuneOffsets: Array<number> = []
+  private entryTunes: Array<number> = []
+  private entryStrings: Array<number> = []
+  private entryFields: Array<number> = []
+  private postings = new Map<number, PostingList>()
+
+  /**
+   * Adds a tune's header and returns the tune's number.
+   */
+  add(header: Tune_header, offset = 0) {
+    const tune = this.tuneOffsets.push(offset) - 1
+    for (const line of header.info_lines) {
+      const field = INDEXED_FIELDS.indexOf(fieldName(line))
+      if (field === -1) continue
+      const value = fieldValue(line)
+      if (value === "") continue
+      this.entryTunes.push(tune)
+      this.entryStrings.push(this.intern(value))
+      this.entryFields.push(field)
+    }
+    return tune
+  }
+
+  build(): HeaderIndex {
+    const grams = Float64Array.from(this.postings.keys()).sort()
+    const postingStarts = new Uint32Array(grams.length)
+    const postingCounts = new Uint32Array(grams.length)
+    let size = 0
+    grams.forEach((gram, g) => {
+      const list = this.postings.get(gram)!
+      postingStarts[g] = size
+      postingCounts[g] = list.count
+      size += list.size
+    })
+    const postings = new Uint8Array(size)
+    grams.forEach((gram, g) => {
+      const list = this.postings.get(gram)!
+      postings.set(list.bytes.subarray(0, list.size), postingStarts[g])
+    })
+    return new HeaderIndex(
+      this.strings,
+      Float64Array.from(this.tuneOffsets),
+      Int32Array.from(this.entryTunes),
+      Int32Array.from(this.entryStrings),
+      Uint8Array.from(this.entryFields),
+      grams,
+      postingStarts,
+      postingCounts,
+      postings
+    )
+  }
+
+  private intern(value: string) {
+    let id = this.stringIds.get(value)
+    if (id !== undefined) return id
+    id = this.strings.push(value) - 1
+    this.stringIds.set(value, id)
+    // strings are numbered in order, so postings stay sorted
+    for (const gram of trigrams(normalize(value))) {
+      let list = this.postings.get(gram)
+      if (!list) this.postings.set(gram, (list = new PostingList()))
+      list.add(id)
+    }
+    return id
+  }
+}
+
+/**
+ * Indexes the headers of an archive's tunes, skipping their bodies.
+ */
+export const indexHeaders = (source: string): HeaderIndex => {
+  const builder = new HeaderIndexBuilder()
+  for (const { header, offset } of parseHeaders(source)) {
+    builder.add(header, offset)
+  }
+  return builder.build()
+}
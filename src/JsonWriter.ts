@@ -0,0 +1,405 @@
+import {
+  Annotation,
+  BarLine,
+  Chord,
+  Comment,
+  Decoration,
+  Expr,
+  File_header,
+  File_structure,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  Lyric_section,
+  MultiMeasureRest,
+  Music_code,
+  Note,
+  Nth_repeat,
+  Pitch,
+  Rest,
+  Rhythm,
+  Slur_group,
+  Symbol,
+  Tune,
+  Tune_Body,
+  Tune_header,
+  Tuplet,
+  Visitor,
+  YSPACER,
+} from "./Expr"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { SymbolTable } from "./Symbols"
+import Token from "./token"
+import { splitTunes, splitTuneStream } from "./tunes"
+import { StringBuilder, Writer } from "./Writer"
+
+/*
+ * JSON schema of the AST, version 1.
+ *
+ * A file is `{"version":1,"header":node|null,"tunes":[node,…]}`,
+ * with one tune per line.
+ * Nodes are arrays starting with their `NodeKind`:
+ *
+ *   Token            [kind, type, offset, lexeme]
+ *   FileHeader       [kind, text]
+ *   Tune             [kind, fingerprint, header, body|null]
+ *   TuneHeader       [kind, [info line…]]
+ *   InfoLine         [kind, key, value, comment|null]
+ *   Comment          [kind, text]
+ *   TuneBody         [kind, [node…]]
+ *   MusicCode        [kind, [node…]]
+ *   LyricSection     [kind, [info line…]]
+ *   Note             [kind, pitch|rest, rhythm|null, tie]
+ *   Pitch            [kind, alteration|null, letter, octave|null]
+ *   Rest             [kind, rest]
+ *   Rhythm           [kind, numerator|null, separator|null,
+ *                           denominator|null, broken|null]
+ *   MultiMeasureRest [kind, rest, length|null]
+ *   Symbol           [kind, symbol]
+ *   GraceGroup       [kind, acciaccatura, [note…]]
+ *   InlineField      [kind, field, [token…]]
+ *   Chord            [kind, [node…], rhythm|null]
+ *   Tuplet           [kind, p, q|null, r|null]
+ *   NthRepeat        [kind, repeat]
+ *   Annotation       [kind, text]
+ *   BarLine          [kind, barline]
+ *   SlurGroup        [kind, [node…]]
+ *   Decoration       [kind, decoration, symbol|null]
+ *   YSpacer          [kind, spacer, number|null]
+ *
+ * Tokens in a node's fields are `[type, offset, lexeme]`, without their kind,
+ * offsets being from the start of the file. Booleans are 0 or 1.
+ */
+
+export const JSON_VERSION = 1
+
+/**
+ * Kinds of the nodes. Their numbers are part of the schema,
+ * new kinds go at the end.
+ */
+export enum NodeKind {
+  Token,
+  FileHeader,
+  Tune,
+  TuneHeader,
+  InfoLine,
+  Comment,
+  TuneBody,
+  MusicCode,
+  LyricSection,
+  Note,
+  Pitch,
+  Rest,
+  Rhythm,
+  MultiMeasureRest,
+  Symbol,
+  GraceGroup,
+  InlineField,
+  Chord,
+  Tuplet,
+  NthRepeat,
+  Annotation,
+  BarLine,
+  SlurGroup,
+  Decoration,
+  YSpacer,
+}
+
+/**
+ * Prints the AST as compact JSON into a `Writer`.
+ * `base` is added to the tokens' offsets,
+ * for trees parsed out of a larger archive.
+ */
+export class JsonPrinter implements Visitor<void> {
+  private out: Writer
+  base: number
+  constructor(out: Writer, base = 0) {
+    this.out = out
+    this.base = base
+  }
+
+  print(expr: Expr | Token) {
+    if (expr instanceof Token) {
+      const out = this.out
+      out.write(`[${NodeKind.Token},${expr.type},${this.base + expr.offset},`)
+      out.write(JSON.stringify(expr.lexeme))
+      out.write("]")
+    } else {
+      expr.accept(this)
+    }
+  }
+
+  private start(kind: NodeKind) {
+    this.out.write(`[${kind}`)
+  }
+  private end() {
+    this.out.write("]")
+  }
+  private token(token: Token | null | undefined) {
+    const out = this.out
+    if (!token) return out.write(",null")
+    out.write(`,[${token.type},${this.base + token.offset},`)
+    out.write(JSON.stringify(token.lexeme))
+    out.write("]")
+  }
+  private text(text: string | undefined) {
+    this.out.write(text === undefined ? ",null" : "," + JSON.stringify(text))
+  }
+  private nodes(nodes: Array<Expr | Token>) {
+    const out = this.out
+    out.write(",[")
+    for (let i = 0; i < nodes.length; i++) {
+      if (i > 0) out.write(",")
+      this.print(nodes[i])
+    }
+    out.write("]")
+  }
+  private node(node: Expr | undefined) {
+    if (!node) return this.out.write(",null")
+    this.out.write(",")
+    node.accept(this)
+  }
+
+  visitFileStructureExpr(expr: File_structure) {
+    const out = this.out
+    out.write(`{"version":${JSON_VERSION},"header":`)
+    if (expr.file_header) expr.file_header.accept(this)
+    else out.write("null")
+    out.write(',"tunes":[')
+    expr.tune.forEach((tune, index) => {
+      out.write(index > 0 ? ",\n" : "\n")
+      tune.accept(this)
+    })
+    out.write("\n]}\n")
+  }
+  visitFileHeaderExpr(expr: File_header) {
+    this.start(NodeKind.FileHeader)
+    this.text(expr.text)
+    this.end()
+  }
+  visitTuneExpr(expr: Tune) {
+    this.start(NodeKind.Tune)
+    this.text(expr.fingerprint)
+    this.node(expr.tune_header)
+    this.node(expr.tune_body)
+    this.end()
+  }
+  visitTuneHeaderExpr(expr: Tune_header) {
+    this.start(NodeKind.TuneHeader)
+    this.nodes(expr.info_lines)
+    this.end()
+  }
+  visitInfoLineExpr(expr: Info_line) {
+    this.start(NodeKind.InfoLine)
+    this.token(expr.key)
+    this.token(expr.value[0])
+    this.token(expr.value[1])
+    this.end()
+  }
+  visitCommentExpr(expr: Comment) {
+    this.start(NodeKind.Comment)
+    this.text(expr.text)
+    this.end()
+  }
+  visitTuneBodyExpr(expr: Tune_Body) {
+    this.start(NodeKind.TuneBody)
+    this.nodes(expr.sequence)
+    this.end()
+  }
+  visitMusicCodeExpr(expr: Music_code) {
+    this.start(NodeKind.MusicCode)
+    this.nodes(expr.contents)
+    this.end()
+  }
+  visitLyricSectionExpr(expr: Lyric_section) {
+    this.start(NodeKind.LyricSection)
+    this.nodes(expr.info_lines)
+    this.end()
+  }
+  visitNoteExpr(expr: Note) {
+    this.start(NodeKind.Note)
+    this.node(expr.pitch)
+    this.node(expr.rhythm)
+    this.out.write(expr.tie ? ",1" : ",0")
+    this.end()
+  }
+  visitPitchExpr(expr: Pitch) {
+    this.start(NodeKind.Pitch)
+    this.token(expr.alteration)
+    this.token(expr.noteLetter)
+    this.token(expr.octave)
+    this.end()
+  }
+  visitRestExpr(expr: Rest) {
+    this.start(NodeKind.Rest)
+    this.token(expr.rest)
+    this.end()
+  }
+  visitRhythmExpr(expr: Rhythm) {
+    this.start(NodeKind.Rhythm)
+    this.token(expr.numerator)
+    this.token(expr.separator)
+    this.token(expr.denominator)
+    this.token(expr.broken)
+    this.end()
+  }
+  visitMultiMeasureRestExpr(expr: MultiMeasureRest) {
+    this.start(NodeKind.MultiMeasureRest)
+    this.token(expr.rest)
+    this.token(expr.length)
+    this.end()
+  }
+  visitSymbolExpr(expr: Symbol) {
+    this.start(NodeKind.Symbol)
+    this.token(expr.symbol)
+    this.end()
+  }
+  visitGraceGroupExpr(expr: Grace_group) {
+    this.start(NodeKind.GraceGroup)
+    this.out.write(expr.isAccacciatura ? ",1" : ",0")
+    this.nodes(expr.notes)
+    this.end()
+  }
+  visitInlineFieldExpr(expr: Inline_field) {
+    this.start(NodeKind.InlineField)
+    this.token(expr.field)
+    this.nodes(expr.text)
+    this.end()
+  }
+  visitChordExpr(expr: Chord) {
+    this.start(NodeKind.Chord)
+    this.nodes(expr.contents)
+    this.node(expr.rhythm)
+    this.end()
+  }
+  visitTupletExpr(expr: Tuplet) {
+    this.start(NodeKind.Tuplet)
+    this.token(expr.p)
+    this.token(expr.q)
+    this.token(expr.r)
+    this.end()
+  }
+  visitNthRepeatExpr(expr: Nth_repeat) {
+    this.start(NodeKind.NthRepeat)
+    this.token(expr.repeat)
+    this.end()
+  }
+  visitAnnotationExpr(expr: Annotation) {
+    this.start(NodeKind.Annotation)
+    this.token(expr.text)
+    this.end()
+  }
+  visitBarLineExpr(expr: BarLine) {
+    this.start(NodeKind.BarLine)
+    this.token(expr.barline)
+    this.end()
+  }
+  visitSlurGroupExpr(expr: Slur_group) {
+    this.start(NodeKind.SlurGroup)
+    this.nodes(expr.contents)
+    this.end()
+  }
+  visitDecorationExpr(expr: Decoration) {
+    this.start(NodeKind.Decoration)
+    this.token(expr.decoration)
+    this.text(expr.symbol)
+    this.end()
+  }
+  visitYSpacerExpr(expr: YSPACER) {
+    this.start(NodeKind.YSpacer)
+    this.token(expr.ySpacer)
+    this.token(expr.number)
+    this.end()
+  }
+}
+
+/**
+ * Returns the JSON of a whole tree, for trees that fit in a string.
+ */
+export const toJson = (ast: File_structure): string => {
+  const builder = new StringBuilder()
+  new JsonPrinter(builder).print(ast)
+  return builder.toString()
+}
+
+/**
+ * Writes the JSON of the archive's tree to the stream, one tune at a time,
+ * in the same format as `toJson` of the whole tree.
+ * The archive can be a string or a stream of strings,
+ * which is then split into tunes as it is read.
+ *
+ * Tunes are parsed and printed on their own, so memory use depends on
+ * the largest tune rather than the archive. Writing waits for the stream
+ * to drain when it asks to, and otherwise yields to the event loop
+ * between tunes.
+ * Resolves to the offsets of the tunes that couldn't be parsed,
+ * which are left out of the output.
+ * Rejects if the stream fails or closes before the end.
+ */
+export const writeJson = async (
+  source: string | AsyncIterable<string>,
+  out: NodeJS.WritableStream
+): Promise<Array<number>> => {
+  const write = (chunk: string) =>
+    new Promise<void>((resolve, reject) => {
+      if (!out.writable) {
+        reject(new Error("The output stream is closed"))
+      } else if (out.write(chunk)) {
+        setImmediate(resolve)
+      } else {
+        // the stream may fail or close instead of draining
+        const settle = (error?: Error) => {
+          out.removeListener("drain", onDrain)
+          out.removeListener("error", onError)
+          out.removeListener("close", onClose)
+          if (error) reject(error)
+          else resolve()
+        }
+        const onDrain = () => settle()
+        const onError = (error: Error) => settle(error)
+        const onClose = () =>
+          settle(new Error("The output stream closed before draining"))
+        out.on("drain", onDrain)
+        out.on("error", onError)
+        out.on("close", onClose)
+      }
+    })
+  const builder = new StringBuilder()
+  const printer = new JsonPrinter(builder)
+  const failed: Array<number> = []
+  // filled in by the file header's `U:` fields
+  const symbols = new SymbolTable()
+  let tunes = 0
+  let started = false
+  const chunks =
+    typeof source === "string" ? splitTunes(source) : splitTuneStream(source)
+  for await (const chunk of chunks) {
+    const tokens = new Scanner(chunk.source).scanTokens()
+    const ast = new Parser(tokens, chunk.source, symbols).parse()
+    if (!ast) {
+      failed.push(chunk.offset)
+      continue
+    }
+    printer.base = chunk.offset
+    if (!started) {
+      builder.write(`{"version":${JSON_VERSION},"header":`)
+      if (ast.file_header) ast.file_header.accept(printer)
+      else builder.write("null")
+      builder.write(',"tunes":[')
+      started = true
+    }
+    for (const tune of ast.tune) {
+      builder.write(tunes++ > 0 ? ",\n" : "\n")
+      tune.accept(printer)
+      await write(builder.toString())
+      builder.clear()
+    }
+  }
+  if (!started) {
+    builder.write(`{"version":${JSON_VERSION},"header":null,"tunes":[`)
+  }
+  builder.write("\n]}\n")
+  await write(builder.toString())
+  return failed
+}
@@ -0,0 +1,187 @@
+import { Pitch } from "./Expr"
+
+export const LETTERS = "CDEFGAB"
+export const SEMITONES = [0, 2, 4, 5, 7, 9, 11]
+// letters in the order they get sharpened by the key signatures
+export const SHARPS = "FCGDAEB"
+
+// remainder of the division, positive for negative values too
+export const mod = (value: number, modulus: number) =>
+  ((value % modulus) + modulus) % modulus
+
+const TONICS: { [letter: string]: number } = {
+  C: 0,
+  G: 1,
+  D: 2,
+  A: 3,
+  E: 4,
+  B: 5,
+  F: -1,
+}
+// position of each mode relative to its relative major
+const MODES: { [mode: string]: number } = {
+  "": 0,
+  maj: 0,
+  ion: 0,
+  mix: -1,
+  dor: -2,
+  min: -3,
+  aeo: -3,
+  phr: -4,
+  loc: -5,
+  lyd: 1,
+}
+
+/**
+ * Alteration of each letter (C to B) for every key signature,
+ * from 7 flats (index 0) to 7 sharps (index 14).
+ */
+const SIGNATURES: Array<Int8Array> = []
+for (let fifths = -7; fifths <= 7; fifths++) {
+  const alterations = new Int8Array(7)
+  for (let i = 0; i < Math.abs(fifths); i++) {
+    const letter = fifths > 0 ? SHARPS.charAt(i) : SHARPS.charAt(6 - i)
+    alterations[LETTERS.indexOf(letter)] = fifths > 0 ? 1 : -1
+  }
+  SIGNATURES.push(alterations)
+}
+
+/**
+ * Signature of every tonic and mode, keyed by `tonic + mode`,
+ * e.g. `F#min` or `Ebdor`, the major keys having an empty mode.
+ */
+const KEYS = new Map<string, number>()
+for (const letter of Object.keys(TONICS)) {
+  for (const accidental of ["", "#", "b"]) {
+    for (const mode of Object.keys(MODES)) {
+      const fifths =
+        TONICS[letter] +
+        (accidental === "#" ? 7 : accidental === "b" ? -7 : 0) +
+        MODES[mode]
+      if (Math.abs(fifths) <= 7) KEYS.set(letter + accidental + mode, fifths)
+    }
+  }
+}
+
+export const signature = (fifths: number): Int8Array =>
+  SIGNATURES[Math.max(-7, Math.min(7, fifths)) + 7]
+
+/**
+ * Modes are case insensitive and only their first three letters count,
+ * `m` standing for minor.
+ * Returns null for words that aren't modes.
+ */
+export const normalizeMode = (mode: string) => {
+  const lower = mode.toLowerCase()
+  if (lower === "m") return "min"
+  const short = lower.substring(0, 3)
+  return short in MODES ? short : null
+}
+
+export type Key = {
+  // sharps (positive) or flats (negative) of the signature
+  fifths: number
+  // alteration of each letter, C to B, including explicit accidentals
+  alterations: Int8Array
+}
+
+export const ALTERATIONS: { [accidental: string]: number } = {
+  "^^": 2,
+  "^": 1,
+  "=": 0,
+  _: -1,
+  __: -2,
+}
+
+/**
+ * Parses the value of a `K:` field.
+ *
+ * Keys come from the precomputed signatures.
+ * Explicit accidentals (`K:D ^g`) modify a copy of the signature,
+ * or replace it when preceded by `exp`.
+ * `none`, `HP` and unrecognised keys have no signature,
+ * `Hp` is marked with F# and C#.
+ * Returns null if the field sets no key, e.g. `K:clef=bass`,
+ * in which case the current key goes on.
+ */
+export const parseKey = (value: string): Key | null => {
+  const text = value.trim()
+  let fifths = 0
+  let rest = text
+  let tonic = true
+  const match = /^([A-G][#b]?)\s*([A-Za-z]*)/.exec(text)
+  if (text.startsWith("Hp")) {
+    fifths = 2
+    rest = text.substring(2)
+  } else if (match) {
+    const mode = normalizeMode(match[2])
+    fifths = KEYS.get(match[1] + (mode ?? "")) ?? 0
+    // words that aren't modes (e.g. `exp`, `clef=`) are left in the rest
+    rest = text.substring(mode === null ? match[1].length : match[0].length)
+  } else {
+    tonic = /^(none|HP)\b/.test(text)
+  }
+  let alterations = signature(fifths)
+  // accidentals are words of their own, unlike the `=` of `clef=bass`
+  const accidentals = /(?:^|\s)(\^\^|\^|__|_|=)([a-gA-G])(?=\s|$)/g
+  let accidental: RegExpExecArray | null
+  let copied = false
+  while ((accidental = accidentals.exec(rest))) {
+    if (!copied) {
+      alterations = /\bexp\b/.test(rest)
+        ? new Int8Array(7)
+        : Int8Array.from(alterations)
+      copied = true
+    }
+    alterations[LETTERS.indexOf(accidental[2].toUpperCase())] =
+      ALTERATIONS[accidental[1]]
+  }
+  if (!tonic && !copied) return null
+  return { fifths, alterations }
+}
+
+export const letterIndex = (pitch: Pitch) =>
+  LETTERS.indexOf(pitch.noteLetter.lexeme.toUpperCase())
+
+/**
+ * Octave of the pitch, where `C` is octave 0 and `c` is octave 1.
+ */
+export const pitchOctave = (pitch: Pitch) => {
+  const letter = pitch.noteLetter.lexeme
+  let octave = letter === letter.toLowerCase() ? 1 : 0
+  if (pitch.octave) {
+    const count = pitch.octave.lexeme.length
+    octave += pitch.octave.lexeme.charAt(0) === "'" ? count : -count
+  }
+  return octave
+}
+
+/**
+ * Alteration written in front of the pitch, or undefined if there is none.
+ * Naturals are 0.
+ */
+export const writtenAlteration = (pitch: Pitch): number | undefined => {
+  if (!pitch.alteration) return undefined
+  switch (pitch.alteration.lexeme) {
+    case "^":
+    case "♯":
+      return 1
+    case "^^":
+    case "𝄪":
+      return 2
+    case "_":
+    case "♭":
+      return -1
+    case "__":
+    case "𝄫":
+      return -2
+    default:
+      return 0
+  }
+}
+
+/**
+ * MIDI number of the pitch with the given alteration, `C` being 60.
+ */
+export const midiNumber = (pitch: Pitch, alteration: number) =>
+  60 + 12 * pitchOctave(pitch) + SEMITONES[letterIndex(pitch)] + alteration
@@ -0,0 +1,279 @@
+import {
+  BarLine,
+  Chord,
+  Expr,
+  Info_line,
+  Inline_field,
+  Note,
+  Rest,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue } from "./fields"
+import Token from "./token"
+
+// flags of an aligned syllable
+// the word goes on after the syllable, with a hyphen
+export const HYPHEN = 1
+// the note holds the previous syllable, `_`
+export const HELD = 2
+
+/**
+ * The lyrics of a tune, aligned on its notes.
+ *
+ * Notes are numbered in body order, rests and grace notes excluded,
+ * a chord counting as one note.
+ * `syllables[verse * notes.length + n]` is the index in `texts`
+ * of the syllable sung on note `n`, or -1 if it has none,
+ * and `flags` holds the `HYPHEN` and `HELD` marks at the same index.
+ * `W:` lines, printed after the tune, are kept in `words`.
+ */
+export class TuneLyrics {
+  notes: Array<Note | Chord>
+  verses: number
+  texts: Array<string>
+  syllables: Int32Array
+  flags: Uint8Array
+  words: Array<string>
+  private indices: Map<Note | Chord, number>
+  constructor(
+    notes: Array<Note | Chord>,
+    verses: number,
+    texts: Array<string>,
+    syllables: Int32Array,
+    flags: Uint8Array,
+    words: Array<string>
+  ) {
+    this.notes = notes
+    this.verses = verses
+    this.texts = texts
+    this.syllables = syllables
+    this.flags = flags
+    this.words = words
+    this.indices = new Map(notes.map((note, n) => [note, n]))
+  }
+
+  /**
+   * Returns the number of the note, or -1 if it takes no lyrics.
+   */
+  indexOf(note: Note | Chord) {
+    const n = this.indices.get(note)
+    return n === undefined ? -1 : n
+  }
+
+  /**
+   * Returns the syllable sung on the note, if any.
+   */
+  syllableAt(n: number, verse = 0): string | undefined {
+    if (n < 0 || n >= this.notes.length || verse >= this.verses) return
+    const syllable = this.syllables[verse * this.notes.length + n]
+    return syllable === -1 ? undefined : this.texts[syllable]
+  }
+
+  syllableOf(note: Note | Chord, verse = 0) {
+    return this.syllableAt(this.indexOf(note), verse)
+  }
+}
+
+type Voice = {
+  name: string
+  // notes the next `w:` line applies to
+  pending: Array<number>
+  // `w:` lines since the voice's last note, the verse of the next one
+  verse: number
+  bar: number
+}
+
+/**
+ * Walks the body once, collecting each voice's notes
+ * until a `w:` line consumes them.
+ * Consecutive `w:` lines are successive verses of the same notes.
+ */
+class LyricAligner {
+  private notes: Array<Note | Chord> = []
+  private bars: Array<number> = []
+  private texts: Array<string> = []
+  private textIndices = new Map<string, number>()
+  // syllables and flags of each verse, by note number
+  private verses: Array<Array<number>> = []
+  private verseFlags: Array<Array<number>> = []
+  private voices: Array<Voice> = []
+  private voice: Voice | undefined
+
+  align(tune: Tune) {
+    const words: Array<string> = []
+    const info_lines = tune.tune_header.info_lines
+    const key = info_lines.findIndex((line) => fieldName(line) === "K")
+    info_lines.forEach((line, i) => {
+      if (fieldName(line) === "W") words.push(fieldValue(line))
+      // fields right after `K:` are parsed into the header,
+      // a voice field among them opens the body
+      if (key !== -1 && i > key && fieldName(line) === "V") {
+        this.voice = this.voiceNamed(fieldValue(line).split(/\s/)[0])
+      }
+    })
+    const sequence = tune.tune_body ? tune.tune_body.sequence : []
+    for (const element of sequence) {
+      if (element instanceof Info_line && fieldName(element) === "w") {
+        this.lyrics(fieldValue(element))
+      } else if (element instanceof Info_line && fieldName(element) === "W") {
+        words.push(fieldValue(element))
+      } else if (
+        (element instanceof Info_line || element instanceof Inline_field) &&
+        fieldName(element) === "V"
+      ) {
+        this.voice = this.voiceNamed(fieldValue(element).split(/\s/)[0])
+      } else {
+        this.music(element)
+      }
+    }
+
+    const length = this.notes.length
+    const verses = this.verses.length
+    const syllables = new Int32Array(verses * length).fill(-1)
+    const flags = new Uint8Array(verses * length)
+    this.verses.forEach((verse, v) => {
+      verse.forEach((syllable, n) => (syllables[v * length + n] = syllable))
+    })
+    this.verseFlags.forEach((verse, v) => {
+      verse.forEach((flag, n) => (flags[v * length + n] = flag))
+    })
+    return new TuneLyrics(
+      this.notes,
+      verses,
+      this.texts,
+      syllables,
+      flags,
+      words
+    )
+  }
+
+  private music(element: Expr | Token) {
+    if (element instanceof Slur_group) {
+      for (const content of element.contents) this.music(content)
+      return
+    }
+    const voice = this.voice || (this.voice = this.voiceNamed(""))
+    if (element instanceof BarLine) {
+      voice.bar++
+    } else if (
+      element instanceof Chord ||
+      (element instanceof Note && !(element.pitch instanceof Rest))
+    ) {
+      if (voice.verse > 0) {
+        voice.pending = []
+        voice.verse = 0
+      }
+      voice.pending.push(this.notes.length)
+      this.notes.push(element)
+      this.bars.push(voice.bar)
+    }
+  }
+
+  /**
+   * Places the syllables of a `w:` line on the voice's pending notes.
+   */
+  private lyrics(text: string) {
+    const voice = this.voice || (this.voice = this.voiceNamed(""))
+    const pending = voice.pending
+    const v = voice.verse++
+    const syllables = this.verses[v] || (this.verses[v] = [])
+    const flags = this.verseFlags[v] || (this.verseFlags[v] = [])
+    let next = 0
+    let last = -1
+    // bar of the last note given a syllable, or skipped to with `|`
+    let bar = -1
+    let syllable = ""
+    // the last character ended a syllable with a hyphen
+    let hyphen = false
+
+    const place = (text: string | null, flag: number) => {
+      if (next >= pending.length) return
+      const n = (last = pending[next++])
+      bar = this.bars[n]
+      syllables[n] = text === null ? -1 : this.intern(text)
+      flags[n] = flag
+    }
+    const end = (flag = 0) => {
+      if (syllable === "") return false
+      place(syllable, flag)
+      syllable = ""
+      return true
+    }
+
+    for (let i = 0; i < text.length; i++) {
+      const char = text.charAt(i)
+      if (char === "\\" && text.charAt(i + 1) === "-") {
+        syllable += "-"
+        i++
+        continue
+      }
+      if (char === "-") {
+        if (!end(HYPHEN)) {
+          // a hyphen after another one skips a note
+          if (hyphen) place(null, HYPHEN)
+          else if (last !== -1) flags[last] |= HYPHEN
+        }
+        hyphen = true
+        continue
+      }
+      hyphen = false
+      if (char === " " || char === "\t") {
+        end()
+      } else if (char === "_") {
+        end()
+        place(null, HELD)
+      } else if (char === "*") {
+        end()
+        place(null, 0)
+      } else if (char === "|") {
+        end()
+        // the rest of the bar's notes get no syllable,
+        // and each further `|` skips a whole bar
+        if (next === 0) continue
+        bar++
+        while (next < pending.length && this.bars[pending[next]] < bar) {
+          next++
+        }
+      } else if (char === "~") {
+        syllable += " "
+      } else {
+        syllable += char
+      }
+    }
+    end()
+  }
+
+  private intern(text: string) {
+    let index = this.textIndices.get(text)
+    if (index === undefined) {
+      index = this.texts.push(text) - 1
+      this.textIndices.set(text, index)
+    }
+    return index
+  }
+
+  private voiceNamed(name: string) {
+    let voice = this.voices.find((voice) => voice.name === name)
+    if (!voice) {
+      voice = { name, pending: [], verse: 0, bar: 0 }
+      this.voices.push(voice)
+    }
+    return voice
+  }
+}
+
+const cache = new WeakMap<Tune, TuneLyrics>()
+
+/**
+ * Returns the tune's lyrics, aligned on its notes.
+ * Alignment is done in a single pass on first use, then cached per tune.
+ */
+export const alignLyrics = (tune: Tune): TuneLyrics => {
+  let lyrics = cache.get(tune)
+  if (!lyrics) {
+    lyrics = new LyricAligner().align(tune)
+    cache.set(tune, lyrics)
+  }
+  return lyrics
+}
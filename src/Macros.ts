@@ -0,0 +1,316 @@
+import { LETTERS, mod } from "./Key"
+
+/**
+ * Maps offsets of an expanded text back to the original source.
+ * Segment `i` starts at `outStarts[i]` in the expanded text
+ * and comes from `lengths[i]` characters at `srcStarts[i]`:
+ * either the same text, or the part of a macro definition it expands.
+ */
+export class SourceMap {
+  outStarts: Int32Array
+  srcStarts: Int32Array
+  lengths: Int32Array
+  constructor(
+    outStarts: Array<number>,
+    srcStarts: Array<number>,
+    lengths: Array<number>
+  ) {
+    this.outStarts = Int32Array.from(outStarts)
+    this.srcStarts = Int32Array.from(srcStarts)
+    this.lengths = Int32Array.from(lengths)
+  }
+
+  originalOffset(offset: number) {
+    let low = 0
+    let high = this.outStarts.length
+    while (low < high) {
+      const middle = (low + high) >>> 1
+      if (this.outStarts[middle] <= offset) low = middle + 1
+      else high = middle
+    }
+    const i = low - 1
+    if (i < 0) return offset
+    const within = offset - this.outStarts[i]
+    const last = Math.max(0, this.lengths[i] - 1)
+    return this.srcStarts[i] + Math.min(within, last)
+  }
+}
+
+/**
+ * Part of a macro's replacement: either literal text,
+ * or a note `step` letters away from the macro's note,
+ * e.g. `o` for the note above `n`.
+ */
+type Piece = {
+  text: string
+  step: number | null
+  octave: number
+  // offset of the piece in the source of the definition
+  offset: number
+  length: number
+}
+
+/**
+ * Expansion of a macro for one note, with the source offset
+ * and length of each part of the text.
+ */
+type Expansion = {
+  text: string
+  starts: Array<number>
+  offsets: Array<number>
+  lengths: Array<number>
+}
+
+/**
+ * A compiled `m:` field, such as `~G2 = {A}G{F}G`,
+ * or the transposing `~n2 = {o}n{m}n` which applies to any note.
+ */
+export class Macro {
+  // target before and after its note, the whole target when static
+  prefix: string
+  suffix: string
+  transposing: boolean
+  pieces: Array<Piece>
+  // expansions already computed, keyed by the note they were applied to
+  private cache = new Map<string, Expansion>()
+  constructor(
+    prefix: string,
+    suffix: string,
+    transposing: boolean,
+    pieces: Array<Piece>
+  ) {
+    this.prefix = prefix
+    this.suffix = suffix
+    this.transposing = transposing
+    this.pieces = pieces
+  }
+
+  /**
+   * Returns the macro's text for the note, memoized.
+   */
+  expand(note: string): Expansion {
+    let expansion = this.cache.get(note)
+    if (expansion) return expansion
+    expansion = { text: "", starts: [], offsets: [], lengths: [] }
+    const letter = LETTERS.indexOf(note.charAt(0).toUpperCase())
+    let octave = note.charAt(0) === note.charAt(0).toLowerCase() ? 1 : 0
+    for (let i = 1; i < note.length; i++) {
+      octave += note.charAt(i) === "'" ? 1 : -1
+    }
+    for (const piece of this.pieces) {
+      let text = piece.text
+      if (piece.step !== null) {
+        const moved = letter + piece.step
+        const name = LETTERS.charAt(mod(moved, 7))
+        const pitchOctave = octave + Math.floor(moved / 7) + piece.octave
+        text =
+          pitchOctave > 0
+            ? name.toLowerCase() + "'".repeat(pitchOctave - 1)
+            : name + ",".repeat(-pitchOctave)
+      }
+      expansion.starts.push(expansion.text.length)
+      expansion.offsets.push(piece.offset)
+      expansion.lengths.push(piece.length)
+      expansion.text += text
+    }
+    this.cache.set(note, expansion)
+    return expansion
+  }
+}
+
+/**
+ * Compiles the value of an `m:` field,
+ * `offset` being the source offset of that value.
+ * Returns null when the field has no `=`.
+ */
+export const compileMacro = (value: string, offset: number): Macro | null => {
+  const equals = value.indexOf("=")
+  if (equals === -1) return null
+  const target = value.substring(0, equals).trim()
+  if (target === "") return null
+  let start = equals + 1
+  while (value.charAt(start) === " " || value.charAt(start) === "\t") start++
+  const replacement = value.substring(start).trimEnd()
+
+  // the note of a transposing macro can't start its target
+  const note = target.indexOf("n")
+  const transposing = note !== -1
+  if (note === 0) return null
+  const pieces: Array<Piece> = []
+  const pattern = transposing ? /([h-z])([',]*)|[^h-z]+/g : /[^]+/g
+  let match: RegExpExecArray | null
+  while ((match = pattern.exec(replacement))) {
+    const piece: Piece = {
+      text: match[0],
+      step: null,
+      octave: 0,
+      offset: offset + start + match.index,
+      length: match[0].length,
+    }
+    if (match[1]) {
+      piece.step = match[1].charCodeAt(0) - "n".charCodeAt(0)
+      for (const mark of match[2]) piece.octave += mark === "'" ? 1 : -1
+    }
+    pieces.push(piece)
+  }
+  return transposing
+    ? new Macro(
+        target.substring(0, note),
+        target.substring(note + 1),
+        true,
+        pieces
+      )
+    : new Macro(target, "", false, pieces)
+}
+
+const NOTE = /[A-Ga-g][,']*/y
+
+/**
+ * Macros in scope, looked up by the first character of their target.
+ */
+export class MacroTable {
+  private macros = new Map<string, Array<Macro>>()
+
+  define(macro: Macro) {
+    const first = macro.prefix.charAt(0)
+    const macros = (this.macros.get(first) || []).filter(
+      (other) =>
+        other.prefix !== macro.prefix ||
+        other.suffix !== macro.suffix ||
+        other.transposing !== macro.transposing
+    )
+    macros.push(macro)
+    // longer targets are tried first
+    macros.sort(
+      (a, b) =>
+        b.prefix.length + b.suffix.length - (a.prefix.length + a.suffix.length)
+    )
+    this.macros.set(first, macros)
+  }
+
+  /**
+   * Returns the macro applying at `position`, with the text it replaces
+   * and the note it applies to.
+   */
+  match(
+    source: string,
+    position: number
+  ): { macro: Macro; length: number; note: string } | null {
+    const macros = this.macros.get(source.charAt(position))
+    if (!macros) return null
+    for (const macro of macros) {
+      if (!source.startsWith(macro.prefix, position)) continue
+      if (!macro.transposing) {
+        return { macro, length: macro.prefix.length, note: "" }
+      }
+      NOTE.lastIndex = position + macro.prefix.length
+      const note = NOTE.exec(source)
+      if (!note || !source.startsWith(macro.suffix, NOTE.lastIndex)) continue
+      const length = NOTE.lastIndex + macro.suffix.length - position
+      return { macro, length, note: note[0] }
+    }
+    return null
+  }
+
+  copy() {
+    const table = new MacroTable()
+    for (const [first, macros] of this.macros) {
+      table.macros.set(first, macros.slice())
+    }
+    return table
+  }
+}
+
+/**
+ * Expands the macros of a source before it is scanned.
+ *
+ * `m:` fields define macros for the rest of their tune,
+ * or for every tune when they come before the first one.
+ * Music lines are searched for the macros' targets,
+ * skipping annotations, decorations and inline fields,
+ * and field and comment lines are copied as they are.
+ * The returned map points the expanded text back to the source,
+ * `base` being the offset of the source in its file:
+ * expanded macros point into their definition.
+ */
+export const expandMacros = (
+  source: string,
+  inherited = new MacroTable(),
+  base = 0
+): { source: string; map: SourceMap; macros: MacroTable } => {
+  // macros defined before the first tune, shared by all tunes
+  const header = inherited.copy()
+  let macros = header
+  const chunks: Array<string> = []
+  const outStarts: Array<number> = []
+  const srcStarts: Array<number> = []
+  const lengths: Array<number> = []
+  let length = 0
+  let copied = 0
+
+  // source from `copied` to `end` goes through unchanged
+  const copy = (end: number) => {
+    if (end <= copied) return
+    outStarts.push(length)
+    srcStarts.push(base + copied)
+    lengths.push(end - copied)
+    chunks.push(source.substring(copied, end))
+    length += end - copied
+    copied = end
+  }
+
+  let lineStart = 0
+  while (lineStart < source.length) {
+    let lineEnd = source.indexOf("\n", lineStart)
+    if (lineEnd === -1) lineEnd = source.length
+    const isField = /^[A-Za-z+]:/.test(source.substr(lineStart, 2))
+    if (source.startsWith("X:", lineStart)) {
+      macros = header.copy()
+    } else if (source.startsWith("m:", lineStart)) {
+      const macro = compileMacro(
+        source.substring(lineStart + 2, lineEnd),
+        base + lineStart + 2
+      )
+      if (macro) macros.define(macro)
+    } else if (!isField && source.charAt(lineStart) !== "%") {
+      let i = lineStart
+      while (i < lineEnd) {
+        const char = source.charAt(i)
+        if (char === '"' || char === "!") {
+          const close = source.indexOf(char, i + 1)
+          i = close === -1 || close > lineEnd ? lineEnd : close + 1
+          continue
+        }
+        if (char === "[" && /^[A-Za-z]:/.test(source.substr(i + 1, 2))) {
+          const close = source.indexOf("]", i)
+          i = close === -1 || close > lineEnd ? lineEnd : close + 1
+          continue
+        }
+        if (char === "%") break
+        const match = macros.match(source, i)
+        if (!match) {
+          i++
+          continue
+        }
+        copy(i)
+        const expansion = match.macro.expand(match.note)
+        expansion.starts.forEach((start, piece) => {
+          outStarts.push(length + start)
+          srcStarts.push(expansion.offsets[piece])
+          lengths.push(expansion.lengths[piece])
+        })
+        chunks.push(expansion.text)
+        length += expansion.text.length
+        i += match.length
+        copied = i
+      }
+    }
+    lineStart = lineEnd + 1
+  }
+  copy(source.length)
+  return {
+    source: chunks.join(""),
+    map: new SourceMap(outStarts, srcStarts, lengths),
+    macros: header,
+  }
+}
@@ -0,0 +1,267 @@
+import { resize } from "./buffers"
+import { resolveDurations } from "./Duration"
+import {
+  Chord,
+  Expr,
+  Info_line,
+  Inline_field,
+  Note,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue } from "./fields"
+import { Parser } from "./Parser"
+import { intersect, PostingList } from "./postings"
+import { resolvePitches, TunePitches } from "./PitchResolver"
+import { toNumber } from "./rational"
+import Scanner from "./Scanner"
+import Token from "./token"
+import { parseTunes } from "./tunes"
+
+// separates the voices of a melody, no interval can take that value
+const VOICE_BREAK = -128
+
+// n-grams are packed into a number, 8 bits per interval
+const MAX_N = 6
+
+export type Melody = {
+  pitches: Array<number>
+  // in whole notes
+  durations: Array<number>
+}
+
+/**
+ * The melody of each voice of a tune, in the order voices appear.
+ * Chords count as their top note, grace notes and rests are left out,
+ * and notes tied to the same pitch are merged.
+ */
+export const voiceMelodies = (tune: Tune): Array<Melody> => {
+  const pitches = resolvePitches(tune)
+  const durations = resolveDurations(tune)
+  const voices = new Map<string, Melody>()
+  let voice: Melody | undefined
+  let tied = false
+  const select = (name: string) => {
+    voice = voices.get(name)
+    if (!voice) voices.set(name, (voice = { pitches: [], durations: [] }))
+  }
+  const add = (pitch: number, element: Note | Chord, tie: boolean) => {
+    if (!voice) select("")
+    const melody = voice!
+    const rational = durations.durationOf(element)
+    const duration = rational ? toNumber(rational) : 0
+    const last = melody.pitches.length - 1
+    if (tied && pitch === melody.pitches[last]) {
+      melody.durations[last] += duration
+    } else {
+      melody.pitches.push(pitch)
+      melody.durations.push(duration)
+    }
+    tied = tie
+  }
+  const visit = (element: Expr | Token) => {
+    if (element instanceof Note) {
+      const pitch = pitches.pitchOf(element)
+      if (pitch !== -1) add(pitch, element, !!element.tie)
+    } else if (element instanceof Chord) {
+      const pitch = topPitch(element, pitches)
+      if (pitch !== -1) add(pitch, element, false)
+    } else if (element instanceof Slur_group) {
+      for (const content of element.contents) visit(content)
+    } else if (
+      (element instanceof Info_line || element instanceof Inline_field) &&
+      fieldName(element) === "V"
+    ) {
+      select(fieldValue(element).split(/\s/)[0])
+      tied = false
+    }
+  }
+  if (tune.tune_body) {
+    for (const element of tune.tune_body.sequence) visit(element)
+  }
+  return Array.from(voices.values())
+}
+
+/**
+ * The melodies of a tune as the intervals between successive notes,
+ * in semitones.
+ * With `contour`, intervals are reduced to their direction: -1, 0 or 1.
+ * Voices are separated by `VOICE_BREAK`.
+ */
+export const melodyIntervals = (tune: Tune, contour = false): Int8Array => {
+  const intervals: Array<number> = []
+  for (const { pitches } of voiceMelodies(tune)) {
+    if (intervals.length > 0) intervals.push(VOICE_BREAK)
+    for (let i = 1; i < pitches.length; i++) {
+      const interval = pitches[i] - pitches[i - 1]
+      intervals.push(contour ? Math.sign(interval) : interval)
+    }
+  }
+  return Int8Array.from(intervals)
+}
+
+const topPitch = (chord: Chord, pitches: TunePitches) => {
+  let top = -1
+  for (const content of chord.contents) {
+    if (content instanceof Note) top = Math.max(top, pitches.pitchOf(content))
+  }
+  return top
+}
+
+/**
+ * Returns whether the interval sequence appears in the melody.
+ */
+const contains = (melody: Int8Array, intervals: Int8Array) => {
+  const last = melody.length - intervals.length
+  for (let start = 0; start <= last; start++) {
+    let i = 0
+    while (i < intervals.length && melody[start + i] === intervals[i]) i++
+    if (i === intervals.length) return true
+  }
+  return false
+}
+
+export type MelodyIndexOptions = {
+  // intervals per n-gram, from 1 to 6
+  n?: number
+  // index the melodic contour rather than the intervals
+  contour?: boolean
+}
+
+/**
+ * Inverted index from the interval n-grams of melodies to the tunes
+ * they appear in, so phrases are found in any key.
+ *
+ * Tunes are numbered in the order they are added.
+ * A query looks up the postings of its n-grams, rarest first,
+ * then checks the remaining tunes' melodies for the whole phrase.
+ */
+export class MelodyIndex {
+  n: number
+  contour: boolean
+  // source offset of each tune, for tunes read from an archive
+  offsets: Array<number> = []
+  private postings = new Map<number, PostingList>()
+  private melodies: Int8Array = new Int8Array(1024)
+  private melodyStarts: Int32Array = new Int32Array(65)
+  private melodiesLength = 0
+
+  constructor({ n = 4, contour = false }: MelodyIndexOptions = {}) {
+    this.n = Math.max(1, Math.min(MAX_N, n))
+    this.contour = contour
+  }
+
+  get length() {
+    return this.offsets.length
+  }
+
+  /**
+   * Adds a tune and returns its number.
+   */
+  add(tune: Tune, offset = 0) {
+    const id = this.offsets.push(offset) - 1
+    const intervals = melodyIntervals(tune, this.contour)
+    this.store(intervals)
+    for (let start = 0; start + this.n <= intervals.length; start++) {
+      const gram = this.gram(intervals, start)
+      if (gram === -1) continue
+      let postings = this.postings.get(gram)
+      if (!postings) this.postings.set(gram, (postings = new PostingList()))
+      postings.add(id)
+    }
+    return id
+  }
+
+  melody(id: number) {
+    return this.melodies.subarray(
+      this.melodyStarts[id],
+      this.melodyStarts[id + 1]
+    )
+  }
+
+  /**
+   * Returns the numbers of the tunes containing the phrase,
+   * written in ABC and read in the given key.
+   */
+  query(snippet: string, key = "C") {
+    const source = `X:1\nK:${key}\n${snippet}\n`
+    const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+    if (!ast || ast.tune.length === 0) return []
+    return this.search(melodyIntervals(ast.tune[0], this.contour))
+  }
+
+  /**
+   * Returns the numbers of the tunes whose melody contains the intervals.
+   */
+  search(intervals: Int8Array): Array<number> {
+    let candidates: Uint32Array | undefined
+    if (intervals.length >= this.n && intervals.indexOf(VOICE_BREAK) === -1) {
+      const lists: Array<PostingList> = []
+      for (let start = 0; start + this.n <= intervals.length; start++) {
+        const postings = this.postings.get(this.gram(intervals, start))
+        if (!postings) return []
+        lists.push(postings)
+      }
+      lists.sort((a, b) => a.count - b.count)
+      for (const list of lists) {
+        candidates = candidates
+          ? intersect(candidates, list.decode())
+          : list.decode()
+        if (candidates.length === 0) return []
+      }
+    }
+    const found: Array<number> = []
+    if (candidates) {
+      for (const id of candidates) {
+        if (contains(this.melody(id), intervals)) found.push(id)
+      }
+    } else {
+      // phrases shorter than an n-gram are searched for directly
+      for (let id = 0; id < this.length; id++) {
+        if (contains(this.melody(id), intervals)) found.push(id)
+      }
+    }
+    return found
+  }
+
+  /**
+   * Packs the n-gram starting at `start`,
+   * or returns -1 if it spans two voices.
+   */
+  private gram(intervals: Int8Array, start: number) {
+    let gram = 0
+    for (let i = start; i < start + this.n; i++) {
+      if (intervals[i] === VOICE_BREAK) return -1
+      gram = gram * 256 + (intervals[i] & 0xff)
+    }
+    return gram
+  }
+
+  private store(intervals: Int8Array) {
+    const id = this.offsets.length - 1
+    if (id + 2 > this.melodyStarts.length) {
+      const size = this.melodyStarts.length * 2
+      this.melodyStarts = resize(this.melodyStarts, size)
+    }
+    let size = this.melodies.length
+    while (this.melodiesLength + intervals.length > size) size *= 2
+    if (size > this.melodies.length) {
+      this.melodies = resize(this.melodies, size)
+    }
+    this.melodies.set(intervals, this.melodiesLength)
+    this.melodiesLength += intervals.length
+    this.melodyStarts[id + 1] = this.melodiesLength
+  }
+}
+
+/**
+ * Indexes every tune of an archive, each parsed on its own.
+ */
+export const indexMelodies = (
+  source: string,
+  options: MelodyIndexOptions = {}
+) => {
+  const index = new MelodyIndex(options)
+  for (const { tune, offset } of parseTunes(source)) index.add(tune, offset)
+  return index
+}
@@ -0,0 +1,296 @@
+import { writeSync } from "fs"
+import {
+  defaultUnitLength,
+  Meter,
+  parseMeter,
+  parseUnitLength,
+} from "./Duration"
+import { Tune } from "./Expr"
+import { headerValue } from "./fields"
+import { Rational, toNumber } from "./rational"
+import { compileTune, TuneEvents } from "./Timeline"
+
+const DEFAULT_TEMPO = 500000 // µs per quarter note, i.e. 120 bpm
+// largest tempo a set tempo event holds, on 3 bytes
+const MAX_TEMPO = 0xffffff
+const PERCUSSION_CHANNEL = 9
+
+/**
+ * Returns the MIDI channel of the voice, skipping the percussion channel.
+ * There are only 15 other channels: from the 16th voice on,
+ * the channels are reused in the same order, voice 15 sharing voice 0's.
+ */
+export const voiceChannel = (voice: number) => {
+  const channel = voice % 15
+  return channel < PERCUSSION_CHANNEL ? channel : channel + 1
+}
+
+/**
+ * Parses the value of a `Q:` field into µs per quarter note.
+ * Beats are given as fractions (`1/4=120`, `1/8 3/8=40`),
+ * or default to the unit note length for bare numbers (`Q:120`).
+ * Tempos too slow for MIDI are clamped to the slowest it holds.
+ */
+export const parseTempo = (value: string, unit: Rational): number | null => {
+  const text = value.replace(/"[^"]*"/g, "").trim()
+  let beat = 0
+  let bpm: number
+  const match = /^((?:\d+\/\d+\s*)+)=\s*(\d+)/.exec(text)
+  if (match) {
+    for (const fraction of match[1].trim().split(/\s+/)) {
+      const [num, den] = fraction.split("/").map(Number)
+      beat += num / den
+    }
+    bpm = Number(match[2])
+  } else if (/^\d+$/.test(text)) {
+    beat = toNumber(unit)
+    bpm = Number(text)
+  } else {
+    return null
+  }
+  if (!beat || !bpm) return null
+  return Math.min(MAX_TEMPO, Math.round(60000000 / (bpm * beat * 4)))
+}
+
+/**
+ * Writes tunes as type 1 Standard MIDI Files:
+ * a first track for the tempo and meter, then one track per voice.
+ * Tempo and meter changes in the body are written to the first track,
+ * at the onset where they appear.
+ *
+ * Files are encoded into a single byte buffer,
+ * allocated once and reused from one tune to the next.
+ */
+export class MidiWriter {
+  private buffer: Uint8Array
+  private position = 0
+  private ticksPerQuarter: number
+  constructor(ticksPerQuarter = 480, capacity = 1 << 16) {
+    this.ticksPerQuarter = ticksPerQuarter
+    this.buffer = new Uint8Array(capacity)
+  }
+
+  /**
+   * Returns the MIDI file of the tune.
+   * The returned bytes are a view of the writer's buffer,
+   * they get overwritten by the next call.
+   */
+  encode(tune: Tune): Uint8Array {
+    const info_lines = tune.tune_header.info_lines
+    const meterValue = headerValue(info_lines, "M")
+    const meter = meterValue === undefined ? null : parseMeter(meterValue)
+    const unitValue = headerValue(info_lines, "L")
+    const unit =
+      (unitValue !== undefined && parseUnitLength(unitValue)) ||
+      defaultUnitLength(meter)
+    const tempoValue = headerValue(info_lines, "Q")
+    const tempo =
+      (tempoValue !== undefined && parseTempo(tempoValue, unit)) ||
+      DEFAULT_TEMPO
+    const events = compileTune(tune)
+
+    this.position = 0
+    this.ascii("MThd")
+    this.uint32(6)
+    this.uint16(1)
+    this.uint16(events.voiceNames.length + 1)
+    this.uint16(this.ticksPerQuarter)
+    this.tempoTrack(
+      events,
+      tempo,
+      meter,
+      unit,
+      headerValue(info_lines, "T") || ""
+    )
+    events.voiceNames.forEach((name, voice) =>
+      this.voiceTrack(events, voice, name)
+    )
+    return this.buffer.subarray(0, this.position)
+  }
+
+  /**
+   * Encodes the tune and writes it to the stream.
+   * Streams keep the chunks they are given until flushed,
+   * so the bytes are copied out of the reused buffer.
+   * Returns false when the stream asks to wait for a drain.
+   */
+  write(tune: Tune, out: NodeJS.WritableStream): boolean {
+    return out.write(Buffer.from(this.encode(tune)))
+  }
+
+  /**
+   * Encodes the tune and writes it synchronously to the file descriptor,
+   * without copying the bytes.
+   */
+  writeSync(tune: Tune, fd: number) {
+    const bytes = this.encode(tune)
+    let written = 0
+    while (written < bytes.length) {
+      written += writeSync(fd, bytes, written, bytes.length - written)
+    }
+  }
+
+  private tempoTrack(
+    events: TuneEvents,
+    tempo: number,
+    meter: Meter | null,
+    unit: Rational,
+    title: string
+  ) {
+    const start = this.trackStart()
+    if (title) this.text(0x03, title)
+    this.varint(0)
+    this.tempo(tempo)
+    if (meter) {
+      this.varint(0)
+      this.meter(meter)
+    }
+    const ticksPerWhole = this.ticksPerQuarter * 4
+    let tick = 0
+    for (const field of events.fields) {
+      if (field.name === "L") {
+        // bare `Q:` numbers count in unit note lengths
+        unit = parseUnitLength(field.value) || unit
+        continue
+      }
+      const time = Math.round(field.onset * ticksPerWhole)
+      if (field.name === "Q") {
+        const change = parseTempo(field.value, unit)
+        if (change === null) continue
+        this.varint(time - tick)
+        this.tempo(change)
+      } else {
+        const change = parseMeter(field.value)
+        if (!change) continue
+        this.varint(time - tick)
+        this.meter(change)
+      }
+      tick = time
+    }
+    this.trackEnd(start)
+  }
+
+  private tempo(tempo: number) {
+    this.bytes(0xff, 0x51, 0x03, (tempo >> 16) & 0xff, (tempo >> 8) & 0xff)
+    this.bytes(tempo & 0xff)
+  }
+
+  private meter(meter: Meter) {
+    const power = Math.round(Math.log2(meter.denominator))
+    this.bytes(0xff, 0x58, 0x04, meter.numerator & 0xff, power, 24, 8)
+  }
+
+  private voiceTrack(events: TuneEvents, voice: number, name: string) {
+    const channel = voiceChannel(voice)
+    const ticksPerWhole = this.ticksPerQuarter * 4
+    const graceTicks = Math.max(1, this.ticksPerQuarter >> 3)
+
+    // note-ons and note-offs, offs sorting before ons on the same tick
+    const times: Array<number> = []
+    const pitches: Array<number> = []
+    const velocities: Array<number> = []
+    for (let i = 0; i < events.length; i++) {
+      if (events.voices[i] !== voice) continue
+      const on = Math.round(events.onsets[i] * ticksPerWhole)
+      const length = Math.round(events.durations[i] * ticksPerWhole)
+      times.push(on * 2 + 1, (on + (length || graceTicks)) * 2)
+      pitches.push(events.pitches[i], events.pitches[i])
+      velocities.push(events.velocities[i], 0)
+    }
+    const order = times.map((_, i) => i)
+    order.sort((a, b) => times[a] - times[b] || a - b)
+
+    const start = this.trackStart()
+    if (name) this.text(0x03, name)
+    let tick = 0
+    for (const i of order) {
+      const time = times[i] >> 1
+      this.varint(time - tick)
+      tick = time
+      const isOn = times[i] & 1
+      this.reserve(3)
+      this.buffer[this.position++] = (isOn ? 0x90 : 0x80) | channel
+      this.buffer[this.position++] = pitches[i]
+      this.buffer[this.position++] = isOn ? velocities[i] : 0x40
+    }
+    this.trackEnd(start)
+  }
+
+  private trackStart() {
+    this.ascii("MTrk")
+    this.uint32(0)
+    return this.position
+  }
+
+  private trackEnd(start: number) {
+    this.varint(0)
+    this.bytes(0xff, 0x2f, 0x00)
+    const length = this.position - start
+    const end = this.position
+    this.position = start - 4
+    this.uint32(length)
+    this.position = end
+  }
+
+  private text(type: number, text: string) {
+    const encoded = Buffer.from(text, "utf8")
+    this.varint(0)
+    this.bytes(0xff, type)
+    this.varint(encoded.length)
+    this.reserve(encoded.length)
+    this.buffer.set(encoded, this.position)
+    this.position += encoded.length
+  }
+
+  private reserve(size: number) {
+    if (this.position + size <= this.buffer.length) return
+    let capacity = this.buffer.length * 2
+    while (capacity < this.position + size) capacity *= 2
+    const grown = new Uint8Array(capacity)
+    grown.set(this.buffer.subarray(0, this.position))
+    this.buffer = grown
+  }
+
+  private bytes(...values: Array<number>) {
+    this.reserve(values.length)
+    for (const value of values) this.buffer[this.position++] = value
+  }
+
+  private ascii(text: string) {
+    this.reserve(text.length)
+    for (let i = 0; i < text.length; i++) {
+      this.buffer[this.position++] = text.charCodeAt(i)
+    }
+  }
+
+  private uint16(value: number) {
+    this.bytes((value >> 8) & 0xff, value & 0xff)
+  }
+
+  private uint32(value: number) {
+    this.bytes(
+      (value >>> 24) & 0xff,
+      (value >> 16) & 0xff,
+      (value >> 8) & 0xff,
+      value & 0xff
+    )
+  }
+
+  /**
+   * Variable-length quantity: 7 bits per byte, most significant first,
+   * the high bit set on every byte but the last.
+   */
+  private varint(value: number) {
+    this.reserve(4)
+    if (value >= 1 << 21) {
+      this.buffer[this.position++] = 0x80 | ((value >> 21) & 0x7f)
+    }
+    if (value >= 1 << 14) {
+      this.buffer[this.position++] = 0x80 | ((value >> 14) & 0x7f)
+    }
+    if (value >= 1 << 7) {
+      this.buffer[this.position++] = 0x80 | ((value >> 7) & 0x7f)
+    }
+    this.buffer[this.position++] = value & 0x7f
+  }
+}
@@ -0,0 +1,385 @@
+import { closeSync, openSync, writeSync } from "fs"
+import { TextDecoder, TextEncoder } from "util"
+import { indexBars } from "./BarIndex"
+import { resize } from "./buffers"
+import { Tune } from "./Expr"
+import { SourceMap } from "./Macros"
+import { compileTune, TuneEvents } from "./Timeline"
+import { parseTunes } from "./tunes"
+
+/*
+ * Note tables hold the note events of many tunes in columns,
+ * so analytics tools load them without parsing anything:
+ * each column is a run of little-endian values, copied as is
+ * into a typed array or viewed in place.
+ *
+ *   file        chunk* footer trailer
+ *   chunk       rows:u32 decorations:u32
+ *               onset:f64[rows]           whole notes from the tune's start
+ *               duration:f64[rows]        whole notes
+ *               offset:i32[rows]          of the note in the archive
+ *               tune:u32[rows]            number of the tune in the table
+ *               bar:i32[rows]             number of the bar in the voice
+ *               decorationStart:u32[rows + 1]
+ *               voice:u16[rows]           into the voice dictionary
+ *               decoration:u16[decorations]
+ *               pitch:u8[rows]            MIDI number
+ *   footer      chunks:u32 tunes:u32 0:u32 0:u32
+ *               chunkOffset:f64[chunks]   from the start of the file
+ *               tuneOffset:f64[tunes]     of the tune in the archive
+ *               dictionary(voices) dictionary(decorations)
+ *               dictionary(references)    the tunes' `X:` values
+ *   dictionary  count:u32 bytes:u32 utf8[bytes], entries separated by `\n`
+ *   trailer     footerOffset:f64 "ABCN" version:u32
+ *
+ * Every chunk, column, dictionary and the footer start
+ * at a multiple of 8 bytes, padded with zeros.
+ * The decorations of row `i` are the ids of `decoration`
+ * from `decorationStart[i]` to before `decorationStart[i + 1]`.
+ * Rows are in tune order, then by onset within each tune,
+ * and a tune's rows may continue into the next chunk.
+ * Bars are counted from 0 in each voice, the bar being -1
+ * for notes before the first bar of their voice.
+ */
+
+const MAGIC = 0x4e434241 // "ABCN"
+const VERSION = 1
+const TRAILER_SIZE = 16
+
+const align = (size: number) => (size + 7) & ~7
+
+// size of a chunk's encoding
+const chunkSize = (rows: number, decorations: number) =>
+  8 +
+  align(rows * 8) * 2 +
+  align(rows * 4) * 3 +
+  align((rows + 1) * 4) +
+  align(rows * 2) +
+  align(decorations * 2) +
+  align(rows)
+
+/**
+ * Returns the bar playing at the time in the voice,
+ * notes at the very end of the voice, e.g. grace notes,
+ * belonging to the last bar.
+ */
+const barOf = (
+  bars: ReturnType<typeof indexBars>,
+  voice: string,
+  time: number
+) => {
+  const voiceBars = bars.voice(voice)
+  if (!voiceBars) return -1
+  const bar = voiceBars.barAtTime(time)
+  return bar === -1 && time > 0 ? voiceBars.length - 1 : bar
+}
+
+/**
+ * Writes note tables chunk by chunk.
+ *
+ * Rows are collected into columns of `chunkRows` values,
+ * encoded into a single buffer reused from one chunk to the next,
+ * and handed to the sink: the bytes are only valid until it returns.
+ * Voices and decorations go into dictionaries shared by all tunes.
+ */
+export class NoteTableWriter {
+  private sink: (bytes: Uint8Array) => void
+  private chunkRows: number
+  private rows = 0
+  private onsets: Float64Array
+  private durations: Float64Array
+  private offsets: Int32Array
+  private tunes: Uint32Array
+  private bars: Int32Array
+  private decorationStarts: Uint32Array
+  private voices: Uint16Array
+  private decorations = new Uint16Array(256)
+  private pitches: Uint8Array
+  private buffer = new Uint8Array(0)
+  private position = 0
+  private chunkOffsets: Array<number> = []
+  private tuneOffsets: Array<number> = []
+  private references: Array<string> = []
+  private voiceNames: Array<string> = []
+  private voiceIds = new Map<string, number>()
+  private decorationNames: Array<string> = []
+  private decorationIds = new Map<string, number>()
+
+  constructor(sink: (bytes: Uint8Array) => void, chunkRows = 1 << 16) {
+    this.sink = sink
+    this.chunkRows = chunkRows
+    this.onsets = new Float64Array(chunkRows)
+    this.durations = new Float64Array(chunkRows)
+    this.offsets = new Int32Array(chunkRows)
+    this.tunes = new Uint32Array(chunkRows)
+    this.bars = new Int32Array(chunkRows)
+    this.decorationStarts = new Uint32Array(chunkRows + 1)
+    this.voices = new Uint16Array(chunkRows)
+    this.pitches = new Uint8Array(chunkRows)
+  }
+
+  /**
+   * Compiles the tune and adds its notes,
+   * `base` and `map` placing them in the archive as for `compileTune`.
+   * Returns the tune's number.
+   */
+  addTune(tune: Tune, base = 0, map?: SourceMap) {
+    const events = compileTune(tune, base, map)
+    const bars = indexBars(tune)
+    const numbers = new Int32Array(events.length)
+    for (let i = 0; i < events.length; i++) {
+      const voice = events.voiceNames[events.voices[i]]
+      numbers[i] = barOf(bars, voice, events.onsets[i])
+    }
+    return this.add(events, numbers, base)
+  }
+
+  /**
+   * Adds the events of a tune, with the bar of each event.
+   * Returns the tune's number.
+   */
+  add(events: TuneEvents, bars: Int32Array, offset = 0) {
+    const tune = this.tuneOffsets.push(offset) - 1
+    this.references.push(events.reference)
+    const voices = events.voiceNames.map((name) =>
+      this.intern(name, this.voiceNames, this.voiceIds)
+    )
+    const decorations = events.decorationNames.map((name) =>
+      this.intern(name, this.decorationNames, this.decorationIds)
+    )
+    for (let i = 0; i < events.length; i++) {
+      if (this.rows === this.chunkRows) this.flush()
+      const row = this.rows++
+      this.onsets[row] = events.onsets[i]
+      this.durations[row] = events.durations[i]
+      this.offsets[row] = events.offsets[i]
+      this.tunes[row] = tune
+      this.bars[row] = bars[i]
+      this.voices[row] = voices[events.voices[i]]
+      this.pitches[row] = events.pitches[i]
+      const first = events.decorationStarts[i]
+      const last = events.decorationStarts[i + 1]
+      let end = this.decorationStarts[row]
+      if (end + last - first > this.decorations.length) {
+        const size = Math.max(this.decorations.length * 2, end + last - first)
+        this.decorations = resize(this.decorations, size)
+      }
+      for (let d = first; d < last; d++) {
+        this.decorations[end++] = decorations[events.decorationIds[d]]
+      }
+      this.decorationStarts[row + 1] = end
+    }
+    return tune
+  }
+
+  /**
+   * Writes the rows left and the footer.
+   */
+  close() {
+    if (this.rows > 0) this.flush()
+    const footerOffset = this.position
+    const dictionaries = [
+      this.voiceNames,
+      this.decorationNames,
+      this.references,
+    ]
+    const encoded = dictionaries.map((strings) =>
+      new TextEncoder().encode(strings.join("\n"))
+    )
+    let size = 16 + (this.chunkOffsets.length + this.tuneOffsets.length) * 8
+    for (const bytes of encoded) size += 8 + align(bytes.length)
+    const buffer = this.reserve(size + TRAILER_SIZE)
+    const view = new DataView(buffer.buffer, 0, size + TRAILER_SIZE)
+    view.setUint32(0, this.chunkOffsets.length, true)
+    view.setUint32(4, this.tuneOffsets.length, true)
+    let position = 16
+    for (const offset of [...this.chunkOffsets, ...this.tuneOffsets]) {
+      view.setFloat64(position, offset, true)
+      position += 8
+    }
+    encoded.forEach((bytes, i) => {
+      view.setUint32(position, dictionaries[i].length, true)
+      view.setUint32(position + 4, bytes.length, true)
+      buffer.set(bytes, position + 8)
+      position += 8 + align(bytes.length)
+    })
+    view.setFloat64(position, footerOffset, true)
+    view.setUint32(position + 8, MAGIC, true)
+    view.setUint32(position + 12, VERSION, true)
+    this.emit(buffer.subarray(0, position + TRAILER_SIZE))
+  }
+
+  private flush() {
+    const rows = this.rows
+    const decorations = this.decorationStarts[rows]
+    const buffer = this.reserve(chunkSize(rows, decorations))
+    const header = new Uint32Array(buffer.buffer, 0, 2)
+    header[0] = rows
+    header[1] = decorations
+    let position = 8
+    const column = (array: ArrayBufferView, length: number) => {
+      buffer.set(
+        new Uint8Array(array.buffer, array.byteOffset, length),
+        position
+      )
+      position += align(length)
+    }
+    column(this.onsets, rows * 8)
+    column(this.durations, rows * 8)
+    column(this.offsets, rows * 4)
+    column(this.tunes, rows * 4)
+    column(this.bars, rows * 4)
+    column(this.decorationStarts, (rows + 1) * 4)
+    column(this.voices, rows * 2)
+    column(this.decorations, decorations * 2)
+    column(this.pitches, rows)
+    this.chunkOffsets.push(this.position)
+    this.emit(buffer.subarray(0, position))
+    this.rows = 0
+  }
+
+  // returns the buffer, grown to the size and cleared for the padding
+  private reserve(size: number) {
+    if (this.buffer.length < size) this.buffer = new Uint8Array(size)
+    else this.buffer.fill(0, 0, size)
+    return this.buffer
+  }
+
+  private emit(bytes: Uint8Array) {
+    this.sink(bytes)
+    this.position += bytes.length
+  }
+
+  private intern(name: string, names: Array<string>, ids: Map<string, number>) {
+    let id = ids.get(name)
+    if (id === undefined) {
+      id = names.push(name) - 1
+      ids.set(name, id)
+    }
+    return id
+  }
+}
+
+export type NoteChunk = {
+  rows: number
+  onsets: Float64Array
+  durations: Float64Array
+  offsets: Int32Array
+  tunes: Uint32Array
+  bars: Int32Array
+  decorationStarts: Uint32Array
+  voices: Uint16Array
+  decorations: Uint16Array
+  pitches: Uint8Array
+}
+
+export type NoteTable = {
+  chunks: Array<NoteChunk>
+  tuneOffsets: Float64Array
+  voiceNames: Array<string>
+  decorationNames: Array<string>
+  references: Array<string>
+}
+
+/**
+ * Reads a note table, viewing its columns in place
+ * when the bytes are aligned, and copying them once otherwise.
+ * Returns null if the bytes aren't a note table.
+ */
+export const readNoteTable = (bytes: Uint8Array): NoteTable | null => {
+  if (bytes.length < TRAILER_SIZE) return null
+  if (bytes.byteOffset % 8 !== 0) bytes = bytes.slice()
+  const { buffer, byteOffset } = bytes
+  const view = new DataView(buffer, byteOffset, bytes.length)
+  const trailer = bytes.length - TRAILER_SIZE
+  if (
+    view.getUint32(trailer + 8, true) !== MAGIC ||
+    view.getUint32(trailer + 12, true) !== VERSION
+  ) {
+    return null
+  }
+  const footer = view.getFloat64(trailer, true)
+  const chunkCount = view.getUint32(footer, true)
+  const tuneCount = view.getUint32(footer + 4, true)
+  let position = byteOffset + footer + 16
+  const chunkOffsets = new Float64Array(buffer, position, chunkCount)
+  const tuneOffsets = new Float64Array(
+    buffer,
+    position + chunkCount * 8,
+    tuneCount
+  )
+  position = footer + 16 + (chunkCount + tuneCount) * 8
+  const dictionary = () => {
+    const count = view.getUint32(position, true)
+    const length = view.getUint32(position + 4, true)
+    const text = new TextDecoder().decode(
+      bytes.subarray(position + 8, position + 8 + length)
+    )
+    position += 8 + align(length)
+    return count === 0 ? [] : text.split("\n")
+  }
+  const voiceNames = dictionary()
+  const decorationNames = dictionary()
+  const references = dictionary()
+
+  const chunks = Array.from(chunkOffsets, (start) => {
+    const rows = view.getUint32(start, true)
+    const decorations = view.getUint32(start + 4, true)
+    let offset = byteOffset + start + 8
+    const column = <T>(
+      Type: new (buffer: ArrayBufferLike, offset: number, length: number) => T,
+      length: number,
+      itemSize: number
+    ) => {
+      const array = new Type(buffer, offset, length)
+      offset += align(length * itemSize)
+      return array
+    }
+    return {
+      rows,
+      onsets: column(Float64Array, rows, 8),
+      durations: column(Float64Array, rows, 8),
+      offsets: column(Int32Array, rows, 4),
+      tunes: column(Uint32Array, rows, 4),
+      bars: column(Int32Array, rows, 4),
+      decorationStarts: column(Uint32Array, rows + 1, 4),
+      voices: column(Uint16Array, rows, 2),
+      decorations: column(Uint16Array, decorations, 2),
+      pitches: column(Uint8Array, rows, 1),
+    }
+  })
+  return { chunks, tuneOffsets, voiceNames, decorationNames, references }
+}
+
+/**
+ * Exports the notes of an archive's tunes, macros expanded,
+ * each tune being parsed on its own.
+ */
+export const exportNotes = (
+  source: string,
+  sink: (bytes: Uint8Array) => void,
+  chunkRows?: number
+) => {
+  const writer = new NoteTableWriter(sink, chunkRows)
+  for (const { tune, offset, map } of parseTunes(source, { macros: true })) {
+    writer.addTune(tune, offset, map)
+  }
+  writer.close()
+}
+
+/**
+ * Exports the notes of an archive into a file.
+ */
+export const exportNotesToFile = (source: string, path: string) => {
+  const fd = openSync(path, "w")
+  try {
+    exportNotes(source, (bytes) => {
+      let written = 0
+      while (written < bytes.length) {
+        written += writeSync(fd, bytes, written, bytes.length - written)
+      }
+    })
+  } finally {
+    closeSync(fd)
+  }
+}
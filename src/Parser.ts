@@ -21,42 +21,86 @@ import {
   Tune,
   Tune_Body,
   Tune_header,
+  Tuplet,
   tune_body_code,
   File_structure,
   music_code,
   Decoration,
   YSPACER,
 } from "./Expr"
+import { fieldValue } from "./fields"
+import { Fingerprint } from "./Fingerprint"
+import Scanner from "./Scanner"
+import { SymbolTable } from "./Symbols"
 import Token from "./token"
 import { TokenType } from "./types"
 
+// elements of a tune's body parsed between two pauses of `parseSteps`
+const BODY_SLICE = 256
+
 export class Parser {
   private tokens: Array<Token>
   private current = 0
   private source = ""
-  constructor(tokens: Array<Token>, source?: string) {
+  // tuplet being read, and the number of notes it still spans
+  private tuplet: Tuplet | null = null
+  private tupletNotes = 0
+  // decorations of the redefinable symbols, updated by `U:` fields
+  private symbols = new SymbolTable()
+  // symbols redefined in the file header, which each tune starts from
+  private header: SymbolTable
+  // hash of the tokens of the tune being parsed
+  private fingerprint = new Fingerprint()
+  /**
+   * The `U:` fields of the file header are applied to `header`,
+   * so that tunes parsed apart from their header can be given the same.
+   */
+  constructor(
+    tokens: Array<Token>,
+    source?: string,
+    header = new SymbolTable()
+  ) {
     this.tokens = tokens
+    this.header = header
     if (source) {
       this.source = source
     }
   }
 
   parse() {
+    const steps = this.parseSteps()
+    let step = steps.next()
+    while (!step.done) step = steps.next()
+    return step.value
+  }
+
+  /**
+   * Parses the file in steps, pausing after each tune
+   * and every `BODY_SLICE` elements of a tune's body,
+   * for callers that parse in slices.
+   * Returns the same result as `parse()`.
+   */
+  *parseSteps(): Generator<void, File_structure | null> {
     try {
-      return this.file_structure()
+      return yield* this.file_structure()
     } catch {
       return null
     }
   }
 
-  private file_structure() {
+  private *file_structure(): Generator<void, File_structure> {
     let file_header: File_header | null = null
     let tunes: Array<Tune> = []
     while (!this.isAtEnd()) {
       const pkd = this.peek()
       if (this.current === 0 && pkd.lexeme !== "X:")
         file_header = this.file_header()
-      else if (pkd.type === TokenType.LETTER_COLON) tunes.push(this.tune())
+      else if (pkd.type === TokenType.LETTER_COLON) {
+        tunes.push(yield* this.tune())
+        yield
+      }
+      // empty lines separating the tunes
+      else if (pkd.type === TokenType.EOL) this.advance()
       else if (pkd.type === TokenType.EOF) {
         break
       } else throw this.error(this.peek(), "Expected a tune or file header")
@@ -68,36 +112,58 @@ export class Parser {
     //collect a multiline string
     //until finding two line breaks in a row
     let header_text = ""
+    // text of the current line, without its comment
+    let line = ""
     while (!this.isAtEnd()) {
+      const token = this.peek()
       if (
-        this.peek().type === TokenType.EOL &&
+        token.type === TokenType.EOL &&
         this.peekNext().type === TokenType.EOL
       ) {
+        this.headerField(line)
+        line = ""
         this.consume(TokenType.EOL, "Expected a line break")
         this.consume(TokenType.EOL, "Expected a line break")
-      } else if (this.peek().lexeme === "X:") {
+      } else if (token.lexeme === "X:") {
         break
       } else {
-        header_text += this.peek().lexeme
+        header_text += token.lexeme
+        if (token.type === TokenType.EOL) {
+          this.headerField(line)
+          line = ""
+        } else if (token.type !== TokenType.COMMENT) {
+          line += token.lexeme
+        }
         this.advance()
       }
     }
+    this.headerField(line)
     return new File_header(header_text)
   }
-  private tune() {
+  private headerField(line: string) {
+    if (line.startsWith("U:")) this.header.define(line.substring(2))
+  }
+  private *tune(): Generator<void, Tune> {
     // parse a tune header
     // then try to parse a tune body
     // unless the header is followed by a line break
+    this.tuplet = null
+    this.tupletNotes = 0
+    this.symbols = this.header.copy()
+    this.fingerprint.reset()
     const tune_header = this.tune_header()
+    let tune: Tune
     if (
       this.peek().type === TokenType.EOL ||
       this.peek().type === TokenType.EOF
     ) {
-      return new Tune(tune_header)
+      tune = new Tune(tune_header)
     } else {
-      const tune_body = this.tune_body()
-      return new Tune(tune_header, tune_body)
+      const tune_body = yield* this.tune_body()
+      tune = new Tune(tune_header, tune_body)
     }
+    tune.fingerprint = this.fingerprint.digest()
+    return tune
   }
 
   private tune_header() {
@@ -135,12 +201,16 @@ export class Parser {
         this.advance()
       }
     }
-    return new Info_line(info_line)
+    const line = new Info_line(info_line)
+    if (line.key.lexeme === "U:") this.symbols.define(fieldValue(line))
+    return line
   }
 
-  private tune_body() {
-    let elements: Array<tune_body_code> = []
+  private *tune_body(): Generator<void, Tune_Body> {
+    const elements: Array<tune_body_code> = []
+    let count = 0
     while (!this.isAtEnd()) {
+      if (++count % BODY_SLICE === 0) yield
       //check for commentline
       // check for info line
       // check for music_code
@@ -155,7 +225,7 @@ export class Parser {
             this.peekNext().type === TokenType.EOL
           )
         ) {
-          elements = elements.concat(this.music_content().contents)
+          elements.push(...this.music_content().contents)
         } else if (this.peek().type === TokenType.EOL) {
           break
         }
@@ -181,6 +251,7 @@ export class Parser {
       | Symbol
       | MultiMeasureRest
       | Slur_group
+      | Tuplet
     > = []
     const curTokn = this.peek()
 
@@ -212,7 +283,9 @@ export class Parser {
         // parse the note following the dot
         // and add the dot to the note
         if (this.isDecoration()) {
-          contents.push(new Decoration(curTokn))
+          contents.push(
+            new Decoration(curTokn, this.symbols.resolve(curTokn.lexeme))
+          )
           this.advance()
         } else {
           throw this.error(
@@ -265,9 +338,11 @@ export class Parser {
         contents.push(this.slurGroup())
         break
       case TokenType.LEFTPAREN_NUMBER:
-      // parse a tuplet
-      // which is a leftparen_number followed by
-      // a beam group
+        const tuplet = this.tuplet_marker()
+        contents.push(tuplet)
+        this.tuplet = tuplet
+        this.tupletNotes = tuplet.notes
+        break
       case TokenType.SYMBOL:
         contents.push(this.symbol())
         break
@@ -286,7 +361,9 @@ export class Parser {
             this.advance()
           }
         } else if (this.isDecoration()) {
-          contents.push(new Decoration(curTokn))
+          contents.push(
+            new Decoration(curTokn, this.symbols.resolve(curTokn.lexeme))
+          )
           this.advance()
         } else if (this.isMultiMesureRest()) {
           contents.push(this.multiMeasureRest())
@@ -300,8 +377,48 @@ export class Parser {
         throw this.error(curTokn, "Unexpected token in music code")
     }
 
+    // the notes and chords following a tuplet marker get its reference,
+    // so their durations can be scaled without looking back
+    if (this.tupletNotes > 0) {
+      for (const content of contents) {
+        if (!(content instanceof Note || content instanceof Chord)) continue
+        content.tuplet = this.tuplet!
+        if (--this.tupletNotes === 0) this.tuplet = null
+      }
+    }
     return new Music_code(contents)
   }
+  /**
+   * `(p`, `(p:q`, `(p:q:r` or `(p::r`
+   */
+  private tuplet_marker() {
+    const p = this.peek()
+    this.advance()
+    let q: Token | undefined
+    let r: Token | undefined
+    const separators: Array<Token> = []
+    if (this.peek().type === TokenType.COLON) {
+      separators.push(this.advance())
+      if (this.peek().type === TokenType.NUMBER) {
+        q = this.peek()
+        this.advance()
+      }
+      if (this.peek().type === TokenType.COLON) {
+        separators.push(this.advance())
+        if (this.peek().type === TokenType.NUMBER) {
+          r = this.peek()
+          this.advance()
+        }
+      }
+    } else if (this.peek().type === TokenType.COLON_DBL) {
+      separators.push(this.advance())
+      if (this.peek().type === TokenType.NUMBER) {
+        r = this.peek()
+        this.advance()
+      }
+    }
+    return new Tuplet(p, q, r, separators)
+  }
   barline() {
     return new BarLine(this.peek())
   }
@@ -327,14 +444,16 @@ export class Parser {
           "|",
           null,
           pkd.line,
-          pkd.position
+          pkd.position,
+          pkd.offset
         )
         const numberToken = new Token(
           TokenType.NUMBER,
           pkd.lexeme.substring(1),
           null,
           pkd.line,
-          pkd.position + 1
+          pkd.position + 1,
+          pkd.offset + 1
         )
         this.advance()
         return [new BarLine(barToken), new Nth_repeat(numberToken)]
@@ -346,14 +465,16 @@ export class Parser {
           ":|",
           null,
           pkd.line,
-          pkd.position
+          pkd.position,
+          pkd.offset
         )
         const numberToken = new Token(
           TokenType.NUMBER,
           pkd.lexeme.substring(2),
           null,
           pkd.line,
-          pkd.position + 2
+          pkd.position + 2,
+          pkd.offset + 2
         )
         this.advance()
         return [new BarLine(barToken), new Nth_repeat(numberToken)]
@@ -371,7 +492,7 @@ export class Parser {
     if (
       (type === TokenType.DOT ||
         type === TokenType.TILDE ||
-        (type === TokenType.LETTER && /[HLMOPSTuv]/.test(lexeme))) &&
+        (type === TokenType.LETTER && this.symbols.has(lexeme))) &&
       (nxtType.type === TokenType.FLAT ||
         nxtType.type === TokenType.FLAT_DBL ||
         nxtType.type === TokenType.NATURAL ||
@@ -429,7 +550,9 @@ export class Parser {
     }
     // consume the right bracket
     this.consume(this.peek().type, "Expected a right bracket")
-    return new Inline_field(field, text)
+    const inline_field = new Inline_field(field, text)
+    if (field.lexeme === "U:") this.symbols.define(fieldValue(inline_field))
+    return inline_field
   }
   grace_group() {
     // parse a grace group
@@ -684,7 +807,7 @@ export class Parser {
     return this.peek().type === type
   }
   private advance(): Token {
-    if (!this.isAtEnd()) this.current++
+    if (!this.isAtEnd()) this.fingerprint.add(this.tokens[this.current++])
     return this.previous()
   }
   private isAtEnd(): boolean {
@@ -728,3 +851,53 @@ export class Parser {
     )
   }
 }
+
+export type ParseAsyncOptions = {
+  // time spent parsing before yielding to the event loop
+  budgetMs?: number
+  // stops the parse, rejecting with the signal's reason
+  signal?: AbortSignal
+}
+
+// tokens scanned between two looks at the clock
+const SCAN_SLICE = 4096
+
+/**
+ * Scans and parses the source in slices of `budgetMs`,
+ * yielding to the event loop between them,
+ * so that large documents don't block it.
+ * Resolves to the same tree as `Parser.parse()`.
+ *
+ * Parsing pauses between tunes and within their bodies,
+ * so aborting takes effect within a slice even in a single large tune.
+ */
+export const parseAsync = async (
+  source: string,
+  { budgetMs = 10, signal }: ParseAsyncOptions = {}
+): Promise<File_structure | null> => {
+  const check = () => {
+    if (signal?.aborted) throw signal.reason
+  }
+  let deadline = Date.now() + budgetMs
+  const pause = async () => {
+    if (Date.now() >= deadline) {
+      await new Promise((resolve) => setTimeout(resolve, 0))
+      deadline = Date.now() + budgetMs
+    }
+    check()
+  }
+  check()
+  const scanner = new Scanner(source)
+  let tokens = scanner.scanSome(SCAN_SLICE)
+  while (!tokens) {
+    await pause()
+    tokens = scanner.scanSome(SCAN_SLICE)
+  }
+  const steps = new Parser(tokens, source).parseSteps()
+  let step = steps.next()
+  while (!step.done) {
+    await pause()
+    step = steps.next()
+  }
+  return step.value
+}
@@ -0,0 +1,291 @@
+import { cpus } from "os"
+import { extname, join } from "path"
+import { TextDecoder, TextEncoder } from "util"
+import { Worker } from "worker_threads"
+import { setErrorListener } from "./error"
+import { JsonPrinter } from "./JsonWriter"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { StringBuilder } from "./Writer"
+
+/**
+ * A parse as typed arrays, to be transferred between threads
+ * instead of cloning the tree.
+ *
+ * Token `i` has its type, offset, length and line at index `i` of the
+ * arrays, the last token being the end of file.
+ * The tree is the UTF-8 JSON of the `JsonPrinter`,
+ * empty when the parse failed.
+ */
+export type ParseState = {
+  ok: boolean
+  // messages of the scanner and parser errors
+  errors: Array<string>
+  types: Uint8Array
+  offsets: Uint32Array
+  lengths: Uint32Array
+  lines: Uint32Array
+  tree: Uint8Array
+}
+
+/**
+ * Scans and parses the source into a `ParseState`.
+ */
+export const encodeParse = (source: string): ParseState => {
+  const errors: Array<string> = []
+  const previous = setErrorListener((_, message) => errors.push(message))
+  try {
+    const tokens = new Scanner(source).scanTokens()
+    const n = tokens.length
+    const types = new Uint8Array(n)
+    const offsets = new Uint32Array(n)
+    const lengths = new Uint32Array(n)
+    const lines = new Uint32Array(n)
+    for (let i = 0; i < n; i++) {
+      const token = tokens[i]
+      types[i] = token.type
+      offsets[i] = token.offset
+      lengths[i] = token.lexeme.length
+      lines[i] = token.line
+    }
+    const ast = new Parser(tokens, source).parse()
+    let tree = new Uint8Array(0)
+    if (ast) {
+      const builder = new StringBuilder()
+      new JsonPrinter(builder).print(ast)
+      tree = new TextEncoder().encode(builder.toString())
+    }
+    return { ok: ast !== null, errors, types, offsets, lengths, lines, tree }
+  } finally {
+    setErrorListener(previous)
+  }
+}
+
+/**
+ * A parse received from a worker, read out of its arrays.
+ */
+export class ParseResult {
+  ok: boolean
+  errors: Array<string>
+  types: Uint8Array
+  offsets: Uint32Array
+  lengths: Uint32Array
+  lines: Uint32Array
+  private bytes: Uint8Array
+  constructor(state: ParseState) {
+    this.ok = state.ok
+    this.errors = state.errors
+    this.types = state.types
+    this.offsets = state.offsets
+    this.lengths = state.lengths
+    this.lines = state.lines
+    this.bytes = state.tree
+  }
+
+  // number of tokens
+  get length() {
+    return this.types.length
+  }
+
+  /**
+   * Returns the text of token `i`, out of the source that was parsed.
+   */
+  lexeme(i: number, source: string) {
+    const offset = this.offsets[i]
+    return source.substring(offset, offset + this.lengths[i])
+  }
+
+  /**
+   * Decodes the tree, in the schema of the `JsonPrinter`.
+   * Returns null when the parse failed.
+   */
+  tree(): unknown {
+    if (!this.ok) return null
+    return JSON.parse(new TextDecoder().decode(this.bytes))
+  }
+}
+
+export type ParserPoolOptions = {
+  // parsing threads, 0 to parse on the calling thread
+  workers?: number
+  // jobs waiting for a worker, over which `parse` rejects at once
+  maxQueue?: number
+  // default time limit of a job once started, 0 for none
+  timeoutMs?: number
+}
+
+export type ParseOptions = {
+  signal?: AbortSignal
+  timeoutMs?: number
+}
+
+type Job = {
+  source: string
+  timeoutMs: number
+  signal?: AbortSignal
+  resolve: (result: ParseResult) => void
+  reject: (error: unknown) => void
+  timer?: ReturnType<typeof setTimeout>
+  abort?: () => void
+}
+
+/**
+ * Worker threads scanning and parsing sources,
+ * for servers that can't afford to parse on their main thread.
+ *
+ * Each worker parses one source at a time, the others waiting in a queue
+ * of bounded length, so that a huge source only holds up one worker.
+ * Results come back as transferred typed arrays.
+ * A job that times out or is aborted while running can only be stopped by
+ * terminating its worker, which gets replaced.
+ */
+export class ParserPool {
+  private workers: Array<Worker | null> = []
+  private running: Array<Job | null> = []
+  private queue: Array<Job> = []
+  private maxQueue: number
+  private timeoutMs: number
+  private closed = false
+
+  constructor({
+    workers = cpus().length,
+    maxQueue = 1024,
+    timeoutMs = 0,
+  }: ParserPoolOptions = {}) {
+    this.maxQueue = maxQueue
+    this.timeoutMs = timeoutMs
+    // without workers, a single slot parses on the calling thread
+    const size = Math.max(1, workers)
+    for (let i = 0; i < size; i++) {
+      this.workers.push(workers > 0 ? this.spawn(i) : null)
+      this.running.push(null)
+    }
+  }
+
+  /**
+   * Parses the source on the next free worker.
+   * Rejects when the queue is full, the pool closed,
+   * the job timed out or its signal aborted.
+   */
+  parse(
+    source: string,
+    { signal, timeoutMs = this.timeoutMs }: ParseOptions = {}
+  ): Promise<ParseResult> {
+    if (this.closed) return Promise.reject(new Error("parser pool is closed"))
+    if (signal?.aborted) return Promise.reject(signal.reason)
+    const free = this.running.indexOf(null)
+    if (free === -1 && this.queue.length >= this.maxQueue) {
+      return Promise.reject(new Error("parser queue is full"))
+    }
+    return new Promise((resolve, reject) => {
+      const job: Job = { source, timeoutMs, signal, resolve, reject }
+      if (signal) {
+        job.abort = () => this.cancel(job, signal.reason)
+        signal.addEventListener("abort", job.abort)
+      }
+      if (free === -1) this.queue.push(job)
+      else this.start(free, job)
+    })
+  }
+
+  /**
+   * Stops the workers, rejecting the jobs not done yet.
+   */
+  close() {
+    this.closed = true
+    const error = new Error("parser pool is closed")
+    for (const job of this.queue.splice(0)) this.settle(job, error)
+    this.running.forEach((job, slot) => {
+      if (job) this.settle(job, error)
+      this.running[slot] = null
+    })
+    const workers = this.workers
+    this.workers = []
+    return Promise.all(
+      workers.map((worker) => worker && worker.terminate())
+    ).then(() => undefined)
+  }
+
+  private spawn(slot: number) {
+    const file = join(__dirname, `ParserWorker${extname(__filename)}`)
+    // under ts-node, the workers need its loader as well
+    const execArgv =
+      extname(__filename) === ".ts" ? ["-r", "ts-node/register"] : undefined
+    const worker = new Worker(file, { execArgv })
+    worker.on("message", (state: ParseState) => {
+      const job = this.running[slot]
+      if (!job || this.workers[slot] !== worker) return
+      this.settle(job, null, new ParseResult(state))
+      this.next(slot)
+    })
+    worker.on("error", (error) => {
+      if (this.workers[slot] !== worker) return
+      this.restart(slot, error)
+    })
+    // workers can also exit without an error, e.g. from `process.exit()`
+    worker.on("exit", (code) => {
+      if (this.workers[slot] !== worker) return
+      this.restart(slot, new Error(`parser worker exited with code ${code}`))
+    })
+    return worker
+  }
+
+  private start(slot: number, job: Job) {
+    this.running[slot] = job
+    if (job.timeoutMs > 0) {
+      job.timer = setTimeout(
+        () => this.cancel(job, new Error("parse timed out")),
+        job.timeoutMs
+      )
+    }
+    const worker = this.workers[slot]
+    if (worker) {
+      worker.postMessage(job.source)
+    } else {
+      setImmediate(() => {
+        if (this.running[slot] !== job) return
+        this.settle(job, null, new ParseResult(encodeParse(job.source)))
+        this.next(slot)
+      })
+    }
+  }
+
+  private next(slot: number) {
+    this.running[slot] = null
+    const job = this.queue.shift()
+    if (job) this.start(slot, job)
+  }
+
+  /**
+   * Rejects the job, taking it out of the queue,
+   * or replacing its worker when it is running.
+   */
+  private cancel(job: Job, error: unknown) {
+    const queued = this.queue.indexOf(job)
+    if (queued !== -1) {
+      this.queue.splice(queued, 1)
+      this.settle(job, error)
+      return
+    }
+    const slot = this.running.indexOf(job)
+    if (slot !== -1) this.restart(slot, error)
+  }
+
+  private restart(slot: number, error: unknown) {
+    const job = this.running[slot]
+    if (job) this.settle(job, error)
+    const worker = this.workers[slot]
+    if (worker) {
+      worker.terminate()
+      this.workers[slot] = this.closed ? null : this.spawn(slot)
+    }
+    this.next(slot)
+  }
+
+  private settle(job: Job, error: unknown, result?: ParseResult) {
+    if (job.timer) clearTimeout(job.timer)
+    if (job.abort) job.signal!.removeEventListener("abort", job.abort)
+    if (result) job.resolve(result)
+    else job.reject(error)
+  }
+}
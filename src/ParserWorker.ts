@@ -0,0 +1,17 @@
+import { parentPort } from "worker_threads"
+import { encodeParse } from "./ParserPool"
+
+/**
+ * Parses the sources sent by the `ParserPool`,
+ * and sends each parse back as transferred arrays.
+ */
+parentPort!.on("message", (source: string) => {
+  const state = encodeParse(source)
+  parentPort!.postMessage(state, [
+    state.types.buffer,
+    state.offsets.buffer,
+    state.lengths.buffer,
+    state.lines.buffer,
+    state.tree.buffer,
+  ])
+})
@@ -0,0 +1,216 @@
+import { resolveDurations, TuneDurations } from "./Duration"
+import {
+  Chord,
+  Expr,
+  Info_line,
+  Inline_field,
+  MultiMeasureRest,
+  Note,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue, headerValue } from "./fields"
+import { toNumber } from "./rational"
+import { analyzeStructure } from "./Structure"
+import Token from "./token"
+
+/**
+ * Parses the order of the parts in a header `P:` field,
+ * expanding repeats and groups: `A2B` gives `AAB`,
+ * `(AB)3C` gives `ABABABC`.
+ * Dots and spaces between the parts are ignored.
+ */
+export const parsePartOrder = (value: string): Array<string> => {
+  let position = 0
+  const repeat = () => {
+    const match = /^\d+/.exec(value.substring(position))
+    if (!match) return 1
+    position += match[0].length
+    return Number(match[0])
+  }
+  const sequence = (): Array<string> => {
+    const parts: Array<string> = []
+    while (position < value.length) {
+      const char = value.charAt(position)
+      let item: Array<string>
+      if (char === ")") {
+        break
+      } else if (char === "(") {
+        position++
+        item = sequence()
+        position++
+      } else if (/[A-Za-z]/.test(char)) {
+        position++
+        item = [char]
+      } else {
+        position++
+        continue
+      }
+      const times = repeat()
+      for (let i = 0; i < times; i++) parts.push(...item)
+    }
+    return parts
+  }
+  return sequence()
+}
+
+export type PartSection = {
+  label: string
+  // range of the structure's sequence,
+  // from the part's `P:` field to the next one
+  start: number
+  end: number
+  // length of the part once its repeats are played, in whole notes
+  duration: number
+}
+
+/**
+ * The parts of a tune and the order they are played in.
+ * Entry `i` of the performance plays `sections[order[i]]`
+ * from time `offsets[i]`, `offsets[order.length]` being the tune's length.
+ */
+export class TuneParts {
+  sections: Array<PartSection>
+  order: Uint16Array
+  offsets: Float64Array
+  constructor(sections: Array<PartSection>, order: Array<number>) {
+    this.sections = sections
+    this.order = Uint16Array.from(order)
+    this.offsets = new Float64Array(order.length + 1)
+    order.forEach((section, i) => {
+      this.offsets[i + 1] = this.offsets[i] + sections[section].duration
+    })
+  }
+
+  /**
+   * Yields the sections in the order they are played, with their onsets.
+   */
+  *performance(): Generator<{ section: PartSection; offset: number }> {
+    for (let i = 0; i < this.order.length; i++) {
+      yield { section: this.sections[this.order[i]], offset: this.offsets[i] }
+    }
+  }
+}
+
+const isPartField = (
+  element: Expr | Token
+): element is Info_line | Inline_field =>
+  (element instanceof Info_line || element instanceof Inline_field) &&
+  fieldName(element) === "P"
+
+/**
+ * Cuts the body at its `P:` fields,
+ * then times each part by unfolding the tune's repeats:
+ * every bar counts towards the part and voice it starts in.
+ */
+class PartResolver {
+  private durations: TuneDurations
+
+  constructor(tune: Tune) {
+    this.durations = resolveDurations(tune)
+  }
+
+  resolve(tune: Tune) {
+    const structure = analyzeStructure(tune)
+    const sequence = structure.sequence
+    const sections: Array<PartSection> = []
+    const barSections = new Int32Array(structure.length).fill(-1)
+    const barVoices = new Uint16Array(structure.length)
+    const barDurations = new Float64Array(structure.length)
+    const voiceNames: Array<string> = []
+    let voice = 0
+    let bar = 0
+    // fields right after `K:` are parsed into the header,
+    // a part field among them labels the start of the body
+    const info_lines = tune.tune_header.info_lines
+    const key = info_lines.findIndex((line) => fieldName(line) === "K")
+    for (const line of key === -1 ? [] : info_lines.slice(key + 1)) {
+      if (fieldName(line) !== "P") continue
+      const label = fieldValue(line).charAt(0)
+      sections.length = 0
+      sections.push({ label, start: 0, end: sequence.length, duration: 0 })
+    }
+    sequence.forEach((element, i) => {
+      while (bar < structure.length && i >= structure.ends[bar]) bar++
+      if (isPartField(element)) {
+        if (sections.length > 0) sections[sections.length - 1].end = i
+        const label = fieldValue(element).charAt(0)
+        sections.push({ label, start: i, end: sequence.length, duration: 0 })
+      } else if (
+        (element instanceof Info_line || element instanceof Inline_field) &&
+        fieldName(element) === "V"
+      ) {
+        const name = fieldValue(element).split(/\s/)[0]
+        voice = voiceNames.indexOf(name)
+        if (voice === -1) voice = voiceNames.push(name) - 1
+      } else if (bar < structure.length && i >= structure.starts[bar]) {
+        const duration = this.duration(element)
+        if (duration > 0 && barSections[bar] === -1) {
+          barSections[bar] = sections.length - 1
+          barVoices[bar] = voice
+        }
+        barDurations[bar] += duration
+      }
+    })
+
+    // time of each part in each voice, the longest voice giving its length
+    const voices = Math.max(1, voiceNames.length)
+    const times = new Float64Array(sections.length * voices)
+    for (const bar of structure.playback()) {
+      const section = barSections[bar]
+      if (section < 0) continue
+      times[section * voices + barVoices[bar]] += barDurations[bar]
+    }
+    sections.forEach((section, s) => {
+      for (let v = 0; v < voices; v++) {
+        section.duration = Math.max(section.duration, times[s * voices + v])
+      }
+    })
+
+    const header = key === -1 ? info_lines : info_lines.slice(0, key)
+    const value = headerValue(header, "P")
+    const order: Array<number> = []
+    if (value === undefined) {
+      sections.forEach((_, s) => order.push(s))
+    } else {
+      for (const label of parsePartOrder(value)) {
+        const s = sections.findIndex((section) => section.label === label)
+        if (s !== -1) order.push(s)
+      }
+    }
+    return new TuneParts(sections, order)
+  }
+
+  private duration(element: Expr | Token): number {
+    if (element instanceof Slur_group) {
+      let total = 0
+      for (const content of element.contents) total += this.duration(content)
+      return total
+    }
+    if (
+      element instanceof Note ||
+      element instanceof Chord ||
+      element instanceof MultiMeasureRest
+    ) {
+      const duration = this.durations.durationOf(element)
+      return duration ? toNumber(duration) : 0
+    }
+    return 0
+  }
+}
+
+const cache = new WeakMap<Tune, TuneParts>()
+
+/**
+ * Returns the parts of the tune, in the order of its `P:` header.
+ * Tunes without that header play their parts as written.
+ * Results are cached per tune.
+ */
+export const resolveParts = (tune: Tune): TuneParts => {
+  let parts = cache.get(tune)
+  if (!parts) {
+    parts = new PartResolver(tune).resolve(tune)
+    cache.set(tune, parts)
+  }
+  return parts
+}
@@ -0,0 +1,168 @@
+import {
+  BarLine,
+  Chord,
+  Expr,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  Note,
+  Pitch,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue, headerValue } from "./fields"
+import {
+  letterIndex,
+  midiNumber,
+  parseKey,
+  pitchOctave,
+  signature,
+  writtenAlteration,
+} from "./Key"
+import Token from "./token"
+
+// accidentals are tracked for 11 octaves around middle C
+export const OCTAVES = 11
+export const SLOTS = OCTAVES * 7
+
+/**
+ * MIDI pitches of a tune's notes, including chord and grace notes.
+ * Notes are listed in the order of the body,
+ * with their pitch at the same index in `pitches`.
+ * Rests aren't listed.
+ */
+export class TunePitches {
+  notes: Array<Note>
+  pitches: Uint8Array
+  private index: Map<Note, number>
+  constructor(notes: Array<Note>, pitches: Uint8Array) {
+    this.notes = notes
+    this.pitches = pitches
+    this.index = new Map()
+    notes.forEach((note, i) => this.index.set(note, i))
+  }
+  get length() {
+    return this.notes.length
+  }
+  /**
+   * Returns the note's MIDI pitch, or -1 if the note isn't a pitched note.
+   */
+  pitchOf(note: Note) {
+    const i = this.index.get(note)
+    return i === undefined ? -1 : this.pitches[i]
+  }
+}
+
+/**
+ * Resolves the pitches in a single pass over the tune.
+ *
+ * The key's alterations come from the precomputed signature tables.
+ * Accidentals written in a bar are stored per octave and letter,
+ * along with the number of the bar they were written in:
+ * moving to the next bar invalidates them all at once.
+ * Changing voice or key starts a new bar as well.
+ * A tied note's alteration carries over to the note it is tied to,
+ * even across the bar line, but not to the notes after it.
+ */
+class PitchResolver {
+  private key: Int8Array = signature(0)
+  private alterations = new Int8Array(SLOTS)
+  private bars = new Uint32Array(SLOTS)
+  // slots of the notes tied to the next note or chord
+  private tied = new Uint8Array(SLOTS)
+  private ties: Array<number> = []
+  private bar = 1
+  private notes: Array<Note> = []
+  private pitches: Array<number> = []
+
+  resolve(tune: Tune) {
+    const key = parseKey(headerValue(tune.tune_header.info_lines, "K") || "")
+    this.key = key ? key.alterations : signature(0)
+    if (tune.tune_body) {
+      for (const element of tune.tune_body.sequence) this.element(element)
+    }
+    return new TunePitches(this.notes, Uint8Array.from(this.pitches))
+  }
+
+  private element(element: Expr | Token) {
+    if (element instanceof Note) {
+      const ties = this.ties
+      this.ties = []
+      this.note(element)
+      this.untie(ties)
+    } else if (element instanceof Chord) {
+      const ties = this.ties
+      this.ties = []
+      for (const content of element.contents) {
+        if (content instanceof Note) this.note(content)
+      }
+      this.untie(ties)
+    } else if (element instanceof Grace_group) {
+      for (const note of element.notes) this.note(note)
+    } else if (element instanceof Slur_group) {
+      for (const content of element.contents) this.element(content)
+    } else if (element instanceof BarLine) {
+      this.bar++
+    } else if (
+      element instanceof Info_line ||
+      element instanceof Inline_field
+    ) {
+      const name = fieldName(element)
+      if (name === "K") {
+        const key = parseKey(fieldValue(element))
+        if (key) this.key = key.alterations
+        this.bar++
+      } else if (name === "V") {
+        this.bar++
+      }
+    }
+  }
+
+  private note(note: Note) {
+    const pitch = note.pitch
+    if (!(pitch instanceof Pitch)) return
+    const letter = letterIndex(pitch)
+    const octave = Math.max(0, Math.min(OCTAVES - 1, pitchOctave(pitch) + 5))
+    const slot = octave * 7 + letter
+    let alteration = writtenAlteration(pitch)
+    if (alteration !== undefined) {
+      this.alterations[slot] = alteration
+      this.bars[slot] = this.bar
+    } else if (this.bars[slot] === this.bar || this.tied[slot]) {
+      alteration = this.alterations[slot]
+    } else {
+      alteration = this.key[letter]
+    }
+    if (note.tie) {
+      this.alterations[slot] = alteration
+      this.ties.push(slot)
+    }
+    this.notes.push(note)
+    const midi = midiNumber(pitch, alteration)
+    this.pitches.push(Math.max(0, Math.min(127, midi)))
+  }
+
+  /**
+   * Ends the ties that the previous note or chord started,
+   * keeping those its own notes start.
+   */
+  private untie(ties: Array<number>) {
+    for (const slot of ties) this.tied[slot] = 0
+    for (const slot of this.ties) this.tied[slot] = 1
+  }
+}
+
+const cache = new WeakMap<Tune, TunePitches>()
+
+/**
+ * Returns the MIDI pitches of the tune's notes.
+ * Results are cached per tune.
+ */
+export const resolvePitches = (tune: Tune): TunePitches => {
+  let pitches = cache.get(tune)
+  if (!pitches) {
+    pitches = new PitchResolver().resolve(tune)
+    cache.set(tune, pitches)
+  }
+  return pitches
+}
@@ -12,13 +12,27 @@ export default class Scanner {
     this.source = source
   }
 
-  scanTokens = (): Array<Token> => {
-    while (!this.isAtEnd()) {
+  scanTokens = (): Array<Token> => this.scanSome(Infinity)!
+
+  /**
+   * Scans the next `count` tokens at most, for scanning in slices.
+   * Returns the tokens once the source is scanned, null until then.
+   */
+  scanSome = (count: number): Array<Token> | null => {
+    for (let i = 0; i < count && !this.isAtEnd(); i++) {
       this.start = this.current
       this.scanToken()
     }
+    if (!this.isAtEnd()) return null
     this.tokens.push(
-      new Token(TokenType.EOF, "\n", null, this.line, this.start)
+      new Token(
+        TokenType.EOF,
+        "\n",
+        null,
+        this.line,
+        this.start,
+        this.current
+      )
     )
     return this.tokens
   }
@@ -30,6 +44,10 @@ export default class Scanner {
         if (this.peek() === "\n" && !this.isAtEnd()) {
           this.advance()
           this.addToken(TokenType.ANTISLASH_EOL)
+        } else if (this.peek() === "-") {
+          // hyphen kept inside a syllable of the lyrics, e.g. `w: Fa\-la`
+          this.advance()
+          this.addToken(TokenType.RESERVED_CHAR)
         } else {
           error(this.line, this.errorMessage("expected an end of line"))
         }
@@ -336,6 +354,8 @@ export default class Scanner {
     const lineBreak = this.source.lastIndexOf("\n", this.current)
     const charPos = this.current - lineBreak - 1
 
-    this.tokens.push(new Token(type, text, literal || null, this.line, charPos))
+    this.tokens.push(
+      new Token(type, text, literal || null, this.line, charPos, this.start)
+    )
   }
 }
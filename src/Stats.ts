@@ -0,0 +1,349 @@
+import { readFileSync } from "fs"
+import { cpus } from "os"
+import { extname, join } from "path"
+import { Worker } from "worker_threads"
+import { parseMeter, rhythmValue } from "./Duration"
+import { setErrorListener } from "./error"
+import {
+  Chord,
+  Decoration,
+  Expr,
+  Note,
+  Rest,
+  Slur_group,
+  Symbol,
+  Tune,
+} from "./Expr"
+import { headerValue } from "./fields"
+import { LETTERS, normalizeMode } from "./Key"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { HyperLogLog, TDigest } from "./sketches"
+import Token from "./token"
+import { splitTunes } from "./tunes"
+import { TokenType } from "./types"
+
+// modes as counted, the others being synonyms
+const MODES = ["", "mix", "dor", "min", "phr", "lyd", "loc"]
+const MODE_NAMES: { [mode: string]: string } = { maj: "", ion: "", aeo: "min" }
+
+const KEYS: Array<string> = []
+for (const letter of LETTERS) {
+  for (const accidental of ["", "#", "b"]) {
+    for (const mode of MODES) KEYS.push(letter + accidental + mode)
+  }
+}
+
+const DENOMINATORS = [1, 2, 4, 8, 16, 32]
+const METERS: Array<string> = []
+for (const denominator of DENOMINATORS) {
+  for (let numerator = 1; numerator <= 16; numerator++) {
+    METERS.push(`${numerator}/${denominator}`)
+  }
+}
+
+// written lengths of notes and rests, in unit note lengths
+const LENGTHS: Array<string> = []
+for (const denominator of DENOMINATORS.slice(0, 5)) {
+  for (let numerator = 1; numerator <= 16; numerator++) {
+    LENGTHS.push(`${numerator}/${denominator}`)
+  }
+}
+
+// decorations of ABC 2.1, without their `!`
+const DECORATIONS = (
+  ". trill trill( trill) lowermordent uppermordent mordent pralltriller " +
+  "roll turn turnx invertedturn invertedturnx arpeggio > accent emphasis " +
+  "fermata invertedfermata tenuto 0 1 2 3 4 5 + plus snap slide wedge " +
+  "upbow downbow open thumb breath pppp ppp pp p mp mf f ff fff ffff sfz " +
+  "crescendo( <( crescendo) <) diminuendo( >( diminuendo) >) segno coda " +
+  "D.S. D.C. dacoda dacapo fine shortphrase mediumphrase longphrase"
+).split(" ")
+
+const TOKENS: Array<string> = []
+for (const name of Object.keys(TokenType)) {
+  const type = TokenType[name as keyof typeof TokenType]
+  if (isNaN(Number(name))) TOKENS[type] = name
+}
+
+// first words of the scanner and parser messages, most specific first
+const ERRORS = [
+  "Unterminated string",
+  "expected an end of line",
+  "unexpected character",
+  "Expected a tune or file header",
+  "Unexpected token after letter",
+  "Unexpected token in music code",
+  "Unexpected token in multi measure rest",
+  "Unexpected token in note",
+  "Unexpected token in rest",
+  "Expected a note letter",
+]
+
+const TOTALS = ["files", "bytes", "tunes", "failed"]
+
+/**
+ * Sections of the counters, one counter per label,
+ * the histograms ending with one for the values out of their labels.
+ */
+const SECTIONS: Array<{ name: string; labels: Array<string> }> = [
+  { name: "totals", labels: TOTALS },
+  { name: "keys", labels: [...KEYS, "other"] },
+  { name: "meters", labels: [...METERS, "none", "other"] },
+  { name: "noteLengths", labels: [...LENGTHS, "other"] },
+  { name: "decorations", labels: [...DECORATIONS, "other"] },
+  { name: "tokens", labels: TOKENS },
+  { name: "errors", labels: [...ERRORS, "other"] },
+]
+const OFFSETS: { [name: string]: number } = {}
+let COUNTERS = 0
+for (const { name, labels } of SECTIONS) {
+  OFFSETS[name] = COUNTERS
+  COUNTERS += labels.length
+}
+const KEYS_OTHER = OFFSETS.keys + KEYS.length
+const METERS_NONE = OFFSETS.meters + METERS.length
+const LENGTHS_OTHER = OFFSETS.noteLengths + LENGTHS.length
+const DECORATIONS_OTHER = OFFSETS.decorations + DECORATIONS.length
+const ERRORS_OTHER = OFFSETS.errors + ERRORS.length
+
+const keyCounter = (value: string | undefined) => {
+  const match = /^([A-G][#b]?)\s*([A-Za-z]*)/.exec(value?.trim() ?? "")
+  if (!match) return KEYS_OTHER
+  const mode = normalizeMode(match[2]) ?? ""
+  const index = KEYS.indexOf(match[1] + (MODE_NAMES[mode] ?? mode))
+  return index === -1 ? KEYS_OTHER : OFFSETS.keys + index
+}
+
+const meterCounter = (value: string | undefined) => {
+  const meter = value === undefined ? null : parseMeter(value)
+  if (!meter) return METERS_NONE
+  const index = METERS.indexOf(`${meter.numerator}/${meter.denominator}`)
+  return index === -1 ? METERS_NONE + 1 : OFFSETS.meters + index
+}
+
+const decorationCounter = (name: string) => {
+  const index = DECORATIONS.indexOf(name.replace(/^[!+]|[!+]$/g, "") || name)
+  return index === -1 ? DECORATIONS_OTHER : OFFSETS.decorations + index
+}
+
+const errorCounter = (message: string) => {
+  const index = ERRORS.findIndex((prefix) => message.indexOf(prefix) !== -1)
+  return index === -1 ? ERRORS_OTHER : OFFSETS.errors + index
+}
+
+export type StatsState = {
+  counters: Float64Array
+  registers: Uint8Array
+  digest: Float64Array
+}
+
+type Histogram = { [label: string]: number }
+
+export type StatsReport = {
+  files: number
+  bytes: number
+  tunes: number
+  // tunes that didn't parse, or parsed with errors
+  failed: number
+  distinctTitles: number
+  // in notes and chords
+  tuneLength: {
+    min: number
+    p50: number
+    p90: number
+    p99: number
+    max: number
+  }
+  keys: Histogram
+  meters: Histogram
+  noteLengths: Histogram
+  decorations: Histogram
+  tokens: Histogram
+  errors: Histogram
+}
+
+/**
+ * Corpus-wide counts, accumulated one file at a time.
+ *
+ * Histograms are sections of one array of counters over fixed labels,
+ * titles go into a HyperLogLog and tune lengths into a t-digest,
+ * so that the statistics of several threads merge into the same.
+ */
+export class CorpusStats {
+  counters = new Float64Array(COUNTERS)
+  titles = new HyperLogLog()
+  lengths = new TDigest()
+
+  addSource(source: string) {
+    const counters = this.counters
+    counters[OFFSETS.totals]++
+    counters[OFFSETS.totals + 1] += source.length
+    let errors = 0
+    const previous = setErrorListener((_, message) => {
+      errors++
+      counters[errorCounter(message)]++
+    })
+    try {
+      for (const chunk of splitTunes(source)) {
+        errors = 0
+        const tokens = new Scanner(chunk.source).scanTokens()
+        for (const token of tokens) counters[OFFSETS.tokens + token.type]++
+        const ast = new Parser(tokens, chunk.source).parse()
+        const tunes = ast ? ast.tune : []
+        for (const tune of tunes) this.addTune(tune)
+        counters[OFFSETS.totals + 2] += tunes.length
+        if (!chunk.source.startsWith("X:")) continue
+        if (tunes.length === 0 || errors > 0) counters[OFFSETS.totals + 3]++
+      }
+    } finally {
+      setErrorListener(previous)
+    }
+  }
+
+  merge(other: CorpusStats) {
+    for (let i = 0; i < COUNTERS; i++) this.counters[i] += other.counters[i]
+    this.titles.merge(other.titles)
+    this.lengths.merge(other.lengths)
+  }
+
+  /**
+   * Returns the statistics as typed arrays, to send them to another thread.
+   */
+  state(): StatsState {
+    return {
+      counters: this.counters,
+      registers: this.titles.registers,
+      digest: this.lengths.serialize(),
+    }
+  }
+
+  static fromState(state: StatsState) {
+    const stats = new CorpusStats()
+    stats.counters = state.counters
+    stats.titles = new HyperLogLog(undefined, state.registers)
+    stats.lengths = TDigest.deserialize(state.digest)
+    return stats
+  }
+
+  report(): StatsReport {
+    const section = (name: string): Histogram => {
+      const { labels } = SECTIONS.find((s) => s.name === name)!
+      const entries: Array<[string, number]> = []
+      labels.forEach((label, i) => {
+        const count = this.counters[OFFSETS[name] + i]
+        if (count > 0) entries.push([label, count])
+      })
+      entries.sort((a, b) => b[1] - a[1])
+      const histogram: Histogram = {}
+      for (const [label, count] of entries) histogram[label] = count
+      return histogram
+    }
+    const totals = this.counters.subarray(OFFSETS.totals)
+    const lengths = this.lengths
+    const quantile = (q: number) =>
+      lengths.count > 0 ? Math.round(lengths.quantile(q)) : 0
+    return {
+      files: totals[0],
+      bytes: totals[1],
+      tunes: totals[2],
+      failed: totals[3],
+      distinctTitles: Math.round(this.titles.estimate()),
+      tuneLength: {
+        min: lengths.count > 0 ? lengths.min : 0,
+        p50: quantile(0.5),
+        p90: quantile(0.9),
+        p99: quantile(0.99),
+        max: lengths.count > 0 ? lengths.max : 0,
+      },
+      keys: section("keys"),
+      meters: section("meters"),
+      noteLengths: section("noteLengths"),
+      decorations: section("decorations"),
+      tokens: section("tokens"),
+      errors: section("errors"),
+    }
+  }
+
+  private addTune(tune: Tune) {
+    const counters = this.counters
+    const { info_lines } = tune.tune_header
+    const title = headerValue(info_lines, "T")
+    if (title) this.titles.add(title.toLowerCase())
+    counters[keyCounter(headerValue(info_lines, "K"))]++
+    counters[meterCounter(headerValue(info_lines, "M"))]++
+
+    let notes = 0
+    const length = (element: Note | Chord) => {
+      const { num, den } = rhythmValue(element.rhythm)
+      const index = LENGTHS.indexOf(`${num}/${den}`)
+      counters[index === -1 ? LENGTHS_OTHER : OFFSETS.noteLengths + index]++
+    }
+    const visit = (element: Expr | Token) => {
+      if (element instanceof Note || element instanceof Chord) {
+        if (!(element instanceof Note && element.pitch instanceof Rest)) {
+          notes++
+        }
+        length(element)
+      } else if (element instanceof Decoration) {
+        const name = element.symbol ?? element.decoration.lexeme
+        counters[decorationCounter(name)]++
+      } else if (element instanceof Symbol) {
+        counters[decorationCounter(element.symbol.lexeme)]++
+      } else if (element instanceof Slur_group) {
+        for (const content of element.contents) visit(content)
+      }
+    }
+    if (tune.tune_body) {
+      for (const element of tune.tune_body.sequence) visit(element)
+    }
+    this.lengths.add(notes)
+  }
+}
+
+export type StatsOptions = {
+  // parsing threads, 0 to parse on the calling thread
+  workers?: number
+}
+
+/**
+ * Computes the statistics of the files.
+ *
+ * Each worker reads and parses the files it is handed into statistics
+ * of its own, asking for the next file when done with one,
+ * and sends them back once the files run out, to be merged.
+ */
+export const collectStats = (
+  paths: Array<string>,
+  { workers = Math.max(1, cpus().length - 1) }: StatsOptions = {}
+): Promise<CorpusStats> => {
+  const stats = new CorpusStats()
+  const size = Math.min(workers, paths.length)
+  if (size === 0) {
+    for (const path of paths) {
+      stats.addSource(readFileSync(path, { encoding: "utf8" }))
+    }
+    return Promise.resolve(stats)
+  }
+  const file = join(__dirname, `StatsWorker${extname(__filename)}`)
+  // under ts-node, the workers need its loader as well
+  const execArgv =
+    extname(__filename) === ".ts" ? ["-r", "ts-node/register"] : undefined
+  let next = 0
+  const run = () =>
+    new Promise<void>((resolve, reject) => {
+      const worker = new Worker(file, { execArgv })
+      const send = () =>
+        worker.postMessage(next < paths.length ? paths[next++] : null)
+      worker.on("message", (state?: StatsState) => {
+        if (!state) return send()
+        stats.merge(CorpusStats.fromState(state))
+        worker.terminate().then(() => resolve(), reject)
+      })
+      worker.on("error", reject)
+      send()
+    })
+  const pool: Array<Promise<void>> = []
+  for (let i = 0; i < size; i++) pool.push(run())
+  return Promise.all(pool).then(() => stats)
+}
@@ -0,0 +1,23 @@
+import { readFileSync } from "fs"
+import { parentPort } from "worker_threads"
+import { CorpusStats } from "./Stats"
+
+/**
+ * Accumulates the statistics of the files sent by `collectStats`,
+ * asking for the next one after each,
+ * and sends the statistics back when sent null.
+ */
+const stats = new CorpusStats()
+parentPort!.on("message", (path: string | null) => {
+  if (path === null) {
+    const state = stats.state()
+    parentPort!.postMessage(state, [
+      state.counters.buffer,
+      state.registers.buffer,
+      state.digest.buffer,
+    ])
+    return
+  }
+  stats.addSource(readFileSync(path, { encoding: "utf8" }))
+  parentPort!.postMessage(null)
+})
@@ -0,0 +1,264 @@
+import {
+  BarLine,
+  Chord,
+  Expr,
+  MultiMeasureRest,
+  Note,
+  Nth_repeat,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import Token from "./token"
+
+// flags of a bar
+export const REPEAT_START = 1
+export const REPEAT_END = 2
+// the bar closes with anything but a single bar line
+export const SECTION_END = 4
+// last bar of a repeated section, or of its endings
+export const SECTION_DONE = 8
+
+// passes are stored as bits, so endings can't go past 32
+const MAX_PASSES = 32
+
+/**
+ * Parses the numbers of an ending, e.g. `1`, `[2`, `1,3` or `1-3`,
+ * into a mask with bit 0 for the first pass.
+ */
+export const endingPasses = (lexeme: string) => {
+  let mask = 0
+  for (const part of lexeme.replace("[", "").split(",")) {
+    const [from, to] = part.split("-").map(Number)
+    if (!from) continue
+    const last = Math.min(MAX_PASSES, to || from)
+    for (let pass = from; pass <= last; pass++) mask |= 1 << (pass - 1)
+  }
+  return mask >>> 0
+}
+
+const isMusic = (element: Expr | Token) =>
+  element instanceof Note ||
+  element instanceof Chord ||
+  element instanceof MultiMeasureRest ||
+  element instanceof Slur_group
+
+const hasBarLine = (group: Slur_group): boolean =>
+  group.contents.some(
+    (content) =>
+      content instanceof BarLine ||
+      content instanceof Nth_repeat ||
+      (content instanceof Slur_group && hasBarLine(content))
+  )
+
+/**
+ * Returns the body with the slurs that hold bar lines
+ * replaced by their contents, since a bar can't start within an element.
+ * Bodies without such slurs are returned as they are.
+ */
+const flattenSlurs = (sequence: Array<Expr | Token>) => {
+  const split = (element: Expr | Token): element is Slur_group =>
+    element instanceof Slur_group && hasBarLine(element)
+  if (!sequence.some(split)) return sequence
+  const flat: Array<Expr | Token> = []
+  const add = (element: Expr | Token) => {
+    if (split(element)) element.contents.forEach(add)
+    else flat.push(element)
+  }
+  sequence.forEach(add)
+  return flat
+}
+
+/**
+ * The bars of a tune and how its repeats link them.
+ *
+ * Bar `i` covers the elements of `sequence` from `starts[i]` to `ends[i]`,
+ * its closing bar line excluded.
+ * The sequence is the tune's body, unless slurs hold bar lines:
+ * those slurs are replaced by their contents.
+ * Bars without notes, such as the one before a leading `|:`,
+ * are merged into their neighbours.
+ *
+ * Repeats form a graph over the bars:
+ * a bar closing a repeat jumps back to `targets[i]` until it has been
+ * played `passes[i]` times, and a bar opening an ending skips to the
+ * bar after `endingEnds[i]` on the passes missing from `endings[i]`.
+ */
+export class TuneStructure {
+  sequence: Array<Expr | Token>
+  length: number
+  starts: Int32Array
+  ends: Int32Array
+  flags: Uint8Array
+  // passes of the ending opening at each bar, 0 outside of endings
+  endings: Uint32Array
+  endingEnds: Int32Array
+  targets: Int32Array
+  passes: Uint8Array
+  constructor(sequence: Array<Expr | Token>, length: number) {
+    this.sequence = sequence
+    this.length = length
+    this.starts = new Int32Array(length)
+    this.ends = new Int32Array(length)
+    this.flags = new Uint8Array(length)
+    this.endings = new Uint32Array(length)
+    this.endingEnds = new Int32Array(length).fill(-1)
+    this.targets = new Int32Array(length).fill(-1)
+    this.passes = new Uint8Array(length)
+  }
+
+  /**
+   * Yields the bars in the order they are played, repeats unfolded.
+   * Only the current pass is kept, so unfolding a tune
+   * takes no more memory than the written bars.
+   */
+  *playback(): Generator<number> {
+    let pass = 1
+    let bar = 0
+    while (bar < this.length) {
+      const ending = this.endings[bar]
+      if (ending && !(ending & (1 << (pass - 1)))) {
+        const last = this.endingEnds[bar]
+        if (this.flags[last] & SECTION_DONE) pass = 1
+        bar = last + 1
+        continue
+      }
+      yield bar
+      const flags = this.flags[bar]
+      if (flags & REPEAT_END && pass < this.passes[bar]) {
+        pass++
+        bar = this.targets[bar]
+      } else {
+        if (flags & SECTION_DONE) pass = 1
+        bar++
+      }
+    }
+  }
+
+  /**
+   * Yields the elements of the bar, straight from the tune's body.
+   */
+  *elements(bar: number): Generator<Expr | Token> {
+    for (let i = this.starts[bar]; i < this.ends[bar]; i++) {
+      yield this.sequence[i]
+    }
+  }
+}
+
+/**
+ * Splits the body into bars in a single pass,
+ * then links the repeats and endings.
+ */
+class StructureAnalyzer {
+  private starts: Array<number> = []
+  private ends: Array<number> = []
+  private flags: Array<number> = []
+  private endings: Array<number> = []
+
+  analyze(tune: Tune) {
+    const body = tune.tune_body ? tune.tune_body.sequence : []
+    const sequence = flattenSlurs(body)
+    let start = 0
+    let music = false
+    // flags and ending of the bar being read, from its opening bar line
+    let opening = 0
+    let ending = 0
+    sequence.forEach((element, i) => {
+      if (element instanceof BarLine) {
+        const lexeme = element.barline.lexeme
+        let closing = lexeme === "|" ? 0 : SECTION_END
+        if (lexeme.charAt(0) === ":") closing |= REPEAT_END
+        if (music) {
+          this.push(start, i, opening | closing, ending)
+          opening = 0
+          ending = 0
+        } else if (this.flags.length > 0) {
+          this.flags[this.flags.length - 1] |= closing
+        }
+        if (lexeme.length > 1 && lexeme.charAt(lexeme.length - 1) === ":") {
+          opening |= REPEAT_START
+        }
+        start = i + 1
+        music = false
+      } else if (element instanceof Nth_repeat) {
+        ending |= endingPasses(element.repeat.lexeme)
+      } else if (!music && isMusic(element)) {
+        music = true
+      }
+    })
+    if (music) this.push(start, sequence.length, opening, ending)
+
+    const structure = new TuneStructure(sequence, this.starts.length)
+    structure.starts.set(this.starts)
+    structure.ends.set(this.ends)
+    structure.flags.set(this.flags)
+    structure.endings.set(this.endings)
+    this.link(structure)
+    return structure
+  }
+
+  private push(start: number, end: number, flags: number, ending: number) {
+    this.starts.push(start)
+    this.ends.push(end)
+    this.flags.push(flags)
+    this.endings.push(ending)
+  }
+
+  /**
+   * An ending runs until the next ending, or up to the first bar
+   * closing with a repeat or a double bar line.
+   * The repeats of a group of endings jump back to the start
+   * of the section as long as later endings remain to be played.
+   */
+  private link(structure: TuneStructure) {
+    const { length, flags, endings, endingEnds, targets, passes } = structure
+    let sectionStart = 0
+    // highest pass of the current group of endings, and its repeats
+    let group = 0
+    let groupEnd = -1
+    const repeats: Array<number> = []
+    for (let bar = 0; bar < length; bar++) {
+      if (flags[bar] & REPEAT_START) sectionStart = bar
+      if (endings[bar]) {
+        let last = bar
+        while (
+          last + 1 < length &&
+          !endings[last + 1] &&
+          !(flags[last] & (SECTION_END | REPEAT_END))
+        ) {
+          last++
+        }
+        endingEnds[bar] = last
+        groupEnd = last
+        group = Math.max(group, 32 - Math.clz32(endings[bar]))
+      }
+      if (flags[bar] & REPEAT_END) {
+        targets[bar] = sectionStart
+        passes[bar] = 2
+        repeats.push(bar)
+      }
+      if (bar < groupEnd || (bar + 1 < length && endings[bar + 1])) continue
+      if (group || flags[bar] & REPEAT_END) {
+        for (const repeat of repeats) passes[repeat] = Math.max(2, group)
+        flags[bar] |= SECTION_DONE
+        sectionStart = bar + 1
+        repeats.length = 0
+        group = 0
+      }
+    }
+  }
+}
+
+const cache = new WeakMap<Tune, TuneStructure>()
+
+/**
+ * Returns the bars and repeats of the tune.
+ * Results are cached per tune.
+ */
+export const analyzeStructure = (tune: Tune): TuneStructure => {
+  let structure = cache.get(tune)
+  if (!structure) {
+    structure = new StructureAnalyzer().analyze(tune)
+    cache.set(tune, structure)
+  }
+  return structure
+}
@@ -0,0 +1,73 @@
+/**
+ * Symbols that stand for a decoration in the music,
+ * with their default meaning in ABC 2.1.
+ */
+const DEFAULTS: { [char: string]: string } = {
+  "~": "!roll!",
+  H: "!fermata!",
+  L: "!accent!",
+  M: "!lowermordent!",
+  O: "!coda!",
+  P: "!uppermordent!",
+  S: "!segno!",
+  T: "!trill!",
+  u: "!upbow!",
+  v: "!downbow!",
+}
+
+// `~`, `H` to `W` and `h` to `w` can be redefined with `U:`
+const isRedefinable = (char: string) => /^[~H-Wh-w]$/.test(char)
+
+/**
+ * The decoration of each redefinable symbol, indexed by char code,
+ * so the parser looks symbols up in constant time.
+ */
+export class SymbolTable {
+  private symbols: Array<string | undefined>
+  constructor(symbols?: Array<string | undefined>) {
+    if (symbols) {
+      this.symbols = symbols.slice()
+    } else {
+      this.symbols = new Array(128)
+      for (const char of Object.keys(DEFAULTS)) {
+        this.symbols[char.charCodeAt(0)] = DEFAULTS[char]
+      }
+    }
+  }
+
+  has(char: string) {
+    return char.length === 1 && this.symbols[char.charCodeAt(0)] !== undefined
+  }
+
+  /**
+   * Returns the decoration of the symbol,
+   * undefined for symbols defined as `!nil!`.
+   */
+  resolve(char: string) {
+    if (char.length !== 1) return undefined
+    return this.symbols[char.charCodeAt(0)] || undefined
+  }
+
+  /**
+   * Applies the value of a `U:` field, e.g. `T = !trill!`.
+   * `!nil!` and `!none!` leave the symbol without a decoration,
+   * so it is still accepted in the music but means nothing.
+   * Returns false when the field isn't a valid redefinition.
+   */
+  define(value: string) {
+    const match = /^\s*(\S)\s*=\s*(.*?)\s*$/.exec(value)
+    if (!match || !isRedefinable(match[1])) return false
+    const symbol = match[2]
+    this.symbols[match[1].charCodeAt(0)] =
+      symbol === "!nil!" || symbol === "!none!" ? "" : symbol
+    return true
+  }
+
+  /**
+   * Returns a table starting from these symbols,
+   * for a tune to redefine them without changing the file header's.
+   */
+  copy() {
+    return new SymbolTable(this.symbols)
+  }
+}
@@ -0,0 +1,394 @@
+import { resize } from "./buffers"
+import { resolveDurations, TuneDurations } from "./Duration"
+import {
+  Chord,
+  Decoration,
+  Expr,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  MultiMeasureRest,
+  Note,
+  Pitch,
+  Slur_group,
+  Symbol,
+  Tune,
+} from "./Expr"
+import { fieldName, fieldValue, headerValue } from "./fields"
+import { SourceMap } from "./Macros"
+import { resolvePitches, TunePitches } from "./PitchResolver"
+import { toNumber } from "./rational"
+import Token from "./token"
+import { parseTunes } from "./tunes"
+
+export const DEFAULT_VELOCITY = 80
+
+const DYNAMICS: { [symbol: string]: number } = {
+  pppp: 15,
+  ppp: 30,
+  pp: 45,
+  p: 60,
+  mp: 75,
+  mf: 90,
+  f: 105,
+  ff: 120,
+  fff: 127,
+  ffff: 127,
+}
+
+/**
+ * A field of the body that changes the playback (`M:`, `L:` or `Q:`),
+ * at the onset of the voice it appears in.
+ */
+export type TimedField = { onset: number; name: string; value: string }
+
+/**
+ * The sounding notes of a tune, ordered by onset.
+ *
+ * Event `i` is stored at index `i` of each array.
+ * Onsets and durations are in whole notes,
+ * pitches are MIDI numbers,
+ * voices index into `voiceNames`,
+ * and offsets point to the note in the source.
+ * The decorations of event `i` are the ids in `decorationIds`
+ * from `decorationStarts[i]` to before `decorationStarts[i + 1]`,
+ * indexing into `decorationNames`.
+ * The body's `M:`, `L:` and `Q:` fields are in `fields`, ordered by onset.
+ */
+export class TuneEvents {
+  reference: string
+  voiceNames: Array<string>
+  length: number
+  onsets: Float64Array
+  durations: Float64Array
+  pitches: Uint8Array
+  velocities: Uint8Array
+  voices: Uint16Array
+  offsets: Int32Array
+  decorationNames: Array<string>
+  decorationStarts: Uint32Array
+  decorationIds: Uint16Array
+  fields: Array<TimedField>
+  constructor(
+    reference: string,
+    voiceNames: Array<string>,
+    length: number,
+    onsets: Float64Array,
+    durations: Float64Array,
+    pitches: Uint8Array,
+    velocities: Uint8Array,
+    voices: Uint16Array,
+    offsets: Int32Array,
+    decorationNames: Array<string>,
+    decorationStarts: Uint32Array,
+    decorationIds: Uint16Array,
+    fields: Array<TimedField> = []
+  ) {
+    this.reference = reference
+    this.voiceNames = voiceNames
+    this.length = length
+    this.onsets = onsets
+    this.durations = durations
+    this.pitches = pitches
+    this.velocities = velocities
+    this.voices = voices
+    this.offsets = offsets
+    this.decorationNames = decorationNames
+    this.decorationStarts = decorationStarts
+    this.decorationIds = decorationIds
+    this.fields = fields
+  }
+}
+
+const NO_DECORATIONS: Array<number> = []
+
+/**
+ * Growable columns of events.
+ */
+class EventBuffer {
+  length = 0
+  onsets = new Float64Array(64)
+  durations = new Float64Array(64)
+  pitches = new Uint8Array(64)
+  velocities = new Uint8Array(64)
+  voices = new Uint16Array(64)
+  offsets = new Int32Array(64)
+  // each event's decorations, `decorationCounts[i]` from `firstDecorations[i]`
+  firstDecorations = new Uint32Array(64)
+  decorationCounts = new Uint32Array(64)
+  decorations = new Uint16Array(64)
+  decorationsLength = 0
+
+  push(
+    onset: number,
+    duration: number,
+    pitch: number,
+    velocity: number,
+    voice: number,
+    offset: number,
+    decorations = NO_DECORATIONS
+  ) {
+    if (this.length === this.onsets.length) this.grow()
+    const i = this.length++
+    this.onsets[i] = onset
+    this.durations[i] = duration
+    this.pitches[i] = pitch
+    this.velocities[i] = velocity
+    this.voices[i] = voice
+    this.offsets[i] = offset
+    this.firstDecorations[i] = this.decorationsLength
+    this.decorationCounts[i] = decorations.length
+    if (this.decorationsLength + decorations.length > this.decorations.length) {
+      const size = Math.max(
+        this.decorations.length * 2,
+        this.decorationsLength + decorations.length
+      )
+      this.decorations = resize(this.decorations, size)
+    }
+    this.decorations.set(decorations, this.decorationsLength)
+    this.decorationsLength += decorations.length
+    return i
+  }
+
+  private grow() {
+    const size = this.onsets.length * 2
+    this.onsets = resize(this.onsets, size)
+    this.durations = resize(this.durations, size)
+    this.pitches = resize(this.pitches, size)
+    this.velocities = resize(this.velocities, size)
+    this.voices = resize(this.voices, size)
+    this.offsets = resize(this.offsets, size)
+    this.firstDecorations = resize(this.firstDecorations, size)
+    this.decorationCounts = resize(this.decorationCounts, size)
+  }
+
+  /**
+   * Copies the events into arrays of the exact size,
+   * sorting them by onset when the voices interleave.
+   */
+  toEvents(
+    reference: string,
+    voiceNames: Array<string>,
+    decorationNames: Array<string>,
+    fields: Array<TimedField>
+  ) {
+    const n = this.length
+    const order = new Uint32Array(n)
+    let sorted = true
+    for (let i = 0; i < n; i++) {
+      order[i] = i
+      if (i > 0 && this.onsets[i] < this.onsets[i - 1]) sorted = false
+    }
+    if (!sorted) {
+      // ties are broken by insertion order, to keep the sort stable
+      order.sort((a, b) => this.onsets[a] - this.onsets[b] || a - b)
+    }
+    const events = new TuneEvents(
+      reference,
+      voiceNames,
+      n,
+      new Float64Array(n),
+      new Float64Array(n),
+      new Uint8Array(n),
+      new Uint8Array(n),
+      new Uint16Array(n),
+      new Int32Array(n),
+      decorationNames,
+      new Uint32Array(n + 1),
+      new Uint16Array(this.decorationsLength),
+      // the sort is stable, fields on the same onset keep their order
+      fields.sort((a, b) => a.onset - b.onset)
+    )
+    let decorations = 0
+    for (let i = 0; i < n; i++) {
+      const from = order[i]
+      events.onsets[i] = this.onsets[from]
+      events.durations[i] = this.durations[from]
+      events.pitches[i] = this.pitches[from]
+      events.velocities[i] = this.velocities[from]
+      events.voices[i] = this.voices[from]
+      events.offsets[i] = this.offsets[from]
+      const first = this.firstDecorations[from]
+      const count = this.decorationCounts[from]
+      events.decorationIds.set(
+        this.decorations.subarray(first, first + count),
+        decorations
+      )
+      decorations += count
+      events.decorationStarts[i + 1] = decorations
+    }
+    return events
+  }
+}
+
+/**
+ * Walks a tune's body and lays its notes out in time,
+ * keeping a time cursor per voice.
+ */
+class TimelineCompiler {
+  private durations: TuneDurations
+  private pitches: TunePitches
+  private base: number
+  private map: SourceMap | undefined
+  private events = new EventBuffer()
+  private voiceNames: Array<string> = []
+  private voice = 0
+  private cursors: Array<number> = []
+  // events left open by a tie, by pitch, for each voice
+  private ties: Array<Map<number, number>> = []
+  private velocity = DEFAULT_VELOCITY
+  private decorationNames: Array<string> = []
+  // decorations waiting for the next note
+  private decorations: Array<number> = []
+  private fields: Array<TimedField> = []
+
+  constructor(tune: Tune, base: number, map?: SourceMap) {
+    this.durations = resolveDurations(tune)
+    this.pitches = resolvePitches(tune)
+    this.base = base
+    this.map = map
+  }
+
+  compile(tune: Tune) {
+    const info_lines = tune.tune_header.info_lines
+    for (const line of info_lines) {
+      if (fieldName(line) === "V") this.voiceIndex(fieldValue(line))
+    }
+    if (this.voiceNames.length === 0) this.voiceIndex("")
+    if (tune.tune_body) {
+      for (const element of tune.tune_body.sequence) this.element(element)
+    }
+    return this.events.toEvents(
+      headerValue(info_lines, "X") || "",
+      this.voiceNames,
+      this.decorationNames,
+      this.fields
+    )
+  }
+
+  private element(element: Expr | Token) {
+    if (element instanceof Note) {
+      this.sound([element], element)
+    } else if (element instanceof Chord) {
+      const notes = element.contents.filter(
+        (content): content is Note => content instanceof Note
+      )
+      this.sound(notes, element)
+    } else if (element instanceof MultiMeasureRest) {
+      this.sound([], element)
+    } else if (element instanceof Grace_group) {
+      for (const note of element.notes) {
+        if (!(note.pitch instanceof Pitch)) continue
+        this.events.push(
+          this.cursors[this.voice],
+          0,
+          this.pitches.pitchOf(note),
+          this.velocity,
+          this.voice,
+          this.offsetOf(note.pitch)
+        )
+      }
+    } else if (element instanceof Slur_group) {
+      for (const content of element.contents) this.element(content)
+    } else if (element instanceof Symbol) {
+      this.decorate(element.symbol.lexeme)
+    } else if (element instanceof Decoration) {
+      // symbols redefined with `U:` stand for their decoration
+      this.decorate(element.symbol ?? element.decoration.lexeme)
+    } else if (
+      element instanceof Info_line ||
+      element instanceof Inline_field
+    ) {
+      const name = fieldName(element)
+      if (name === "V") {
+        this.voice = this.voiceIndex(fieldValue(element))
+      } else if (name === "M" || name === "L" || name === "Q") {
+        const onset = this.cursors[this.voice]
+        this.fields.push({ onset, name, value: fieldValue(element) })
+      }
+    }
+  }
+
+  /**
+   * Emits the notes at the voice's cursor, and moves the cursor.
+   * Notes that continue a tie extend the tied event instead.
+   */
+  private sound(notes: Array<Note>, element: Expr) {
+    const duration = toNumber(this.durations.durationOf(element)!)
+    const onset = this.cursors[this.voice]
+    const open = this.ties[this.voice]
+    const next = new Map<number, number>()
+    for (const note of notes) {
+      if (!(note.pitch instanceof Pitch)) continue
+      const pitch = this.pitches.pitchOf(note)
+      let event = open.get(pitch)
+      if (event !== undefined) {
+        this.events.durations[event] += duration
+      } else {
+        event = this.events.push(
+          onset,
+          duration,
+          pitch,
+          this.velocity,
+          this.voice,
+          this.offsetOf(note.pitch),
+          this.decorations
+        )
+      }
+      if (note.tie) next.set(pitch, event)
+    }
+    this.ties[this.voice] = next
+    this.cursors[this.voice] = onset + duration
+    if (this.decorations.length > 0) this.decorations = []
+  }
+
+  /**
+   * Keeps the decoration for the next note, and sets the dynamics.
+   */
+  private decorate(symbol: string) {
+    let id = this.decorationNames.indexOf(symbol)
+    if (id === -1) id = this.decorationNames.push(symbol) - 1
+    this.decorations.push(id)
+    const velocity = DYNAMICS[symbol.replace(/!/g, "")]
+    if (velocity !== undefined) this.velocity = velocity
+  }
+
+  private offsetOf(pitch: Pitch) {
+    const offset = (pitch.alteration || pitch.noteLetter).offset
+    return this.map ? this.map.originalOffset(offset) : this.base + offset
+  }
+
+  private voiceIndex(value: string) {
+    const name = value.split(/\s/)[0]
+    let index = this.voiceNames.indexOf(name)
+    if (index === -1) {
+      index = this.voiceNames.push(name) - 1
+      this.cursors.push(0)
+      this.ties.push(new Map())
+    }
+    return index
+  }
+}
+
+/**
+ * Lays the tune's notes out in time.
+ * `base` is added to the events' source offsets,
+ * for tunes parsed out of a larger archive,
+ * unless a map from a macro expansion gives the offsets.
+ */
+export const compileTune = (
+  tune: Tune,
+  base = 0,
+  map?: SourceMap
+): TuneEvents => new TimelineCompiler(tune, base, map).compile(tune)
+
+/**
+ * Compiles an archive one tune at a time, macros expanded.
+ * Each tune is parsed on its own,
+ * so memory use depends on the largest tune rather than the archive.
+ */
+export function* compileTunes(source: string): Generator<TuneEvents> {
+  for (const { tune, offset, map } of parseTunes(source, { macros: true })) {
+    yield compileTune(tune, offset, map)
+  }
+}
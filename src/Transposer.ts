@@ -0,0 +1,341 @@
+import {
+  Annotation,
+  BarLine,
+  Chord,
+  Expr,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  Note,
+  Pitch,
+  Slur_group,
+  Tune,
+} from "./Expr"
+import { fieldName } from "./fields"
+import { TextEdit } from "./Formatter"
+import { annotationChord } from "./Harmony"
+import {
+  ALTERATIONS,
+  LETTERS,
+  letterIndex,
+  mod,
+  parseKey,
+  pitchOctave,
+  SEMITONES,
+  SHARPS,
+  signature,
+} from "./Key"
+import { OCTAVES, resolvePitches, SLOTS, TunePitches } from "./PitchResolver"
+import Token from "./token"
+import { parseTunes } from "./tunes"
+
+const ACCIDENTALS = ["__", "_", "=", "^", "^^"]
+
+// difference between two pitch classes, from -6 to 5
+const interval = (from: number, to: number) => mod(to - from + 6, 12) - 6
+
+/**
+ * Signature of the key a tune in `fifths` moves to,
+ * from 5 flats to 6 sharps.
+ */
+const transposeFifths = (fifths: number, semitones: number) => {
+  const result = mod(fifths + 7 * semitones, 12)
+  return result > 6 ? result - 12 : result
+}
+
+// letter index of the major key with the given signature
+const majorTonic = (fifths: number) =>
+  LETTERS.indexOf(SHARPS.charAt(mod(fifths + 1, 7)))
+
+/**
+ * Number of letters the notes move by, e.g. 1 for C to D or C to Db,
+ * taken from the tonics of both keys and signed like `semitones`.
+ */
+const letterSteps = (from: number, to: number, semitones: number) => {
+  const octaves = Math.floor(semitones / 12)
+  const expected = Math.round(((semitones - 12 * octaves) * 7) / 12)
+  let steps = mod(majorTonic(to) - majorTonic(from), 7)
+  if (steps - expected > 3) steps -= 7
+  if (expected - steps > 3) steps += 7
+  return steps + 7 * octaves
+}
+
+/**
+ * Spells a pitch class with the letter `letter` moves to,
+ * or with sharps (flats in flat keys) when that letter would need
+ * more than `limit` accidentals.
+ */
+const spell = (
+  letter: number,
+  alteration: number,
+  semitones: number,
+  steps: number,
+  fifths: number,
+  limit: number
+) => {
+  const pitchClass = SEMITONES[letter] + alteration + semitones
+  const moved = mod(letter + steps, 7)
+  const needed = interval(SEMITONES[moved], pitchClass)
+  if (Math.abs(needed) <= limit) return { letter: moved, alteration: needed }
+  for (let i = 0; i < 7; i++) {
+    const difference = interval(SEMITONES[i], pitchClass)
+    if (difference === 0 || difference === (fifths < 0 ? -1 : 1)) {
+      return { letter: i, alteration: difference }
+    }
+  }
+  return { letter: moved, alteration: needed }
+}
+
+const accidentalValue = (accidental: string) =>
+  accidental === "#" ? 1 : accidental === "b" ? -1 : 0
+
+const accidentalText = (alteration: number) =>
+  alteration > 0 ? "#" : alteration < 0 ? "b" : ""
+
+/**
+ * Rewrites the pitches of a tune in place, without reprinting it.
+ *
+ * The tune is walked once, and every pitch is rewritten from its
+ * resolved MIDI number, moving its letter by as many steps
+ * as the tonic of the key moves.
+ * Accidentals are only written where the new key and the accidentals
+ * already written in the bar don't give the right pitch,
+ * or where the original had one.
+ * Edits only cover the characters that change.
+ */
+class Transposer {
+  private semitones: number
+  private base: number
+  private source: TunePitches
+  private edits: Array<TextEdit> = []
+  private fifths = 0
+  private steps = 0
+  private key: Int8Array = signature(0)
+  // accidentals written in the transposed bar, as in the pitch resolver
+  private alterations = new Int8Array(SLOTS)
+  private bars = new Uint32Array(SLOTS)
+  private bar = 1
+
+  constructor(tune: Tune, semitones: number, base: number) {
+    this.semitones = semitones
+    this.base = base
+    this.source = resolvePitches(tune)
+  }
+
+  transpose(tune: Tune) {
+    this.setKey(0)
+    for (const line of tune.tune_header.info_lines) {
+      if (fieldName(line) === "K") this.field(line)
+    }
+    if (tune.tune_body) {
+      for (const element of tune.tune_body.sequence) this.element(element)
+    }
+    return this.edits
+  }
+
+  private element(element: Expr | Token) {
+    if (element instanceof Note) {
+      this.note(element)
+    } else if (element instanceof Chord) {
+      for (const content of element.contents) {
+        if (content instanceof Note) this.note(content)
+        else if (content instanceof Annotation) this.annotation(content)
+      }
+    } else if (element instanceof Grace_group) {
+      for (const note of element.notes) this.note(note)
+    } else if (element instanceof Slur_group) {
+      for (const content of element.contents) this.element(content)
+    } else if (element instanceof Annotation) {
+      this.annotation(element)
+    } else if (element instanceof BarLine) {
+      this.bar++
+    } else if (
+      element instanceof Info_line ||
+      element instanceof Inline_field
+    ) {
+      const name = fieldName(element)
+      if (name === "K") {
+        this.field(element)
+        this.bar++
+      } else if (name === "V") {
+        this.bar++
+      }
+    }
+  }
+
+  private setKey(fifths: number) {
+    this.fifths = transposeFifths(fifths, this.semitones)
+    this.steps = letterSteps(fifths, this.fifths, this.semitones)
+  }
+
+  /**
+   * Moves the tonic and the explicit accidentals of a `K:` field,
+   * leaving its mode and clef as they are.
+   */
+  private field(field: Info_line | Inline_field) {
+    // the value of an info line is merged into its first token
+    const tokens =
+      field instanceof Info_line ? field.value.slice(0, 1) : field.text
+    if (tokens.length === 0) return
+    let text = ""
+    for (const token of tokens) text += token.lexeme
+    const key = parseKey(text)
+    // e.g. a clef change, which keeps the key
+    if (!key) return
+    this.setKey(key.fifths)
+    const transposed = text
+      .replace(/^(\s*)([A-G])([#b]?)/, (_, space, letter, accidental) => {
+        const tonic = spell(
+          LETTERS.indexOf(letter),
+          accidentalValue(accidental),
+          this.semitones,
+          this.steps,
+          this.fifths,
+          1
+        )
+        const name = LETTERS.charAt(tonic.letter)
+        return space + name + accidentalText(tonic.alteration)
+      })
+      .replace(
+        /(^|\s)(\^\^|\^|__|_|=)([a-gA-G])(?=\s|$)/g,
+        (_, space, accidental, letter) => {
+          const spelled = spell(
+            LETTERS.indexOf(letter.toUpperCase()),
+            ALTERATIONS[accidental],
+            this.semitones,
+            this.steps,
+            this.fifths,
+            2
+          )
+          const name = LETTERS.charAt(spelled.letter)
+          return (
+            space +
+            ACCIDENTALS[spelled.alteration + 2] +
+            (letter === letter.toUpperCase() ? name : name.toLowerCase())
+          )
+        }
+      )
+    this.key = parseKey(transposed)!.alterations
+    this.replace(tokens[0].offset, text, transposed)
+  }
+
+  private note(note: Note) {
+    const pitch = note.pitch
+    if (!(pitch instanceof Pitch)) return
+    const target = this.source.pitchOf(note) + this.semitones
+    const moved = letterIndex(pitch) + this.steps
+    let letter = mod(moved, 7)
+    let octave = pitchOctave(pitch) + Math.floor(moved / 7)
+    let alteration = target - (60 + 12 * octave + SEMITONES[letter])
+    if (Math.abs(alteration) > 2) {
+      // the moved letter is too far off, spell the pitch from scratch
+      const spelled = spell(0, target, 0, 0, this.fifths, 0)
+      letter = spelled.letter
+      alteration = spelled.alteration
+      octave = Math.floor((target - alteration - SEMITONES[letter] - 60) / 12)
+    }
+
+    const slot = Math.max(0, Math.min(OCTAVES - 1, octave + 5)) * 7 + letter
+    const current =
+      this.bars[slot] === this.bar ? this.alterations[slot] : this.key[letter]
+    let text = ""
+    if (pitch.alteration || alteration !== current) {
+      text = ACCIDENTALS[alteration + 2]
+      this.alterations[slot] = alteration
+      this.bars[slot] = this.bar
+    }
+    const name = LETTERS.charAt(letter)
+    text +=
+      octave > 0
+        ? name.toLowerCase() + "'".repeat(octave - 1)
+        : name + ",".repeat(-octave)
+
+    const written =
+      (pitch.alteration?.lexeme ?? "") +
+      pitch.noteLetter.lexeme +
+      (pitch.octave?.lexeme ?? "")
+    this.replace((pitch.alteration || pitch.noteLetter).offset, written, text)
+  }
+
+  /**
+   * Chord symbols are the annotations that decode as chords,
+   * with an optional bass note: `"Am7"`, `"F#m/C#"`.
+   * Other annotations, such as `"Fine"`, are left as they are.
+   */
+  private annotation(annotation: Annotation) {
+    const token = annotation.text
+    const symbol = token.lexeme.substring(1, token.lexeme.length - 1)
+    const chord = annotationChord(annotation)
+    if (!chord) return
+    const note = (letter: number, alteration: number) => {
+      const spelled = spell(
+        letter,
+        alteration,
+        this.semitones,
+        this.steps,
+        this.fifths,
+        1
+      )
+      return (
+        LETTERS.charAt(spelled.letter) + accidentalText(spelled.alteration)
+      )
+    }
+    const slash = chord.bass === -1 ? symbol.length : symbol.lastIndexOf("/")
+    let transposed =
+      note(chord.letter, chord.alteration) +
+      symbol.substring(chord.alteration === 0 ? 1 : 2, slash)
+    if (chord.bass !== -1) {
+      transposed += "/" + note(chord.bassLetter, chord.bassAlteration)
+    }
+    this.replace(token.offset + 1, symbol, transposed)
+  }
+
+  /**
+   * Records an edit for the part of `before` that differs from `after`,
+   * `before` being the source text at `offset`.
+   */
+  private replace(offset: number, before: string, after: string) {
+    if (before === after) return
+    let head = 0
+    while (head < before.length && before[head] === after[head]) head++
+    let tail = 0
+    while (
+      tail < before.length - head &&
+      tail < after.length - head &&
+      before[before.length - 1 - tail] === after[after.length - 1 - tail]
+    ) {
+      tail++
+    }
+    this.edits.push({
+      start: this.base + offset + head,
+      end: this.base + offset + before.length - tail,
+      text: after.substring(head, after.length - tail),
+    })
+  }
+}
+
+/**
+ * Lists the edits that transpose the tune by `semitones`.
+ * `base` is added to the edits' offsets,
+ * for tunes parsed out of a larger archive.
+ */
+export const transposeTune = (
+  tune: Tune,
+  semitones: number,
+  base = 0
+): Array<TextEdit> => new Transposer(tune, semitones, base).transpose(tune)
+
+/**
+ * Lists the edits that transpose every tune of the source by `semitones`,
+ * sorted by offset.
+ */
+export const transpose = (
+  source: string,
+  semitones: number
+): Array<TextEdit> => {
+  const edits: Array<TextEdit> = []
+  for (const { tune, offset } of parseTunes(source)) {
+    for (const edit of transposeTune(tune, semitones, offset)) edits.push(edit)
+  }
+  return edits
+}
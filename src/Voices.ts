@@ -0,0 +1,126 @@
+import { indexBars } from "./BarIndex"
+import { Expr, Info_line, Inline_field, Tune } from "./Expr"
+import { fieldName, fieldValue } from "./fields"
+import Token from "./token"
+
+/**
+ * The voices of a tune, separated out of its body.
+ *
+ * The body is cut into ranges of consecutive elements of the same voice:
+ * range `r` covers the elements from `starts[r]` to `ends[r]` (excluded)
+ * and belongs to voice `voices[r]`.
+ * Reading a voice's ranges in order gives that voice's music alone.
+ *
+ * Bars are aligned by number across voices:
+ * `sync[bar * names.length + voice]` is the body index
+ * where the voice's bar starts, or -1 if the voice is shorter.
+ */
+export class TuneVoices {
+  sequence: Array<Expr | Token>
+  names: Array<string>
+  length: number
+  starts: Int32Array
+  ends: Int32Array
+  voices: Uint16Array
+  bars: number
+  sync: Int32Array
+  constructor(
+    sequence: Array<Expr | Token>,
+    names: Array<string>,
+    starts: Array<number>,
+    ends: Array<number>,
+    voices: Array<number>,
+    bars: number,
+    sync: Int32Array
+  ) {
+    this.sequence = sequence
+    this.names = names
+    this.length = starts.length
+    this.starts = Int32Array.from(starts)
+    this.ends = Int32Array.from(ends)
+    this.voices = Uint16Array.from(voices)
+    this.bars = bars
+    this.sync = sync
+  }
+
+  /**
+   * Yields the ranges of the voice, in body order.
+   */
+  *ranges(voice: number): Generator<number> {
+    for (let r = 0; r < this.length; r++) {
+      if (this.voices[r] === voice) yield r
+    }
+  }
+
+  /**
+   * Yields the elements of the voice, straight from the tune's body.
+   */
+  *elements(voice: number): Generator<Expr | Token> {
+    for (const r of this.ranges(voice)) {
+      for (let i = this.starts[r]; i < this.ends[r]; i++) {
+        yield this.sequence[i]
+      }
+    }
+  }
+
+  barStart(bar: number, voice: number) {
+    if (bar < 0 || bar >= this.bars) return -1
+    return this.sync[bar * this.names.length + voice]
+  }
+}
+
+/**
+ * Cuts the body into voice ranges in a single pass.
+ * Voices are named and ordered as in the bar index,
+ * which provides the bars to align.
+ */
+const demultiplexTune = (tune: Tune): TuneVoices => {
+  const index = indexBars(tune)
+  const names = index.voices.map((voice) => voice.name)
+  const sequence = tune.tune_body ? tune.tune_body.sequence : []
+  const starts: Array<number> = []
+  const ends: Array<number> = []
+  const voices: Array<number> = []
+  let voice = 0
+  sequence.forEach((element, i) => {
+    if (
+      (element instanceof Info_line || element instanceof Inline_field) &&
+      fieldName(element) === "V"
+    ) {
+      voice = Math.max(0, names.indexOf(fieldValue(element).split(/\s/)[0]))
+    }
+    const last = voices.length - 1
+    if (last >= 0 && voices[last] === voice) {
+      ends[last] = i + 1
+    } else {
+      starts.push(i)
+      ends.push(i + 1)
+      voices.push(voice)
+    }
+  })
+
+  let bars = 0
+  for (const voice of index.voices) bars = Math.max(bars, voice.length)
+  const sync = new Int32Array(bars * names.length).fill(-1)
+  index.voices.forEach((voice, v) => {
+    for (let bar = 0; bar < voice.length; bar++) {
+      sync[bar * names.length + v] = voice.starts[bar]
+    }
+  })
+  return new TuneVoices(sequence, names, starts, ends, voices, bars, sync)
+}
+
+const cache = new WeakMap<Tune, TuneVoices>()
+
+/**
+ * Returns the tune's voices, separated.
+ * Results are cached per tune.
+ */
+export const demultiplex = (tune: Tune): TuneVoices => {
+  let voices = cache.get(tune)
+  if (!voices) {
+    voices = demultiplexTune(tune)
+    cache.set(tune, voices)
+  }
+  return voices
+}
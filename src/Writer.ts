@@ -0,0 +1,102 @@
+/**
+ * Sinks for the printers.
+ * Printers emit many small chunks,
+ * so the sinks collect them instead of concatenating strings.
+ */
+export interface Writer {
+  write(chunk: string): void
+}
+
+/**
+ * Collects chunks into an array
+ * and only joins them when the result is requested.
+ */
+export class StringBuilder implements Writer {
+  private chunks: Array<string> = []
+  write(chunk: string) {
+    this.chunks.push(chunk)
+  }
+  toString() {
+    const result = this.chunks.join("")
+    this.chunks = [result]
+    return result
+  }
+  clear() {
+    this.chunks = []
+  }
+}
+
+/**
+ * Buffers chunks and flushes them to a writable stream
+ * once the buffered length goes over `highWaterMark`.
+ */
+export class StreamWriter implements Writer {
+  private stream: NodeJS.WritableStream
+  private chunks: Array<string> = []
+  private length = 0
+  private highWaterMark: number
+  constructor(stream: NodeJS.WritableStream, highWaterMark = 1 << 16) {
+    this.stream = stream
+    this.highWaterMark = highWaterMark
+  }
+  write(chunk: string) {
+    this.chunks.push(chunk)
+    this.length += chunk.length
+    if (this.length >= this.highWaterMark) this.flush()
+  }
+  flush() {
+    if (this.length === 0) return
+    this.stream.write(this.chunks.join(""))
+    this.chunks = []
+    this.length = 0
+  }
+}
+
+/**
+ * thrown by the CheckWriter to interrupt the printer
+ * as soon as its output stops matching the expected text.
+ */
+export class Mismatch extends Error {
+  offset: number
+  constructor(offset: number) {
+    super(`output differs at offset ${offset}`)
+    this.offset = offset
+  }
+}
+
+/**
+ * Compares the chunks against an expected text as they get written,
+ * instead of building the whole output.
+ */
+export class CheckWriter implements Writer {
+  private expected: string
+  private position = 0
+  constructor(expected: string) {
+    this.expected = expected
+  }
+  write(chunk: string) {
+    if (this.expected.startsWith(chunk, this.position)) {
+      this.position += chunk.length
+      return
+    }
+    let offset = this.position
+    let i = 0
+    while (
+      i < chunk.length &&
+      this.expected.charCodeAt(offset) === chunk.charCodeAt(i)
+    ) {
+      offset++
+      i++
+    }
+    throw new Mismatch(offset)
+  }
+  /**
+   * throws if the expected text has remaining characters
+   * that the printer didn't produce.
+   */
+  end() {
+    if (this.position !== this.expected.length) {
+      throw new Mismatch(this.position)
+    }
+  }
+}
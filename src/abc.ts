@@ -1,17 +1,44 @@
-import { readFileSync } from "fs"
+import { closeSync, createReadStream, openSync, readFileSync } from "fs"
+import { join } from "path"
 import readline from "readline"
-// import { AstPrinter } from "./AstPrinter"
+import { findDuplicates } from "./Dedup"
 import { getError, setError } from "./error"
 import { Expr } from "./Expr"
+import { applyEdits, check, formatTo } from "./Formatter"
+import { writeJson } from "./JsonWriter"
+import { MidiWriter } from "./MidiWriter"
+import { exportNotesToFile } from "./NoteTable"
 import { Parser } from "./Parser"
 import Scanner from "./Scanner"
+import { collectStats, CorpusStats } from "./Stats"
 import Token from "./token"
+import { transpose } from "./Transposer"
+import { parseTunes } from "./tunes"
+import { StreamWriter } from "./Writer"
 
 export let hadError = false
 
 const main = (args: string[]) => {
-  if (args.length > 1) {
-    console.log("Usage: jlox [script]")
+  if (args[0] === "--check") {
+    runCheck(args.slice(1))
+  } else if (args[0] === "--format" && args.length === 2) {
+    runFormat(args[1])
+  } else if (args[0] === "--midi" && args.length === 3) {
+    runMidi(args[1], args[2])
+  } else if (args[0] === "--transpose" && args.length === 3) {
+    runTranspose(Number(args[1]), args[2])
+  } else if (args[0] === "--dedupe" && args.length === 2) {
+    runDedupe(args[1])
+  } else if (args[0] === "--notes" && args.length === 3) {
+    exportNotesToFile(readFileSync(args[1], { encoding: "utf8" }), args[2])
+  } else if (args[0] === "--json" && args.length === 2) {
+    runJson(args[1])
+  } else if (args[0] === "--stats" && args.length > 1) {
+    runStats(args.slice(1))
+  } else if (args.length > 1) {
+    console.log(
+      "Usage: jlox [script] | --format [script] | --check [scripts] | --midi [script] [directory] | --transpose [semitones] [script] | --dedupe [script] | --stats [scripts] | --notes [script] [output] | --json [script]"
+    )
     return
   } else if (args.length === 1) {
     runFile(args[0])
@@ -28,6 +55,138 @@ function runFile(path: string) {
   if (getError()) return
 }
 
+/**
+ * Reports the first file that isn't formatted, and stops there.
+ */
+function runCheck(paths: string[]) {
+  for (const path of paths) {
+    const result = check(readFileSync(path, { encoding: "utf8" }))
+    if (result.formatted) continue
+    if ("error" in result) {
+      console.error(`${path}: could not be parsed`)
+    } else {
+      console.error(`${path}:${result.line}:${result.column}: not formatted`)
+    }
+    process.exitCode = 1
+    return
+  }
+}
+
+function runFormat(path: string) {
+  const source = readFileSync(path, { encoding: "utf8" })
+  const writer = new StreamWriter(process.stdout)
+  if (!formatTo(source, writer)) {
+    process.exitCode = 1
+    return
+  }
+  writer.flush()
+}
+
+/**
+ * Writes one MIDI file per tune into the directory,
+ * named after the tunes' reference numbers.
+ */
+function runMidi(path: string, directory: string) {
+  const source = readFileSync(path, { encoding: "utf8" })
+  const writer = new MidiWriter()
+  const names = new Set<string>()
+  let index = 0
+  for (const { tune } of parseTunes(source)) {
+    index++
+    const reference = tune.tune_header.info_lines.find(
+      (line) => line.key.lexeme === "X:"
+    )
+    // keep the files within the directory, and apart from each other
+    let name = (reference?.value[0]?.lexeme.trim() || "").replace(
+      /[^\w-]/g,
+      "_"
+    )
+    if (!name) name = String(index)
+    while (names.has(name)) name = `${name}-${index}`
+    names.add(name)
+    const fd = openSync(join(directory, `${name}.mid`), "w")
+    try {
+      writer.writeSync(tune, fd)
+    } finally {
+      closeSync(fd)
+    }
+  }
+}
+
+/**
+ * Streams the archive in and its JSON out,
+ * reporting the tunes that couldn't be parsed.
+ */
+async function runJson(path: string) {
+  const input = createReadStream(path, { encoding: "utf8" })
+  let failed: Array<number>
+  try {
+    failed = await writeJson(input, process.stdout)
+  } catch (e) {
+    // e.g. the reading end of a pipe closed
+    console.error(`${path}: ${(e as Error).message}`)
+    process.exitCode = 1
+    return
+  }
+  for (const offset of failed) {
+    console.error(`${path}: tune at offset ${offset} could not be parsed`)
+  }
+  if (failed.length > 0) process.exitCode = 1
+}
+
+function runTranspose(semitones: number, path: string) {
+  if (!Number.isInteger(semitones)) {
+    console.error("semitones should be an integer")
+    process.exitCode = 1
+    return
+  }
+  const source = readFileSync(path, { encoding: "utf8" })
+  process.stdout.write(applyEdits(source, transpose(source, semitones)))
+}
+
+/**
+ * Lists the tunes that nearly duplicate an earlier one,
+ * by the line they start on.
+ */
+async function runDedupe(path: string) {
+  try {
+    const source = readFileSync(path, { encoding: "utf8" })
+    const lines: Array<number> = []
+    let line = 1
+    let counted = 0
+    for await (const { offset, duplicateOf } of findDuplicates(source)) {
+      for (; counted < offset; counted++) {
+        if (source.charCodeAt(counted) === 10) line++
+      }
+      lines.push(line)
+      if (duplicateOf !== -1) {
+        console.log(`${path}:${line}: duplicates line ${lines[duplicateOf]}`)
+      }
+    }
+  } catch (e) {
+    // e.g. the file can't be read, or a worker failed
+    console.error(`${path}: ${(e as Error).message}`)
+    process.exitCode = 1
+  }
+}
+
+/**
+ * Prints the statistics of the files as JSON,
+ * the files being parsed by a pool of workers.
+ */
+async function runStats(paths: string[]) {
+  let stats: CorpusStats
+  try {
+    stats = await collectStats(paths)
+  } catch (e) {
+    // a worker failed, reading or parsing a file
+    console.error(`${paths.join(", ")}: ${(e as Error).message}`)
+    process.exitCode = 1
+    return
+  }
+  console.log(JSON.stringify(stats.report(), null, 2))
+}
+
 function runPrompt() {
   let rl = readline.createInterface({
     input: process.stdin,
@@ -52,7 +211,6 @@ function run(source: string) {
     console.log("\nhad error")
     return
   }
-  //console.log(new AstPrinter().print(expression as Expr))
 }
 
 main(process.argv.slice(2))
@@ -0,0 +1,36 @@
+/**
+ * Builds a synthetic archive of tunes for the benchmarks,
+ * so that they don't depend on files outside of the repo.
+ */
+export const corpus = (tuneCount: number) => {
+  const tunes: Array<string> = []
+  const letters = "CDEFGABcdefgab"
+  for (let t = 0; t < tuneCount; t++) {
+    let body = ""
+    for (let line = 0; line < 8; line++) {
+      body += line % 4 === 0 ? "|:" : "|"
+      for (let bar = 0; bar < 4; bar++) {
+        for (let n = 0; n < 6; n++) {
+          const letter = letters[(t * 7 + line * 5 + bar * 3 + n) % 14]
+          body += n === 2 ? `${letter}>` : letter
+          if (n === 2) body += " "
+        }
+        body += bar === 3 && line % 4 === 3 ? ":|" : "|"
+      }
+      body += "\n"
+    }
+    tunes.push(`X:${t + 1}\nT:Tune ${t + 1}\nM:6/8\nL:1/8\nK:G\n${body}`)
+  }
+  return tunes.join("\n")
+}
+
+/**
+ * runs the function `iterations` times,
+ * and returns the mean duration in milliseconds.
+ */
+export const time = (fn: () => void, iterations = 5) => {
+  fn()
+  const start = process.hrtime.bigint()
+  for (let i = 0; i < iterations; i++) fn()
+  return Number(process.hrtime.bigint() - start) / 1e6 / iterations
+}
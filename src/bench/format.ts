@@ -0,0 +1,33 @@
+import { AstPrinter } from "../AstPrinter"
+import { File_structure } from "../Expr"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import { StringBuilder } from "../Writer"
+import { corpus, time } from "./corpus"
+
+/**
+ * Compares the formatter's throughput with the parser's.
+ * The printer is expected to be at least as fast as the parsing.
+ */
+const source = corpus(2000)
+const tokens = new Scanner(source).scanTokens()
+const ast = new Parser(tokens, source).parse() as File_structure
+
+const scan = time(() => new Scanner(source).scanTokens())
+const parse = time(() => new Parser(tokens, source).parse())
+const print = time(() => {
+  const builder = new StringBuilder()
+  new AstPrinter(builder).print(ast)
+  builder.toString()
+})
+
+const mb = source.length / (1 << 20)
+const report = (name: string, ms: number) =>
+  console.log(
+    `${name.padEnd(8)} ${ms.toFixed(1).padStart(8)} ms ${(mb / (ms / 1000))
+      .toFixed(1)
+      .padStart(8)} MB/s`
+  )
+report("scan", scan)
+report("parse", parse)
+report("print", print)
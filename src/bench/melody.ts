@@ -0,0 +1,16 @@
+import { indexMelodies } from "../MelodyIndex"
+import { corpus, time } from "./corpus"
+
+/**
+ * Times building the melody index over an archive,
+ * and looking a phrase up in it.
+ */
+const source = corpus(20000)
+
+const start = process.hrtime.bigint()
+const index = indexMelodies(source)
+const build = Number(process.hrtime.bigint() - start) / 1e6
+
+const query = time(() => index.query("GABc BA", "G"), 100)
+console.log(`index  ${build.toFixed(1).padStart(8)} ms ${index.length} tunes`)
+console.log(`query  ${query.toFixed(3).padStart(8)} ms`)
@@ -0,0 +1,36 @@
+import { mkdtempSync, rmSync, writeFileSync } from "fs"
+import { cpus, tmpdir } from "os"
+import { join } from "path"
+import { collectStats } from "../Stats"
+import { corpus } from "./corpus"
+
+/**
+ * Times the corpus statistics of a set of files
+ * with a growing number of workers, to check that they scale.
+ */
+const main = async () => {
+  const directory = mkdtempSync(join(tmpdir(), "abc-stats-"))
+  try {
+    const paths: Array<string> = []
+    for (let i = 0; i < 64; i++) {
+      const path = join(directory, `${i}.abc`)
+      writeFileSync(path, corpus(500))
+      paths.push(path)
+    }
+    for (let workers = 1; workers <= cpus().length; workers *= 2) {
+      const start = process.hrtime.bigint()
+      const stats = await collectStats(paths, { workers })
+      const duration = Number(process.hrtime.bigint() - start) / 1e6
+      const { tunes } = stats.report()
+      console.log(
+        `${String(workers).padStart(3)} workers ${duration
+          .toFixed(1)
+          .padStart(8)} ms ${tunes} tunes`
+      )
+    }
+  } finally {
+    rmSync(directory, { recursive: true })
+  }
+}
+
+main()
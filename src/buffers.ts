@@ -0,0 +1,21 @@
+export type TypedArray =
+  | Float64Array
+  | Float32Array
+  | Int32Array
+  | Uint32Array
+  | Int16Array
+  | Uint16Array
+  | Int8Array
+  | Uint8Array
+
+/**
+ * Returns a copy of the array with the new size,
+ * to grow the typed arrays that collect results.
+ */
+export const resize = <T extends TypedArray>(array: T, size: number): T => {
+  const copy = new (array.constructor as new (size: number) => T)(size)
+  copy.set(
+    (size < array.length ? array.subarray(0, size) : array) as ArrayLike<number>
+  )
+  return copy
+}
@@ -1,16 +1,30 @@
 import Token from "./token"
 import { TokenType } from "./types"
 
+export type ErrorListener = (line: number, message: string) => void
+
 let hadError = false
+// while set, receives the errors instead of the console
+let listener: ErrorListener | null = null
 
 export const getError = () => hadError
 export const setError = (setter: boolean) => (hadError = setter)
+/**
+ * Sets the listener and returns the previous one,
+ * for callers to put it back once they are done.
+ */
+export const setErrorListener = (callback: ErrorListener | null) => {
+  const previous = listener
+  listener = callback
+  return previous
+}
 export const error = (line: number, message: string) => {
   report(line, "", message)
 }
 export const report = (line: number, where: string, message: string) => {
   setError(true)
-  console.error(`[line ${line}] Error ${where}: ${message}`)
+  if (listener) listener(line, message)
+  else console.error(`[line ${line}] Error ${where}: ${message}`)
 }
 
 export const tokenError = (token: Token, message: string) => {
@@ -0,0 +1,31 @@
+import { Info_line, Inline_field } from "./Expr"
+
+/**
+ * Returns the field's letter, e.g. `K` for `K:G` or `[K:G]`.
+ */
+export const fieldName = (field: Info_line | Inline_field) =>
+  field instanceof Info_line
+    ? field.key.lexeme.charAt(0)
+    : field.field.lexeme.charAt(0)
+
+/**
+ * Returns the text of the field, without its key nor its comment.
+ */
+export const fieldValue = (field: Info_line | Inline_field) => {
+  if (field instanceof Info_line) {
+    return field.value[0] ? field.value[0].lexeme.trim() : ""
+  }
+  let text = ""
+  for (const token of field.text) text += token.lexeme
+  return text.trim()
+}
+
+/**
+ * Returns the value of the first header field with the given letter.
+ */
+export const headerValue = (info_lines: Array<Info_line>, name: string) => {
+  for (const line of info_lines) {
+    if (fieldName(line) === name) return fieldValue(line)
+  }
+  return undefined
+}
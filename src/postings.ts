@@ -0,0 +1,81 @@
+import { resize } from "./buffers"
+
+/**
+ * Numbers sorted in increasing order, stored as the variable-length
+ * encoded gaps between them: 7 bits per byte, the high bit set on all
+ * bytes of a gap but its last.
+ */
+export class PostingList {
+  bytes = new Uint8Array(4)
+  size = 0
+  count = 0
+  last = -1
+
+  /**
+   * Appends a number, ignoring it if it is already the last one.
+   */
+  add(id: number) {
+    if (id === this.last) return
+    let gap = id - this.last
+    this.last = id
+    this.count++
+    if (this.size + 5 > this.bytes.length) {
+      this.bytes = resize(this.bytes, this.bytes.length * 2)
+    }
+    while (gap >= 0x80) {
+      this.bytes[this.size++] = (gap & 0x7f) | 0x80
+      gap >>>= 7
+    }
+    this.bytes[this.size++] = gap
+  }
+
+  decode(): Uint32Array {
+    return decodePostings(this.bytes, 0, this.count)
+  }
+}
+
+/**
+ * Decodes `count` numbers from the gaps encoded at `start`.
+ */
+export const decodePostings = (
+  bytes: Uint8Array,
+  start: number,
+  count: number
+) => {
+  const ids = new Uint32Array(count)
+  let id = -1
+  let position = start
+  for (let i = 0; i < count; i++) {
+    let gap = 0
+    let shift = 0
+    let byte: number
+    do {
+      byte = bytes[position++]
+      gap |= (byte & 0x7f) << shift
+      shift += 7
+    } while (byte & 0x80)
+    id += gap
+    ids[i] = id
+  }
+  return ids
+}
+
+/**
+ * Ids present in both sorted arrays.
+ */
+export const intersect = (a: Uint32Array, b: Uint32Array) => {
+  const result = new Uint32Array(Math.min(a.length, b.length))
+  let length = 0
+  let i = 0
+  let j = 0
+  while (i < a.length && j < b.length) {
+    if (a[i] < b[j]) i++
+    else if (a[i] > b[j]) j++
+    else {
+      result[length++] = a[i]
+      i++
+      j++
+    }
+  }
+  return result.subarray(0, length)
+}
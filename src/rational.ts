@@ -0,0 +1,45 @@
+/**
+ * Exact fractions, used for note durations and onsets.
+ * Values are kept reduced, with a positive denominator.
+ */
+export type Rational = { num: number; den: number }
+
+export const gcd = (a: number, b: number): number => {
+  a = Math.abs(a)
+  b = Math.abs(b)
+  while (b) {
+    const t = b
+    b = a % b
+    a = t
+  }
+  return a
+}
+
+export const rational = (num: number, den = 1): Rational => {
+  if (den < 0) {
+    num = -num
+    den = -den
+  }
+  const divisor = gcd(num, den) || 1
+  return { num: num / divisor, den: den / divisor }
+}
+
+export const ZERO: Rational = { num: 0, den: 1 }
+export const ONE: Rational = { num: 1, den: 1 }
+
+export const multiply = (a: Rational, b: Rational) =>
+  rational(a.num * b.num, a.den * b.den)
+
+export const divide = (a: Rational, b: Rational) =>
+  rational(a.num * b.den, a.den * b.num)
+
+export const add = (a: Rational, b: Rational) =>
+  rational(a.num * b.den + b.num * a.den, a.den * b.den)
+
+export const subtract = (a: Rational, b: Rational) =>
+  rational(a.num * b.den - b.num * a.den, a.den * b.den)
+
+export const compare = (a: Rational, b: Rational) =>
+  a.num * b.den - b.num * a.den
+
+export const toNumber = (a: Rational) => a.num / a.den
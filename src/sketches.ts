@@ -0,0 +1,220 @@
+/**
+ * Mergeable summaries of large streams of values,
+ * for statistics accumulated on several threads then combined.
+ */
+
+// murmur3's finalizer, spreads the bits of a 32 bit value
+export const mix = (value: number) => {
+  let h = value
+  h ^= h >>> 16
+  h = Math.imul(h, 0x85ebca6b)
+  h ^= h >>> 13
+  h = Math.imul(h, 0xc2b2ae35)
+  h ^= h >>> 16
+  return h >>> 0
+}
+
+const hashString = (text: string) => {
+  let hash = 0x811c9dc5
+  for (let i = 0; i < text.length; i++) {
+    hash = Math.imul(hash ^ text.charCodeAt(i), 0x01000193)
+  }
+  return mix(hash)
+}
+
+/**
+ * Estimates the number of distinct strings added,
+ * within about 1.6% with the default 4096 registers.
+ *
+ * Each string's hash picks a register from its first `precision` bits,
+ * which keeps the longest run of leading zeros seen in the other bits.
+ * Merging two sketches keeps the largest value of each register.
+ */
+export class HyperLogLog {
+  precision: number
+  registers: Uint8Array
+
+  constructor(precision = 12, registers?: Uint8Array) {
+    this.precision = precision
+    this.registers = registers ?? new Uint8Array(1 << precision)
+  }
+
+  add(text: string) {
+    const hash = hashString(text)
+    const register = hash >>> (32 - this.precision)
+    const rest = (hash << this.precision) >>> 0
+    const rank = Math.min(Math.clz32(rest), 32 - this.precision) + 1
+    if (rank > this.registers[register]) this.registers[register] = rank
+  }
+
+  merge(other: HyperLogLog) {
+    for (let i = 0; i < this.registers.length; i++) {
+      if (other.registers[i] > this.registers[i]) {
+        this.registers[i] = other.registers[i]
+      }
+    }
+  }
+
+  estimate() {
+    const m = this.registers.length
+    let sum = 0
+    let zeros = 0
+    for (const rank of this.registers) {
+      sum += 2 ** -rank
+      if (rank === 0) zeros++
+    }
+    const estimate = ((0.7213 / (1 + 1.079 / m)) * m * m) / sum
+    // few values: count the empty registers instead
+    if (estimate <= 2.5 * m && zeros > 0) return m * Math.log(m / zeros)
+    // many values: correct for the collisions of 32 bit hashes
+    if (estimate > 2 ** 32 / 30) {
+      return -(2 ** 32) * Math.log(1 - estimate / 2 ** 32)
+    }
+    return estimate
+  }
+}
+
+/**
+ * Estimates the quantiles of the values added,
+ * more precisely towards the extremes.
+ *
+ * Values are clustered into centroids, a mean and a weight each,
+ * that may hold fewer values near the ends of the distribution.
+ * Values are buffered, then merged with the centroids in sorted order.
+ * Merging two digests adds the centroids of one to the other.
+ */
+export class TDigest {
+  compression: number
+  count = 0
+  min = Infinity
+  max = -Infinity
+  private means: Float64Array
+  private weights: Float64Array
+  private size = 0
+  private bufferMeans: Float64Array
+  private bufferWeights: Float64Array
+  private buffered = 0
+
+  constructor(compression = 100) {
+    this.compression = compression
+    this.means = new Float64Array(0)
+    this.weights = new Float64Array(0)
+    this.bufferMeans = new Float64Array(compression * 5)
+    this.bufferWeights = new Float64Array(compression * 5)
+  }
+
+  add(value: number, weight = 1) {
+    if (this.buffered === this.bufferMeans.length) this.compress()
+    this.bufferMeans[this.buffered] = value
+    this.bufferWeights[this.buffered++] = weight
+    this.count += weight
+    if (value < this.min) this.min = value
+    if (value > this.max) this.max = value
+  }
+
+  merge(other: TDigest) {
+    other.compress()
+    for (let i = 0; i < other.size; i++) {
+      this.add(other.means[i], other.weights[i])
+    }
+    this.min = Math.min(this.min, other.min)
+    this.max = Math.max(this.max, other.max)
+  }
+
+  /**
+   * Returns the estimated value below which the share `q` of values fall,
+   * or NaN if no value was added.
+   */
+  quantile(q: number) {
+    this.compress()
+    if (this.size === 0) return NaN
+    if (this.size === 1) return this.means[0]
+    const target = Math.max(0, Math.min(1, q)) * this.count
+    // interpolates between the centres of the centroids
+    let previousCentre = 0
+    let previousMean = this.min
+    let cumulative = 0
+    for (let i = 0; i < this.size; i++) {
+      const centre = cumulative + this.weights[i] / 2
+      if (target < centre) {
+        const t = (target - previousCentre) / (centre - previousCentre)
+        return previousMean + t * (this.means[i] - previousMean)
+      }
+      previousCentre = centre
+      previousMean = this.means[i]
+      cumulative += this.weights[i]
+    }
+    const t = (target - previousCentre) / (this.count - previousCentre || 1)
+    return previousMean + t * (this.max - previousMean)
+  }
+
+  /**
+   * Returns the digest as numbers, to send it to another thread:
+   * its compression, count, minimum and maximum,
+   * then the means and the weights of its centroids.
+   */
+  serialize(): Float64Array {
+    this.compress()
+    const array = new Float64Array(4 + this.size * 2)
+    array.set([this.compression, this.count, this.min, this.max])
+    array.set(this.means.subarray(0, this.size), 4)
+    array.set(this.weights.subarray(0, this.size), 4 + this.size)
+    return array
+  }
+
+  static deserialize(array: Float64Array) {
+    const digest = new TDigest(array[0])
+    const size = (array.length - 4) / 2
+    digest.count = array[1]
+    digest.min = array[2]
+    digest.max = array[3]
+    digest.means = array.slice(4, 4 + size)
+    digest.weights = array.slice(4 + size)
+    digest.size = size
+    return digest
+  }
+
+  private compress() {
+    if (this.buffered === 0) return
+    const total = this.size + this.buffered
+    const means = new Float64Array(total)
+    const weights = new Float64Array(total)
+    means.set(this.means.subarray(0, this.size))
+    means.set(this.bufferMeans.subarray(0, this.buffered), this.size)
+    weights.set(this.weights.subarray(0, this.size))
+    weights.set(this.bufferWeights.subarray(0, this.buffered), this.size)
+    const order = new Uint32Array(total)
+    for (let i = 0; i < total; i++) order[i] = i
+    order.sort((a, b) => means[a] - means[b])
+
+    this.means = new Float64Array(total)
+    this.weights = new Float64Array(total)
+    this.size = 0
+    let mean = means[order[0]]
+    let weight = weights[order[0]]
+    let cumulative = 0
+    for (let i = 1; i < total; i++) {
+      const nextMean = means[order[i]]
+      const nextWeight = weights[order[i]]
+      // centroids may hold more values in the middle of the distribution
+      const q0 = cumulative / this.count
+      const q2 = (cumulative + weight + nextWeight) / this.count
+      const limit =
+        (4 * this.count * Math.min(q0 * (1 - q0), q2 * (1 - q2))) /
+        this.compression
+      if (weight + nextWeight <= limit) {
+        mean += ((nextMean - mean) * nextWeight) / (weight + nextWeight)
+        weight += nextWeight
+      } else {
+        this.means[this.size] = mean
+        this.weights[this.size++] = weight
+        cumulative += weight
+        mean = nextMean
+        weight = nextWeight
+      }
+    }
+    this.means[this.size] = mean
+    this.weights[this.size++] = weight
+    this.buffered = 0
+  }
+}
@@ -0,0 +1,62 @@
+import chai from "chai"
+import { indexBars } from "../BarIndex"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const index = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return indexBars(ast!.tune[0])
+}
+
+describe("Bar index", () => {
+  const source = "X:1\nL:1/4\nK:C\nC D | E F G | [CE]2 |]\n"
+  it("should list the bars with their onsets", () => {
+    const bars = index(source)
+    expect(bars.voices[0].length).to.equal(3)
+    expect(bars.barAt(1)).to.deep.equal({
+      start: 5,
+      offset: source.indexOf("E F"),
+      time: 0.5,
+      duration: 0.75,
+    })
+    expect(bars.barAt(2)!.offset).to.equal(source.indexOf("[CE]"))
+    expect(bars.barAt(3)).to.equal(undefined)
+  })
+  it("should find bars by source offset", () => {
+    const bars = index(source)
+    expect(bars.barAtOffset(source.indexOf("D"))).to.equal(0)
+    expect(bars.barAtOffset(source.indexOf("G"))).to.equal(1)
+    expect(bars.barAtOffset(source.length)).to.equal(2)
+    expect(bars.barAtOffset(0)).to.equal(-1)
+  })
+  it("should close the bars at bar lines within slurs", () => {
+    const slurred = "X:1\nL:1/4\nK:C\nC (D | E) F | G2 |]\n"
+    const bars = index(slurred)
+    expect(bars.voices[0].length).to.equal(3)
+    expect(bars.barAt(1)).to.deep.equal({
+      start: 2,
+      offset: slurred.indexOf("E)"),
+      time: 0.5,
+      duration: 0.5,
+    })
+    expect(bars.barAtOffset(slurred.indexOf("G2"))).to.equal(2)
+    expect(bars.barAtTime(1)).to.equal(2)
+  })
+  it("should find bars by time", () => {
+    const bars = index(source)
+    expect(bars.barAtTime(0)).to.equal(0)
+    expect(bars.barAtTime(0.5)).to.equal(1)
+    expect(bars.barAtTime(1.24)).to.equal(1)
+    expect(bars.barAtTime(1.25)).to.equal(2)
+    expect(bars.barAtTime(1.75)).to.equal(-1)
+  })
+  it("should index each voice on its own", () => {
+    const bars = index(
+      "X:1\nL:1/4\nV:1\nV:2\nK:C\nV:1\nC D | E F |\nV:2\nC2 | E2 | G2 |\n"
+    )
+    expect(bars.voices.map((voice) => voice.length)).to.deep.equal([2, 3])
+    expect(bars.voice("2")!.barAt(2)!.time).to.equal(1)
+    expect(bars.barAtTime(0.75, 1)).to.equal(1)
+  })
+})
@@ -0,0 +1,76 @@
+import chai from "chai"
+import { Deduplicator, findDuplicates, sketchSource } from "../Dedup"
+const expect = chai.expect
+
+const reel =
+  "X:1\nT:Reel\nL:1/8\nK:G\nGABc dBGB|cBAG FDEF|GABc dBGB|AGFG A4|\n"
+// the same tune in D, with a different unit note length
+const reelInD =
+  "X:2\nT:Reel\nL:1/16\nK:D\nD2E2F2G2 A2F2D2F2|G2F2E2D2 C2A,2B,2C2|" +
+  "D2E2F2G2 A2F2D2F2|E2D2C2D2 E8|\n"
+// one bar changed
+const variant =
+  "X:3\nT:Reel\nL:1/8\nK:G\nGABc dBGB|cBAG FDEF|GABc dBGB|AGFG A2B2|\n"
+const jig = "X:4\nT:Jig\nL:1/8\nK:D\nA|dfe dcB|AFD DFA|Bcd efg|fdB A2|\n"
+
+const similarity = (a: Uint32Array, b: Uint32Array) =>
+  a.filter((value, i) => value === b[i]).length / a.length
+
+describe("Dedup", () => {
+  it("should sketch transposed tunes alike", () => {
+    expect(Array.from(sketchSource(reelInD))).to.deep.equal(
+      Array.from(sketchSource(reel))
+    )
+  })
+  it("should estimate the similarity of variants", () => {
+    const reelSketch = sketchSource(reel)
+    expect(similarity(reelSketch, sketchSource(variant)) > 0.5).to.equal(true)
+    expect(similarity(reelSketch, sketchSource(jig)) < 0.5).to.equal(true)
+  })
+  it("should bucket duplicates with the first tune", () => {
+    const deduplicator = new Deduplicator({ threshold: 0.5 })
+    expect(deduplicator.add(sketchSource(reel))).to.equal(-1)
+    expect(deduplicator.add(sketchSource(jig))).to.equal(-1)
+    expect(deduplicator.add(sketchSource(variant))).to.equal(0)
+    expect(deduplicator.add(sketchSource(reelInD))).to.equal(0)
+    expect(deduplicator.count).to.equal(4)
+  })
+  it("should not match tunes without notes", () => {
+    const deduplicator = new Deduplicator()
+    const empty = sketchSource("X:1\nK:C\n")
+    expect(deduplicator.add(empty)).to.equal(-1)
+    expect(deduplicator.add(empty)).to.equal(-1)
+  })
+  it("should stream the duplicates of an archive", async () => {
+    const archive = ["%header\n", reel, jig, reelInD].join("\n")
+    const results = []
+    for await (const result of findDuplicates(archive, {
+      workers: 0,
+      batch: 2,
+    })) {
+      results.push(result)
+    }
+    expect(results.map((result) => result.duplicateOf)).to.deep.equal([
+      -1, -1, 0,
+    ])
+    expect(archive.startsWith("X:2", results[2].offset)).to.equal(true)
+  })
+  it("should sketch the batches on worker threads", async function () {
+    // leaves time for the workers to load
+    this.timeout(20000)
+    const archive = [reel, jig, reelInD, variant, jig].join("\n")
+    const duplicates = async (workers: number) => {
+      const results = []
+      for await (const result of findDuplicates(archive, {
+        workers,
+        batch: 1,
+      })) {
+        results.push(result.duplicateOf)
+      }
+      return results
+    }
+    const threaded = await duplicates(2)
+    expect(threaded).to.deep.equal(await duplicates(0))
+    expect(threaded).to.deep.equal([-1, -1, 0, 0, 1])
+  })
+})
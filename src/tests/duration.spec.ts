@@ -0,0 +1,88 @@
+import chai from "chai"
+import { parseMeter, resolveDurations } from "../Duration"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const durations = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens()).parse()
+  const result = resolveDurations(ast!.tune[0])
+  return Array.from(result.numerators).map(
+    (num, i) => `${num}/${result.denominators[i]}`
+  )
+}
+
+describe("Durations", () => {
+  it("should parse meters", () => {
+    expect(parseMeter("6/8")).to.deep.equal({ numerator: 6, denominator: 8 })
+    expect(parseMeter("C|")).to.deep.equal({ numerator: 2, denominator: 2 })
+    expect(parseMeter("2+3/8")).to.deep.equal({ numerator: 5, denominator: 8 })
+    expect(parseMeter("none")).to.equal(null)
+  })
+  it("should use the unit note length", () => {
+    expect(durations("X:1\nL:1/4\nK:C\na a2 a/ a3/2\n")).to.deep.equal([
+      "1/4",
+      "1/2",
+      "1/8",
+      "3/8",
+    ])
+  })
+  it("should handle slash shorthands", () => {
+    expect(durations("X:1\nL:1/8\nK:C\na// a/ a/4\n")).to.deep.equal([
+      "1/32",
+      "1/16",
+      "1/32",
+    ])
+  })
+  it("should derive the unit length from the meter", () => {
+    expect(durations("X:1\nM:2/4\nK:C\na\n")).to.deep.equal(["1/16"])
+    expect(durations("X:1\nM:6/8\nK:C\na\n")).to.deep.equal(["1/8"])
+  })
+  it("should resolve broken rhythms pairwise", () => {
+    expect(durations("X:1\nL:1/8\nK:C\na>b c<d e>>f\n")).to.deep.equal([
+      "3/16",
+      "1/16",
+      "1/16",
+      "3/16",
+      "7/32",
+      "1/32",
+    ])
+  })
+  it("should follow inline and body length fields", () => {
+    const source = "X:1\nL:1/8\nK:C\na [L:1/4] a\nL:1/2\na\n"
+    expect(durations(source)).to.deep.equal(["1/8", "1/4", "1/2"])
+  })
+  it("should time chords, rests and grace notes", () => {
+    expect(durations("X:1\nL:1/8\nK:C\n[CE]2 z {g}a [C2E]/\n")).to.deep.equal([
+      "1/4",
+      "1/8",
+      "0/1",
+      "1/8",
+      "1/8",
+    ])
+  })
+  it("should scale the notes of tuplets", () => {
+    expect(durations("X:1\nL:1/8\nK:C\n(3abc d\n")).to.deep.equal([
+      "1/12",
+      "1/12",
+      "1/12",
+      "1/8",
+    ])
+    expect(durations("X:1\nL:1/8\nK:C\n(3:4:2a2b c\n")).to.deep.equal([
+      "1/3",
+      "1/6",
+      "1/8",
+    ])
+  })
+  it("should take the time of odd tuplets from the meter", () => {
+    expect(durations("X:1\nM:6/8\nL:1/8\nK:C\n(5abcde\n")[0]).to.equal(
+      "3/40"
+    )
+    expect(durations("X:1\nM:4/4\nL:1/8\nK:C\n(5abcde\n")[0]).to.equal(
+      "1/20"
+    )
+  })
+  it("should time multi-measure rests from the meter", () => {
+    expect(durations("X:1\nM:3/4\nK:C\nZ2\n")).to.deep.equal(["3/2"])
+  })
+})
@@ -0,0 +1,310 @@
+import chai from "chai"
+import { rhythmValue } from "../Duration"
+import { EventParser, NoteEvent, ParserHandler } from "../EventParser"
+import {
+  Annotation,
+  BarLine,
+  Chord,
+  Comment,
+  Decoration,
+  Expr,
+  Grace_group,
+  Info_line,
+  Inline_field,
+  MultiMeasureRest,
+  Music_code,
+  Note,
+  Nth_repeat,
+  Pitch,
+  Rhythm,
+  Slur_group,
+  Symbol,
+  Tuplet,
+} from "../Expr"
+import { fieldName, fieldValue } from "../fields"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import Token from "../token"
+import { TokenType } from "../types"
+const expect = chai.expect
+
+const events = (source: string, lines = false) => {
+  const log: Array<string> = []
+  const handler: ParserHandler = {
+    onTuneStart: (e) => log.push(`tune ${e.reference}`),
+    onTuneEnd: () => log.push("end"),
+    onInfoLine: (e) => log.push(`${e.inline ? "[" : ""}${e.name}:${e.value}`),
+    onNote: (e) =>
+      log.push(
+        `${e.grace ? "grace " : ""}${e.alteration}${e.letter}${e.octave}` +
+          ` ${e.numerator}/${e.denominator}${e.broken}${e.tie ? "-" : ""}`
+      ),
+    onChordStart: () => log.push("["),
+    onChord: (e) => log.push(`] ${e.notes} ${e.numerator}/${e.denominator}`),
+    onBarLine: (e) => log.push(e.text),
+    onNthRepeat: (e) => log.push(`ending ${e.text}`),
+    onAnnotation: (e) => log.push(e.text),
+    onDecoration: (e) => log.push(`${e.text} ${e.symbol}`),
+    onGraceStart: (e) => log.push(e.text),
+    onGraceEnd: (e) => log.push(e.text),
+    onSlurStart: () => log.push("("),
+    onSlurEnd: () => log.push(")"),
+    onTuplet: (e) => log.push(`tuplet ${e.p}:${e.q}:${e.r}`),
+    onMultiMeasureRest: (e) => log.push(`${e.text}${e.bars}`),
+    onError: (e) => log.push(`error ${e.message}`),
+  }
+  if (lines) {
+    handler.onComment = (e) => log.push(e.text)
+    handler.onLineBreak = () => log.push("eol")
+  }
+  new EventParser(new Scanner(source).scanTokens(), handler).parse()
+  return log
+}
+
+/**
+ * Lists the events of the parser's tree, in the format of `events`,
+ * to check that both parsers read the sources the same way.
+ */
+const treeEvents = (source: string) => {
+  const log: Array<string> = []
+  // as written, where `rhythmValue` reduces the fraction
+  const rhythm = (rhythm?: Rhythm) => {
+    if (!rhythm) return "1/1"
+    const { numerator, separator, denominator, broken } = rhythm
+    let den = 1
+    if (separator) {
+      const slashes = separator.lexeme.length
+      den = denominator
+        ? Number(denominator.lexeme) * 2 ** (slashes - 1)
+        : 2 ** slashes
+    }
+    return (
+      `${numerator ? numerator.lexeme : 1}/${den}` +
+      (broken ? broken.lexeme : "")
+    )
+  }
+  const note = (note: Note, grace: boolean) => {
+    const pitch = note.pitch
+    const name =
+      pitch instanceof Pitch
+        ? (pitch.alteration?.lexeme || "") +
+          pitch.noteLetter.lexeme +
+          (pitch.octave?.lexeme || "")
+        : pitch.rest.lexeme
+    log.push(
+      `${grace ? "grace " : ""}${name} ${rhythm(note.rhythm)}` +
+        (note.tie ? "-" : "")
+    )
+  }
+  const visit = (element: Expr | Token) => {
+    if (element instanceof Token) {
+      if (element.type === TokenType.EOL) log.push("eol")
+    } else if (element instanceof Music_code) {
+      element.contents.forEach(visit)
+    } else if (element instanceof Comment) {
+      log.push(element.text)
+    } else if (element instanceof Info_line) {
+      log.push(`${fieldName(element)}:${fieldValue(element)}`)
+    } else if (element instanceof Inline_field) {
+      log.push(`[${fieldName(element)}:${fieldValue(element)}`)
+    } else if (element instanceof Note) {
+      note(element, false)
+    } else if (element instanceof Chord) {
+      log.push("[")
+      let notes = 0
+      for (const content of element.contents) {
+        if (content instanceof Note) notes++
+        visit(content)
+      }
+      log.push(`] ${notes} ${rhythm(element.rhythm)}`)
+    } else if (element instanceof BarLine) {
+      log.push(element.barline.lexeme)
+    } else if (element instanceof Nth_repeat) {
+      log.push(`ending ${element.repeat.lexeme.replace("[", "")}`)
+    } else if (element instanceof Annotation) {
+      log.push(element.text.lexeme)
+    } else if (element instanceof Decoration) {
+      log.push(`${element.decoration.lexeme} ${element.symbol || ""}`)
+    } else if (element instanceof Symbol) {
+      log.push(`${element.symbol.lexeme} `)
+    } else if (element instanceof Grace_group) {
+      log.push(element.isAccacciatura ? "{/" : "{")
+      element.notes.forEach((grace) => note(grace, true))
+      log.push("}")
+    } else if (element instanceof Slur_group) {
+      log.push("(")
+      element.contents.forEach(visit)
+      log.push(")")
+    } else if (element instanceof Tuplet) {
+      const { p, q, r } = element
+      log.push(
+        `tuplet ${p.lexeme.substring(1)}:${q ? q.lexeme : 0}:${
+          r ? r.lexeme : 0
+        }`
+      )
+    } else if (element instanceof MultiMeasureRest) {
+      log.push(`${element.rest.lexeme}${element.length?.lexeme || 1}`)
+    }
+  }
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  for (const tune of ast ? ast.tune : []) {
+    const reference = tune.tune_header.info_lines.find(
+      (line) => fieldName(line) === "X"
+    )
+    log.push(`tune ${reference ? fieldValue(reference) : ""}`)
+    tune.tune_header.info_lines.forEach(visit)
+    if (tune.tune_body) tune.tune_body.sequence.forEach(visit)
+    log.push("end")
+  }
+  return log
+}
+
+describe("EventParser", () => {
+  it("should call the handler for each element", () => {
+    const source =
+      "X:1\nT:Reel % title\nK:D\n" +
+      '"D" ~A2 F>A [dF]/2 (3B,c\'d |1 {/g}A4- A z Z2 :|\n'
+    expect(events(source)).to.deep.equal([
+      "tune 1",
+      "X:1",
+      "T:Reel",
+      "K:D",
+      '"D"',
+      "~ !roll!",
+      "A 2/1",
+      "F 1/1>",
+      "A 1/1",
+      "[",
+      "d 1/1",
+      "F 1/1",
+      "] 2 1/2",
+      "tuplet 3:0:0",
+      "B, 1/1",
+      "c' 1/1",
+      "d 1/1",
+      "|",
+      "ending 1",
+      "{/",
+      "grace g 1/1",
+      "}",
+      "A 4/1-",
+      "A 1/1",
+      "z 1/1",
+      "Z2",
+      ":|",
+      "end",
+    ])
+  })
+  it("should read inline fields, slurs and redefined symbols", () => {
+    const source = "X:1\nU:T = !fermata!\nK:G\n[M:3/4] (!p! TG .A) |\n"
+    expect(events(source)).to.deep.equal([
+      "tune 1",
+      "X:1",
+      "U:T = !fermata!",
+      "K:G",
+      "[M:3/4",
+      "(",
+      "!p! ",
+      "T !fermata!",
+      "G 1/1",
+      ". ",
+      "A 1/1",
+      ")",
+      "|",
+      "end",
+    ])
+  })
+  it("should report errors and recover at the next bar line", () => {
+    const log = events("X:1\nK:C\nA B | ^ | c\n")
+    expect(log).to.include("error Expected a note letter")
+    expect(log.slice(-2)).to.deep.equal(["c 1/1", "end"])
+  })
+  it("should reuse its event objects", () => {
+    const notes = new Set<NoteEvent>()
+    const parser = new EventParser(
+      new Scanner("X:1\nK:C\nABc d2e|\n").scanTokens(),
+      { onNote: (note) => notes.add(note) }
+    )
+    expect(parser.parse()).to.equal(true)
+    expect(notes.size).to.equal(1)
+  })
+  it("should find the notes of the parser's tree", () => {
+    const source =
+      "X:1\nT:Jig\nM:6/8\nK:Ador\n" +
+      "|:A>BA [ce]2e|(ag/f/) e2d|{c}B3 (3BcB|1 A3 A2z :|2 A3- A2||\n"
+    const expected: Array<string> = []
+    const visit = (element: unknown) => {
+      if (element instanceof Chord) element.contents.forEach(visit)
+      if (element instanceof Slur_group) element.contents.forEach(visit)
+      if (element instanceof Note) {
+        const { num, den } = rhythmValue(element.rhythm)
+        const pitch = element.pitch
+        const letter =
+          pitch instanceof Pitch ? pitch.noteLetter.lexeme : pitch.rest.lexeme
+        expected.push(`${letter} ${num / den}`)
+      }
+    }
+    const tokens = new Scanner(source).scanTokens()
+    const tune = new Parser(tokens, source).parse()!.tune[0]
+    tune.tune_body!.sequence.forEach(visit)
+    const values: Array<string> = []
+    const fields: Array<string> = []
+    new EventParser(tokens, {
+      onNote: (note) =>
+        values.push(`${note.letter} ${note.numerator / note.denominator}`),
+      onInfoLine: (field) => fields.push(field.value),
+    }).parse()
+    // grace notes are apart from the sequence in the tree
+    expect(values.filter((_, i) => i !== 11)).to.deep.equal(expected)
+    expect(fields).to.deep.equal(tune.tune_header.info_lines.map(fieldValue))
+  })
+  it("should read the parser's test sources as the parser does", () => {
+    const sources = [
+      "%abc-2.2\nX:1\n",
+      "X:1\n",
+      "X:1\nT:Test Song\n",
+      "X:1\nI:Some info here\n+:More info",
+      "X:1\nK:C\nabc\nT:Title",
+      "X:1\n%comment",
+      "X:1\n!fff!",
+      "X:1\n(3:2:2abc",
+      "X:1\n(3::4 (ab)[ce]d",
+      "X:1\n(abc)",
+      "X:1\n.a2",
+      "X:1\n:|1",
+      "X:1\nC",
+      "X:1\nC'",
+      "X:1\nC-C",
+      "X:1\nC/",
+      "X:1\nC/2",
+      "X:1\nC2/2",
+      "X:1\nC2>",
+      "X:1\nC>>",
+      "X:1\nHa2",
+      "X:1\nZ4Z",
+      "X:1\n[1",
+      "X:1\n[M:3/4]",
+      "X:1\n^C",
+      "X:1\ny2",
+      "X:1\nz4",
+      "X:1\n{/ac}",
+      "X:1\n{g}",
+      "X:1\n|",
+      "X:1\n|2",
+      "X:1\n|\\\n\n",
+      "X:1\n~23 a bc\na,,",
+      'X:1\n"string"',
+      'X:1\n["suprise"C]4',
+      "X:1\nK:C\nA B | ^ | c\n",
+      "X:1\nT:Reel % title\nK:D\n" +
+        '"D" ~A2 F>A [dF]/2 (3B,c\'d |1 {/g}A4- A z Z2 :|\n',
+      "X:1\nU:T = !fermata!\nK:G\n[M:3/4] (!p! TG .A) |\n",
+      "%abc\n\nX:1\nK:G\nGA|\n% a comment\nBc||\n\nX:2\nK:D\n[2 d4|]\n",
+      "U: W = !pp! % soft\n\nX:1\nK:C\nWC|\n\nX:2\nU: W = !f!\nK:C\nWC|\n",
+    ]
+    for (const source of sources) {
+      const log = events(source, true).filter((e) => !e.startsWith("error"))
+      expect(log, JSON.stringify(source)).to.deep.equal(treeEvents(source))
+    }
+  })
+})
@@ -0,0 +1,48 @@
+import chai from "chai"
+import { format } from "../Formatter"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const fingerprints = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return ast!.tune.map((tune) => tune.fingerprint)
+}
+const fingerprint = (source: string) => fingerprints(source)[0]
+
+describe("Fingerprint", () => {
+  const tune = "X:1\nT:Some Tune\nK:G\nGABc dBGB|\n\"Am\" cBAG FDEF|\n"
+  it("should give each tune a 64 bit hash", () => {
+    expect(/^[0-9a-f]{16}$/.test(fingerprint(tune))).to.equal(true)
+  })
+  it("should ignore layout, comments and the reference number", () => {
+    const reformatted =
+      "X:12\n% from another archive\nT:Some   Tune\nK:G   % key\n" +
+      "GABc  dBGB| % first bar\n  \"Am\"  cBAG FDEF|\n"
+    expect(fingerprint(reformatted)).to.equal(fingerprint(tune))
+  })
+  it("should keep the hash of formatted tunes", () => {
+    const source =
+      "X:1\nM:6/8\nT:Some Tune\nL:1/8\nK:G\nGAB|:cdB  |1 G3:|2 \"Am\"  A3 |]\n"
+    const formatted = format(source)
+    expect(formatted).not.to.equal(null)
+    expect(formatted).not.to.equal(source)
+    expect(fingerprint(formatted!)).to.equal(fingerprint(source))
+  })
+  it("should change with the music", () => {
+    expect(fingerprint(tune.replace("FDEF", "FDED"))).not.to.equal(
+      fingerprint(tune)
+    )
+    expect(fingerprint(tune.replace("c dB", "cdB"))).not.to.equal(
+      fingerprint(tune)
+    )
+    expect(fingerprint(tune.replace("Some Tune", "SomeTune"))).not.to.equal(
+      fingerprint(tune)
+    )
+  })
+  it("should hash each tune of a file on its own", () => {
+    const [first, second] = fingerprints(`${tune}\n${tune.replace("1", "2")}`)
+    expect(first).to.equal(second)
+    expect(first).to.equal(fingerprint(tune))
+  })
+})
@@ -0,0 +1,149 @@
+import chai from "chai"
+import {
+  applyEdits,
+  check,
+  format,
+  formatRange,
+  textEdits,
+} from "../Formatter"
+const expect = chai.expect
+
+describe("Formatter", () => {
+  describe("format", () => {
+    it("should order the header fields", () => {
+      const result = format("X:1\nK:C\nM:3/4\nT:Title\nabc\n")
+      expect(result).to.equal("X:1\nT:Title\nM:3/4\nK:C\nabc\n")
+    })
+    it("should trim info line values", () => {
+      const result = format("X:1\nT:  Title  \nK:C\nabc\n")
+      expect(result).to.equal("X:1\nT:Title\nK:C\nabc\n")
+    })
+    it("should collapse whitespace in music lines", () => {
+      const result = format("X:1\nK:C\n  ab   cd  \n")
+      expect(result).to.equal("X:1\nK:C\nab cd\n")
+    })
+    it("should surround bar lines with single spaces", () => {
+      const result = format("X:1\nK:C\n|:ab|cd   :|\n")
+      expect(result).to.equal("X:1\nK:C\n|: ab | cd :|\n")
+    })
+    it("should keep repeat numbers next to their bar line", () => {
+      const result = format("X:1\nK:C\nab|1 cd :|2 ef|]\n")
+      expect(result).to.equal("X:1\nK:C\nab |1 cd :|2 ef |]\n")
+    })
+    it("should print notes, chords and groups verbatim", () => {
+      const source =
+        'X:1\nK:C\n^C,2>_d/ [CEG]2 "Am"{/g}a (abc) [K:D] z4 Z2 !fff!c-c\n'
+      expect(format(source)).to.equal(source)
+    })
+    it("should print tuplet markers as written", () => {
+      const source = "X:1\nK:C\n(3:abc (3::abc (3:2:abc (3::2ab (3:2:2abc\n"
+      expect(format(source)).to.equal(source)
+    })
+    it("should separate tunes with a single empty line", () => {
+      const result = format("X:1\nK:C\nabc\n\n\n\nX:2\nK:D\ndef")
+      expect(result).to.equal("X:1\nK:C\nabc\n\nX:2\nK:D\ndef\n")
+    })
+    it("should write LF line breaks for CRLF sources", () => {
+      const result = format(
+        "%abc\r\n\r\nX:1\r\nK:C % key\r\n% note\r\nab|cd\r\n"
+      )
+      expect(result).to.equal("%abc\n\nX:1\nK:C % key\n% note\nab | cd\n")
+    })
+    it("should not space line continuations", () => {
+      const result = format("X:1\nK:C\nab | \\\ncd|\n")
+      expect(result).to.equal("X:1\nK:C\nab |\\\ncd |\n")
+    })
+    it("should be idempotent", () => {
+      const once = format("%abc\n\nX:1\nK:C\nM:6/8\n |:a>b c  |d2 e:| %end\n")
+      expect(once).to.exist
+      expect(format(once as string)).to.equal(once)
+    })
+    it("should return null when the source has errors", () => {
+      expect(format("X:1\nK:C\n~23 a bc\n")).to.equal(null)
+    })
+  })
+  describe("check", () => {
+    it("should accept formatted sources", () => {
+      const result = check("X:1\nK:C\nab | cd |]\n")
+      expect(result.formatted).to.be.true
+    })
+    it("should report the first difference", () => {
+      const result = check("X:1\nK:C\nab | cd|]\n")
+      expect(result).to.deep.equal({
+        formatted: false,
+        offset: 15,
+        line: 3,
+        column: 8,
+      })
+    })
+    it("should report missing trailing text", () => {
+      const result = check("X:1\nK:C\nab\n\n\n")
+      expect(result.formatted).to.be.false
+    })
+  })
+})
+
+describe("Range formatting", () => {
+  describe("textEdits", () => {
+    it("should return no edits for identical texts", () => {
+      expect(textEdits("ab | cd\n", "ab | cd\n")).to.deep.equal([])
+    })
+    it("should only touch the whitespace that changed", () => {
+      const edits = textEdits("ab|cd   e\n", "ab | cd e\n")
+      expect(edits).to.deep.equal([
+        { start: 2, end: 2, text: " " },
+        { start: 3, end: 3, text: " " },
+        { start: 5, end: 8, text: " " },
+      ])
+    })
+    it("should replace reordered text with a single edit", () => {
+      const original = "X:1\nK:C\nT:a\nab|c\n"
+      const formatted = "X:1\nT:a\nK:C\nab | c\n"
+      const edits = textEdits(original, formatted)
+      expect(applyEdits(original, edits)).to.equal(formatted)
+      expect(edits.length).to.equal(3)
+    })
+  })
+  describe("formatRange", () => {
+    const source = "X:1\nK:C\nab|cd\nef|g\n\nX:2\nK:D\nab  cd\n"
+    it("should only format the lines of the range", () => {
+      const start = source.indexOf("ef")
+      const edits = formatRange(source, { start, end: start })
+      expect(applyEdits(source, edits)).to.equal(
+        "X:1\nK:C\nab|cd\nef | g\n\nX:2\nK:D\nab  cd\n"
+      )
+    })
+    it("should format the tune containing the range", () => {
+      const start = source.indexOf("X:2")
+      const gap = source.indexOf("  cd")
+      const edits = formatRange(source, { start, end: source.length })
+      expect(edits).to.deep.equal([{ start: gap, end: gap + 2, text: " " }])
+    })
+    it("should find the tune in documents with CRLF line breaks", () => {
+      const crlf = "X:1\r\nK:C\r\nab|cd\r\n\r\nX:2\r\nK:D\r\nab  cd\r\n"
+      const start = crlf.indexOf("ab  cd")
+      const edits = formatRange(crlf, { start, end: start })
+      expect(applyEdits(crlf, edits)).to.equal(
+        "X:1\r\nK:C\r\nab|cd\r\n\r\nX:2\r\nK:D\r\nab cd\r\n"
+      )
+    })
+    it("should keep the CRLF line breaks of comments", () => {
+      const crlf = "X:1\r\nK:C % key\r\n% comment\r\nab  cd\r\n"
+      const edits = formatRange(crlf, { start: 0, end: crlf.length })
+      expect(applyEdits(crlf, edits)).to.equal(
+        "X:1\r\nK:C % key\r\n% comment\r\nab cd\r\n"
+      )
+    })
+    it("should keep the edits reaching past the range's lines whole", () => {
+      const spaced = "X:1\nK:C\nab|cd  \n  ef|g\n"
+      const start = spaced.indexOf("ef")
+      const edits = formatRange(spaced, { start, end: start })
+      expect(applyEdits(spaced, edits)).to.equal("X:1\nK:C\nab|cd\nef | g\n")
+    })
+    it("should return no edits when the tune has errors", () => {
+      const broken = "X:1\nK:C\n~23 a  bc\n"
+      const edits = formatRange(broken, { start: 0, end: broken.length })
+      expect(edits).to.deep.equal([])
+    })
+  })
+})
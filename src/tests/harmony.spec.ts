@@ -0,0 +1,73 @@
+import chai from "chai"
+import { Annotation } from "../Expr"
+import {
+  annotationChord,
+  chordSymbol,
+  DIMINISHED,
+  MAJOR,
+  MINOR,
+  parseChordSymbol,
+  POWER,
+  SUSPENDED4,
+} from "../Harmony"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+// pitch classes of a chord's intervals
+const intervals = (text: string) => {
+  const chord = parseChordSymbol(text)!
+  const classes: Array<number> = []
+  for (let i = 0; i < 12; i++) if (chord.intervals & (1 << i)) classes.push(i)
+  return classes
+}
+
+describe("Harmony", () => {
+  it("should decode the root, quality and bass", () => {
+    const chord = parseChordSymbol("F#m/C#")!
+    expect(chord.root).to.equal(6)
+    expect(chord.quality).to.equal(MINOR)
+    expect(chord.bass).to.equal(1)
+    expect(parseChordSymbol("Bb")!.root).to.equal(10)
+    expect(parseChordSymbol("G/B")!.bass).to.equal(11)
+    expect(parseChordSymbol("C")!.bass).to.equal(-1)
+  })
+  it("should decode qualities", () => {
+    expect(parseChordSymbol("Cdim")!.quality).to.equal(DIMINISHED)
+    expect(parseChordSymbol("Cmaj7")!.quality).to.equal(MAJOR)
+    expect(parseChordSymbol("C5")!.quality).to.equal(POWER)
+    expect(parseChordSymbol("C7sus4")!.quality).to.equal(SUSPENDED4)
+    expect(intervals("C")).to.deep.equal([0, 4, 7])
+    expect(intervals("Am7")).to.deep.equal([0, 3, 7, 10])
+    expect(intervals("Cmaj7")).to.deep.equal([0, 4, 7, 11])
+    expect(intervals("Cdim7")).to.deep.equal([0, 3, 6, 9])
+    expect(intervals("Csus2")).to.deep.equal([0, 2, 7])
+  })
+  it("should decode extensions and alterations", () => {
+    expect(intervals("C6")).to.deep.equal([0, 4, 7, 9])
+    expect(intervals("C9")).to.deep.equal([0, 2, 4, 7, 10])
+    expect(intervals("Cadd9")).to.deep.equal([0, 2, 4, 7])
+    expect(intervals("C7b9")).to.deep.equal([0, 1, 4, 7, 10])
+    expect(intervals("Cm7b5")).to.deep.equal([0, 3, 6, 10])
+    expect(intervals("Cm(maj7)")).to.deep.equal([0, 3, 7, 11])
+  })
+  it("should reject text that isn't a chord", () => {
+    expect(parseChordSymbol("Fine")).to.equal(null)
+    expect(parseChordSymbol("D.C.")).to.equal(null)
+    expect(parseChordSymbol("N.C.")).to.equal(null)
+    expect(parseChordSymbol("C/")).to.equal(null)
+  })
+  it("should decode each distinct symbol once", () => {
+    expect(chordSymbol("Am7")).to.equal(chordSymbol("Am7"))
+    expect(Object.isFrozen(chordSymbol("Am7"))).to.equal(true)
+  })
+  it("should leave placed annotations out", () => {
+    const source = 'X:1\nK:C\n"G"C "^Coda"D|\n'
+    const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+    const annotations = ast!.tune[0].tune_body!.sequence.filter(
+      (element) => element instanceof Annotation
+    ) as Array<Annotation>
+    expect(annotationChord(annotations[0])!.root).to.equal(7)
+    expect(annotationChord(annotations[1])).to.equal(null)
+  })
+})
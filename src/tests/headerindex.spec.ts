@@ -0,0 +1,87 @@
+import chai from "chai"
+import { HeaderIndex, indexHeaders, normalize } from "../HeaderIndex"
+const expect = chai.expect
+
+const archive = [
+  "X:1\nT:The Silver Spear\nR:reel\nO:Ireland\nK:D\nFA A2 BAFA|\n",
+  "X:2\nT:Silver Bells\nC:Trad.\nR:Reel\nK:G\nGABc dBGB|\n",
+  "X:3\nT:Helene\nT:Spearmint\nC:Jean-Marc Dore\nR:valse\nK:C\nCEGc|\n",
+  "X:4\nT:Silver\nR:jig\nK:D\nDFA dAF|\n",
+].join("\n")
+
+describe("HeaderIndex", () => {
+  it("should normalize case, accents and punctuation", () => {
+    expect(normalize("  Jean-Marc  Doré!")).to.equal("jean marc dore")
+  })
+  it("should intern the field values", () => {
+    const index = indexHeaders(archive)
+    expect(index.tunes).to.equal(4)
+    expect(index.entryTunes.length).to.equal(12)
+    expect(index.strings.filter((s) => s === "reel").length).to.equal(1)
+  })
+  it("should rank substring matches", () => {
+    const index = indexHeaders(archive)
+    const matches = index.search("silver", { fields: "T" })
+    expect(matches.map((m) => m.tune)).to.deep.equal([3, 1, 0])
+    expect(matches[0].text).to.equal("Silver")
+    expect(index.search("spear").map((m) => m.text)).to.deep.equal([
+      "Spearmint",
+      "The Silver Spear",
+    ])
+    expect(index.search("ilver sp").map((m) => m.tune)).to.deep.equal([0])
+    expect(index.search("helene")[0].tune).to.equal(2)
+    expect(index.search("doré")[0].field).to.equal("C")
+    expect(index.search("xyz")).to.deep.equal([])
+  })
+  it("should rank word starts before shorter texts", () => {
+    const index = indexHeaders(
+      "X:1\nT:Spearmint\nK:C\nC|\n\n" +
+        "X:2\nT:Mint Leaves on the Long Road Home\nK:C\nC|\n"
+    )
+    expect(index.search("mint").map((m) => m.tune)).to.deep.equal([1, 0])
+  })
+  it("should search short queries", () => {
+    const index = indexHeaders(archive)
+    expect(index.search("jig").map((m) => m.tune)).to.deep.equal([3])
+    expect(index.search("ir").map((m) => m.field)).to.deep.equal(["O"])
+  })
+  it("should filter by field", () => {
+    const index = indexHeaders(archive)
+    const reels = index.search("reel", { fields: "R" })
+    expect(reels.map((m) => m.tune)).to.deep.equal([0, 1])
+    expect(index.search("reel", { fields: "T" })).to.deep.equal([])
+  })
+  it("should find misspelled values", () => {
+    const index = indexHeaders(archive)
+    const matches = index.search("the silvr spear", { fuzzy: true })
+    expect(matches[0].text).to.equal("The Silver Spear")
+    expect(index.search("the silvr spear")).to.deep.equal([])
+  })
+  it("should read back a serialized index", () => {
+    const index = indexHeaders(archive)
+    const bytes = index.serialize()
+    // unaligned, as a slice of a larger buffer
+    const buffer = new Uint8Array(bytes.length + 3)
+    buffer.set(bytes, 3)
+    const copy = HeaderIndex.deserialize(buffer.subarray(3))!
+    expect(copy.strings).to.deep.equal(index.strings)
+    expect(Array.from(copy.tuneOffsets)).to.deep.equal(
+      Array.from(index.tuneOffsets)
+    )
+    expect(copy.search("silver")).to.deep.equal(index.search("silver"))
+    expect(copy.search("dore", { fuzzy: true })).to.deep.equal(
+      index.search("dore", { fuzzy: true })
+    )
+    expect(HeaderIndex.deserialize(new Uint8Array(40))).to.equal(null)
+  })
+  it("should read back values continued over several lines", () => {
+    const index = indexHeaders(
+      "X:1\nT:The Long\n+:Title\nC:Trad.\nK:C\nC|\n\n" +
+        "X:2\nT:Short\nC:Anon.\nK:C\nC|\n"
+    )
+    expect(index.strings.some((s) => s.indexOf("\n") !== -1)).to.equal(true)
+    const copy = HeaderIndex.deserialize(index.serialize())!
+    expect(copy.strings).to.deep.equal(index.strings)
+    expect(copy.search("anon").map((m) => m.tune)).to.deep.equal([1])
+  })
+})
@@ -0,0 +1,165 @@
+import chai from "chai"
+import { Readable, Writable } from "stream"
+import { NodeKind, toJson, writeJson } from "../JsonWriter"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import { splitTunes, splitTuneStream } from "../tunes"
+import { TokenType } from "../types"
+const expect = chai.expect
+
+const archive = [
+  "%abc-2.1\n%%pagewidth 21cm\n",
+  'X:1\nT:One % first\nK:G\n"G" G2 (3ABc|{/e}d>B [GB]2|]\n',
+  "X:2\nT:Two\nK:D\n!f! D2 z A,|1 F4-:|2 F4|]\n",
+].join("\n")
+
+const parse = (source: string) =>
+  new Parser(new Scanner(source).scanTokens(), source).parse()!
+
+/**
+ * Collects what is written into a stream that drains slowly,
+ * and counts the writes made while it asked to wait.
+ */
+const slowStream = () => {
+  const result = { chunks: [] as Array<string>, early: 0, waiting: false }
+  const stream = new Writable({
+    highWaterMark: 16,
+    write(chunk, _, callback) {
+      result.chunks.push(String(chunk))
+      setTimeout(callback, 1)
+    },
+  })
+  const write = stream.write.bind(stream)
+  stream.write = ((chunk: string) => {
+    if (result.waiting) result.early++
+    result.waiting = !write(chunk)
+    return !result.waiting
+  }) as typeof stream.write
+  stream.on("drain", () => (result.waiting = false))
+  return { stream, result }
+}
+
+// the archive in slices of `size` characters
+const slices = (source: string, size: number) => {
+  const result: Array<string> = []
+  for (let i = 0; i < source.length; i += size) {
+    result.push(source.substring(i, i + size))
+  }
+  return Readable.from(result)
+}
+
+describe("JsonWriter", () => {
+  it("should print nodes as arrays of their kind and fields", () => {
+    const json = JSON.parse(toJson(parse('X:1\nK:C\n"C" ^c/2|\n')))
+    expect(json.version).to.equal(1)
+    expect(json.header).to.equal(null)
+    const [kind, , header, body] = json.tunes[0]
+    expect(kind).to.equal(NodeKind.Tune)
+    expect(header[1][0]).to.deep.equal([
+      NodeKind.InfoLine,
+      [TokenType.LETTER_COLON, 0, "X:"],
+      [TokenType.STRING, 2, "1"],
+      null,
+    ])
+    expect(body[1][0]).to.deep.equal([
+      NodeKind.Annotation,
+      [TokenType.STRING, 8, '"C"'],
+    ])
+    expect(body[1][1]).to.deep.equal([
+      NodeKind.Token,
+      TokenType.WHITESPACE,
+      11,
+      " ",
+    ])
+    expect(body[1][2]).to.deep.equal([
+      NodeKind.Note,
+      [
+        NodeKind.Pitch,
+        [TokenType.SHARP, 12, "^"],
+        [TokenType.NOTE_LETTER, 13, "c"],
+        null,
+      ],
+      [
+        NodeKind.Rhythm,
+        null,
+        [TokenType.SLASH, 14, "/"],
+        [TokenType.NUMBER, 15, "2"],
+        null,
+      ],
+      0,
+    ])
+  })
+  it("should stream the tunes with their offsets in the archive", async () => {
+    const { stream, result } = slowStream()
+    await writeJson(archive, stream)
+    const json = JSON.parse(result.chunks.join(""))
+    expect(json.header).to.deep.equal([
+      NodeKind.FileHeader,
+      "%abc-2.1\n%%pagewidth 21cm\n",
+    ])
+    expect(json.tunes.length).to.equal(2)
+    const whole = JSON.parse(toJson(parse(archive)))
+    expect(json.tunes[1]).to.deep.equal(whole.tunes[1])
+    const [, key] = json.tunes[1][2][1][0]
+    expect(key[1]).to.equal(archive.indexOf("X:2"))
+  })
+  it("should wait for the stream to drain", async () => {
+    const tune = "X:1\nT:One\nK:G\nGABc dBGB|\n"
+    const { stream, result } = slowStream()
+    await writeJson(new Array(10).fill(tune).join("\n"), stream)
+    // one write per tune, and the end of the file
+    expect(result.chunks.length).to.equal(11)
+    expect(result.early).to.equal(0)
+  })
+  it("should fail when the stream does while it waits", async () => {
+    const stream: Writable = new Writable({
+      highWaterMark: 1,
+      // never drains, and fails instead
+      write: () => setImmediate(() => stream.destroy(new Error("broken"))),
+    })
+    let error: Error | null = null
+    try {
+      await writeJson(archive, stream)
+    } catch (e) {
+      error = e as Error
+    }
+    expect(error && error.message).to.equal("broken")
+    expect(stream.listenerCount("drain")).to.equal(0)
+  })
+  it("should split a stream the way it splits a string", async () => {
+    const source = archive + "\n\n\nX:3\nK:C\nabc|\n\nX\n\nX:4\n"
+    for (let size = 1; size < 12; size++) {
+      const chunks = []
+      for await (const chunk of splitTuneStream(slices(source, size))) {
+        chunks.push(chunk)
+      }
+      expect(chunks).to.deep.equal(Array.from(splitTunes(source)))
+    }
+  })
+  it("should split archives with CRLF line breaks", async () => {
+    const source = archive.replace(/\n/g, "\r\n")
+    const tunes = Array.from(splitTunes(source))
+    expect(tunes.map((tune) => tune.offset)).to.deep.equal([
+      0,
+      source.indexOf("X:1"),
+      source.indexOf("X:2"),
+    ])
+    expect(tunes[1].source.endsWith("|]\r\n")).to.equal(true)
+    for (let size = 1; size < 12; size++) {
+      const chunks = []
+      for await (const chunk of splitTuneStream(slices(source, size))) {
+        chunks.push(chunk)
+      }
+      expect(chunks).to.deep.equal(tunes)
+    }
+  })
+  it("should report the tunes it can't parse", async () => {
+    const source = archive + "\nX:3\nK:D\n\n}\n"
+    const whole = slowStream()
+    expect(await writeJson(archive, whole.stream)).to.deep.equal([])
+    const streamed = slowStream()
+    const failed = await writeJson(slices(source, 5), streamed.stream)
+    expect(failed).to.deep.equal([archive.length + 1])
+    expect(streamed.result.chunks).to.deep.equal(whole.result.chunks)
+  })
+})
@@ -0,0 +1,100 @@
+import chai from "chai"
+import { alignLyrics, HELD, HYPHEN } from "../Lyrics"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const lyrics = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return alignLyrics(ast!.tune[0])
+}
+
+const verse = (source: string, v = 0) => {
+  const tune = lyrics(source)
+  return tune.notes.map((_, n) => tune.syllableAt(n, v) || "")
+}
+
+describe("Lyrics", () => {
+  it("should place syllables on the notes of the line above", () => {
+    const source = "X:1\nK:C\nC D (EF) z G|\nw: Hel-lo my dear friend\n"
+    expect(verse(source)).to.deep.equal(["Hel", "lo", "my", "dear", "friend"])
+  })
+  it("should mark hyphens and held notes", () => {
+    const tune = lyrics("X:1\nK:C\nC D E F G|\nw: a-b_ c--d\n")
+    expect(tune.notes.map((_, n) => tune.syllableAt(n) || "")).to.deep.equal([
+      "a",
+      "b",
+      "",
+      "c",
+      "",
+    ])
+    expect(Array.from(tune.flags)).to.deep.equal([
+      HYPHEN,
+      0,
+      HELD,
+      HYPHEN,
+      HYPHEN,
+    ])
+  })
+  it("should skip notes with * and to the next bar with |", () => {
+    expect(verse("X:1\nK:C\nC D E | F G A|\nw: a * b | c\n")).to.deep.equal([
+      "a",
+      "",
+      "b",
+      "c",
+      "",
+      "",
+    ])
+    expect(verse("X:1\nK:C\nC D E | F G A|\nw: a | b\n")).to.deep.equal([
+      "a",
+      "",
+      "",
+      "b",
+      "",
+      "",
+    ])
+  })
+  it("should skip a whole bar for each further |", () => {
+    expect(verse("X:1\nK:C\nC D | E F | G A|\nw: a | | b\n")).to.deep.equal([
+      "a",
+      "",
+      "",
+      "",
+      "b",
+      "",
+    ])
+  })
+  it("should keep escaped hyphens in the syllable", () => {
+    expect(verse("X:1\nK:C\nC D|\nw: Fa\\-la la\n")).to.deep.equal([
+      "Fa-la",
+      "la",
+    ])
+  })
+  it("should join words with ~", () => {
+    expect(verse("X:1\nK:C\nC D|\nw: of~the day\n")).to.deep.equal([
+      "of the",
+      "day",
+    ])
+  })
+  it("should read consecutive lines as verses", () => {
+    const source = "X:1\nK:C\nC D|\nw: one two\nw: three four\nE F|\nw: five\n"
+    const tune = lyrics(source)
+    expect(tune.verses).to.equal(2)
+    expect(verse(source, 1)).to.deep.equal(["three", "four", "", ""])
+    expect(verse(source, 0)).to.deep.equal(["one", "two", "five", ""])
+  })
+  it("should align each voice on its own notes", () => {
+    const source = "X:1\nK:C\nV:1\nC D|\nV:2\nE F|\nV:1\nw: a b\nV:2\nw: c d\n"
+    expect(verse(source)).to.deep.equal(["a", "b", "c", "d"])
+  })
+  it("should look syllables up by note", () => {
+    const tune = lyrics("X:1\nK:C\nC [DF]|\nw: la la\n")
+    expect(tune.syllableOf(tune.notes[1])).to.equal("la")
+    expect(tune.texts).to.deep.equal(["la"])
+  })
+  it("should keep W: lines as words", () => {
+    const tune = lyrics("X:1\nK:C\nC D|\nW: after the tune\n")
+    expect(tune.words).to.deep.equal(["after the tune"])
+    expect(tune.verses).to.equal(0)
+  })
+})
@@ -0,0 +1,116 @@
+import chai from "chai"
+import { Decoration, Note, Tune } from "../Expr"
+import { compileMacro, expandMacros } from "../Macros"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import { compileTunes } from "../Timeline"
+import { parseTunes } from "../tunes"
+const expect = chai.expect
+
+const parse = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return ast!.tune[0]
+}
+
+describe("Macros", () => {
+  it("should expand static macros", () => {
+    const { source } = expandMacros("X:1\nm: ~G2 = {A}G{F}G\nK:G\n~G2 B|\n")
+    expect(source).to.equal("X:1\nm: ~G2 = {A}G{F}G\nK:G\n{A}G{F}G B|\n")
+  })
+  it("should expand transposing macros for any note", () => {
+    const { source } = expandMacros(
+      "X:1\nm: ~n2 = {o}n{m}n\nK:G\n~G2 ~c2 ~B,2|\n"
+    )
+    expect(source.split("\n")[3]).to.equal("{A}G{F}G {d}c{B}c {C}B,{A,}B,|")
+  })
+  it("should leave annotations, decorations and fields alone", () => {
+    const { source } = expandMacros(
+      'X:1\nm: T = !trill!\nK:C\n"T" !T! [T:x] T C|\n'
+    )
+    expect(source.split("\n")[3]).to.equal('"T" !T! [T:x] !trill! C|')
+  })
+  it("should keep header macros for every tune", () => {
+    const { source } = expandMacros(
+      "m: ~n = n/n/\n\nX:1\nm: ~n = nn\nK:C\n~C|\n\nX:2\nK:C\n~C|\n"
+    )
+    const lines = source.split("\n")
+    expect(lines[5]).to.equal("CC|")
+    expect(lines[9]).to.equal("C/C/|")
+  })
+  it("should map expanded text back to the source", () => {
+    const input = "X:1\nm: ~n2 = {o}n{m}n\nK:G\nA ~G2 B|\n"
+    const { source, map } = expandMacros(input)
+    // the expansion points into the macro's definition
+    const grace = source.indexOf("{A}G") + 1
+    expect(input.charAt(map.originalOffset(grace))).to.equal("o")
+    // text after the expansion points to itself
+    const after = source.lastIndexOf("B")
+    expect(map.originalOffset(after)).to.equal(input.lastIndexOf("B"))
+    expect(map.originalOffset(source.indexOf("A {"))).to.equal(
+      input.indexOf("A ~")
+    )
+  })
+  it("should reuse a macro's expansion of the same note", () => {
+    const macro = compileMacro(" ~n2 = {o}n{m}n", 0)!
+    expect(macro.expand("G")).to.equal(macro.expand("G"))
+    expect(macro.expand("G").text).to.equal("{A}G{F}G")
+  })
+  it("should ignore macros without a replacement", () => {
+    expect(compileMacro(" ~G2", 0)).to.equal(null)
+    expect(compileMacro(" n2 = nn", 0)).to.equal(null)
+  })
+  it("should give timeline events the offsets of the original source", () => {
+    const input = "X:1\nL:1/4\nm: ~n = n/n/\nK:C\n~C D|\n"
+    const [events] = Array.from(compileTunes(input))
+    expect(events.length).to.equal(3)
+    expect(input.charAt(events.offsets[0])).to.equal("n")
+    expect(input.charAt(events.offsets[2])).to.equal("D")
+  })
+})
+
+describe("Symbols", () => {
+  it("should resolve the default symbols", () => {
+    const tune = parse("X:1\nK:C\nTC|\n")
+    const decoration = tune.tune_body!.sequence.find(
+      (element) => element instanceof Decoration
+    ) as Decoration
+    expect(decoration.symbol).to.equal("!trill!")
+  })
+  it("should redefine symbols with U:", () => {
+    const tune = parse("X:1\nU: W = !pp!\nK:C\nWC|\n")
+    const decoration = tune.tune_body!.sequence.find(
+      (element) => element instanceof Decoration
+    ) as Decoration
+    expect(decoration.symbol).to.equal("!pp!")
+  })
+  it("should accept symbols defined as !nil! without a meaning", () => {
+    const tune = parse("X:1\nU: T = !nil!\nK:C\nTC|\n")
+    const decoration = tune.tune_body!.sequence.find(
+      (element) => element instanceof Decoration
+    ) as Decoration
+    expect(decoration.symbol).to.equal(undefined)
+  })
+  it("should not redefine other characters", () => {
+    const tune = parse("X:1\nU: C = !trill!\nK:C\nC|\n")
+    expect(
+      tune.tune_body!.sequence.some((element) => element instanceof Note)
+    ).to.equal(true)
+  })
+  it("should start each tune from the symbols of the file header", () => {
+    const archive =
+      "U: W = !pp!\n\nX:1\nU: W = !ff!\nK:C\nWC|\n\nX:2\nK:C\nWC|\n"
+    const symbols = (tunes: Array<Tune>) =>
+      tunes.map(
+        (tune) =>
+          (
+            tune.tune_body!.sequence.find(
+              (element) => element instanceof Decoration
+            ) as Decoration
+          ).symbol
+      )
+    const whole = new Parser(new Scanner(archive).scanTokens(), archive)
+    expect(symbols(whole.parse()!.tune)).to.deep.equal(["!ff!", "!pp!"])
+    const split = Array.from(parseTunes(archive), ({ tune }) => tune)
+    expect(symbols(split)).to.deep.equal(["!ff!", "!pp!"])
+  })
+})
@@ -0,0 +1,55 @@
+import chai from "chai"
+import { indexMelodies, melodyIntervals } from "../MelodyIndex"
+import { PostingList } from "../postings"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const parse = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return ast!.tune[0]
+}
+
+const archive = [
+  "X:1\nT:One\nK:G\nGABc dBGA|\n",
+  "X:2\nT:Two\nK:D\nDEFG AFDE|\n",
+  "X:3\nT:Three\nK:C\nCEGc BGEC|\n",
+  "X:4\nT:Four\nK:C\nV:1\nCEDF|\nV:2\nGBAc|\n",
+].join("\n")
+
+describe("MelodyIndex", () => {
+  it("should read melodies as intervals", () => {
+    const melody = melodyIntervals(parse("X:1\nK:C\nC [CEG] F2- F E|\n"))
+    expect(Array.from(melody)).to.deep.equal([7, -2, -1])
+    const contour = melodyIntervals(parse("X:1\nK:C\nC G F E|\n"), true)
+    expect(Array.from(contour)).to.deep.equal([1, -1, -1])
+  })
+  it("should delta encode postings", () => {
+    const list = new PostingList()
+    for (const id of [3, 3, 200, 100000]) list.add(id)
+    expect(list.count).to.equal(3)
+    expect(list.size).to.equal(6)
+    expect(Array.from(list.decode())).to.deep.equal([3, 200, 100000])
+  })
+  it("should find phrases in any key", () => {
+    const index = indexMelodies(archive)
+    expect(index.length).to.equal(4)
+    // GABc dB in G is DEFG AF in D
+    expect(index.query("GABc dB", "G")).to.deep.equal([0, 1])
+    expect(index.query("CEGc")).to.deep.equal([2])
+    expect(index.query("CEGF")).to.deep.equal([])
+  })
+  it("should not match phrases across voices", () => {
+    const index = indexMelodies(archive, { n: 2 })
+    expect(index.query("CEDF")).to.deep.equal([3])
+    expect(index.query("DFGB")).to.deep.equal([])
+  })
+  it("should search phrases shorter than an n-gram", () => {
+    const index = indexMelodies(archive, { n: 6 })
+    expect(index.query("CEG")).to.deep.equal([2])
+  })
+  it("should give the offsets of the tunes in the archive", () => {
+    const index = indexMelodies(archive)
+    expect(archive.startsWith("X:3", index.offsets[2])).to.equal(true)
+  })
+})
@@ -0,0 +1,76 @@
+import chai from "chai"
+import { MidiWriter, parseTempo, voiceChannel } from "../MidiWriter"
+import { Parser } from "../Parser"
+import { rational } from "../rational"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const encode = (source: string) => {
+  const tune = new Parser(new Scanner(source).scanTokens()).parse()!.tune[0]
+  return Array.from(new MidiWriter(480).encode(tune))
+}
+const ascii = (bytes: Array<number>, at: number) =>
+  String.fromCharCode(...bytes.slice(at, at + 4))
+const uint32 = (bytes: Array<number>, at: number) =>
+  ((bytes[at] << 24) | (bytes[at + 1] << 16) | (bytes[at + 2] << 8)) +
+  bytes[at + 3]
+
+describe("MidiWriter", () => {
+  it("should parse tempos", () => {
+    expect(parseTempo("1/4=120", rational(1, 8))).to.equal(500000)
+    expect(parseTempo('"Allegro" 3/8=40', rational(1, 8))).to.equal(1000000)
+    expect(parseTempo("120", rational(1, 8))).to.equal(1000000)
+    expect(parseTempo("Andante", rational(1, 8))).to.equal(null)
+    // too slow for the 3 bytes of a MIDI tempo
+    expect(parseTempo("1/4=1", rational(1, 8))).to.equal(0xffffff)
+  })
+  it("should skip the percussion channel", () => {
+    const channels = [0, 8, 9, 14, 15, 24].map(voiceChannel)
+    expect(channels).to.deep.equal([0, 8, 10, 15, 0, 10])
+  })
+  it("should write a type 1 header with a track per voice", () => {
+    const bytes = encode("X:1\nK:C\nV:1\nC\nV:2\nE\n")
+    expect(ascii(bytes, 0)).to.equal("MThd")
+    expect(uint32(bytes, 4)).to.equal(6)
+    expect(bytes.slice(8, 14)).to.deep.equal([0, 1, 0, 3, 1, 224])
+    let at = 14
+    for (let track = 0; track < 3; track++) {
+      expect(ascii(bytes, at)).to.equal("MTrk")
+      at += 8 + uint32(bytes, at + 4)
+    }
+    expect(at).to.equal(bytes.length)
+  })
+  it("should write the tempo and meter", () => {
+    const bytes = encode("X:1\nM:6/8\nQ:1/4=60\nK:C\nC\n")
+    const tempo = bytes.indexOf(0x51)
+    expect(bytes.slice(tempo - 1, tempo + 5)).to.deep.equal([
+      0xff, 0x51, 3, 0x0f, 0x42, 0x40,
+    ])
+    const meter = bytes.indexOf(0x58)
+    expect(bytes.slice(meter + 2, meter + 4)).to.deep.equal([6, 3])
+  })
+  it("should write the meter changes of the body", () => {
+    const bytes = encode("X:1\nM:4/4\nL:1/4\nK:C\nC D E F|[M:3/4] G A B|\n")
+    const meter = bytes.indexOf(0x58, bytes.indexOf(0x58) + 1)
+    // a whole note, 1920 ticks, after the first meter
+    expect(bytes.slice(meter - 3, meter + 4)).to.deep.equal([
+      0x8f, 0x00, 0xff, 0x58, 4, 3, 2,
+    ])
+  })
+  it("should write the tempo changes of the body", () => {
+    const bytes = encode("X:1\nL:1/4\nQ:1/4=120\nK:C\nC D|\nQ:1/4=60\nE F|\n")
+    const tempo = bytes.indexOf(0x51, bytes.indexOf(0x51) + 1)
+    expect(bytes.slice(tempo - 3, tempo + 5)).to.deep.equal([
+      0x87, 0x40, 0xff, 0x51, 3, 0x0f, 0x42, 0x40,
+    ])
+  })
+  it("should write notes with delta-time varints", () => {
+    const bytes = encode("X:1\nL:1/4\nK:C\nC D\n")
+    const track = bytes.lastIndexOf(0x4d) + 8
+    // quarter notes last 480 ticks, encoded on two bytes
+    expect(bytes.slice(track, track + 18)).to.deep.equal([
+      0, 0x90, 60, 80, 0x83, 0x60, 0x80, 60, 0x40, 0, 0x90, 62, 80, 0x83,
+      0x60, 0x80, 62, 0x40,
+    ])
+  })
+})
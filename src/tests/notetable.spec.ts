@@ -0,0 +1,72 @@
+import chai from "chai"
+import { exportNotes, readNoteTable } from "../NoteTable"
+const expect = chai.expect
+
+const archive = [
+  "X:1\nT:One\nM:2/4\nL:1/8\nK:G\nG2 ~A2|!f!B2 {c}d2|\n",
+  "X:2\nT:Two\nM:2/4\nL:1/8\nK:C\nV:1\nc4|e4|\nV:2\nC2 E2|!trill!G4|\n",
+].join("\n")
+
+// copies each chunk out of the writer's reused buffer
+const encode = (source: string, chunkRows?: number) => {
+  const parts: Array<Uint8Array> = []
+  exportNotes(source, (bytes) => parts.push(bytes.slice()), chunkRows)
+  return new Uint8Array(Buffer.concat(parts))
+}
+
+describe("NoteTable", () => {
+  it("should write the events in columns", () => {
+    const table = readNoteTable(encode(archive))!
+    expect(table.chunks.length).to.equal(1)
+    const chunk = table.chunks[0]
+    expect(chunk.rows).to.equal(10)
+    expect(Array.from(chunk.tunes)).to.deep.equal([
+      0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
+    ])
+    expect(Array.from(chunk.pitches.subarray(0, 5))).to.deep.equal([
+      67, 69, 71, 72, 74,
+    ])
+    expect(Array.from(chunk.onsets.subarray(0, 4))).to.deep.equal([
+      0, 0.25, 0.5, 0.75,
+    ])
+    expect(Array.from(chunk.bars)).to.deep.equal([0, 0, 1, 1, 1, 0, 0, 0, 1, 1])
+    expect(table.references).to.deep.equal(["1", "2"])
+    expect(table.tuneOffsets[1]).to.equal(archive.indexOf("X:2"))
+    expect(chunk.offsets[0]).to.equal(archive.indexOf("G2"))
+  })
+  it("should encode voices and decorations with dictionaries", () => {
+    const table = readNoteTable(encode(archive))!
+    const chunk = table.chunks[0]
+    expect(table.voiceNames).to.deep.equal(["", "1", "2"])
+    expect(Array.from(chunk.voices.subarray(5))).to.deep.equal([1, 2, 2, 1, 2])
+    expect(table.decorationNames).to.deep.equal(["!roll!", "!f!", "!trill!"])
+    const decorationsOf = (row: number) =>
+      Array.from(
+        chunk.decorations.subarray(
+          chunk.decorationStarts[row],
+          chunk.decorationStarts[row + 1]
+        )
+      ).map((id) => table.decorationNames[id])
+    expect(decorationsOf(1)).to.deep.equal(["!roll!"])
+    expect(decorationsOf(2)).to.deep.equal(["!f!"])
+    expect(decorationsOf(9)).to.deep.equal(["!trill!"])
+    expect(decorationsOf(0)).to.deep.equal([])
+  })
+  it("should split the rows into chunks", () => {
+    const whole = readNoteTable(encode(archive))!.chunks[0]
+    const table = readNoteTable(encode(archive, 4))!
+    expect(table.chunks.map((chunk) => chunk.rows)).to.deep.equal([4, 4, 2])
+    const pitches = table.chunks.flatMap((chunk) => Array.from(chunk.pitches))
+    expect(pitches).to.deep.equal(Array.from(whole.pitches))
+    const last = table.chunks[2]
+    expect(Array.from(last.decorationStarts)).to.deep.equal([0, 0, 1])
+  })
+  it("should align the columns", () => {
+    const bytes = encode(archive)
+    const unaligned = new Uint8Array(bytes.length + 1).subarray(1)
+    unaligned.set(bytes)
+    const table = readNoteTable(unaligned)!
+    expect(table.chunks[0].onsets.byteOffset % 8).to.equal(0)
+    expect(readNoteTable(new Uint8Array(16))).to.equal(null)
+  })
+})
@@ -0,0 +1,73 @@
+import chai from "chai"
+import { toJson } from "../JsonWriter"
+import { parseAsync, Parser } from "../Parser"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const tune = (reference: number) =>
+  `X:${reference}\nT:Reel\nM:4/4\nL:1/8\nK:D\n` +
+  "|:A2FA dAFA|B2 !trill!B2 z4|{g}f2ed (3Bcd e2:|\n"
+// a single tune, as in an editor's buffer
+const long = (bars: number) =>
+  "X:1\nK:D\n" + "A2FA dAFA|B2 B2 z4|\n".repeat(bars)
+const archive = (tunes: number) =>
+  "%abc-2.1\n\n" + Array.from({ length: tunes }, (_, i) => tune(i)).join("\n")
+
+describe("parseAsync", () => {
+  it("should give the same tree as the parser", async () => {
+    const source = archive(50)
+    const tokens = new Scanner(source).scanTokens()
+    const expected = new Parser(tokens, source).parse()
+    const ast = await parseAsync(source, { budgetMs: 0 })
+    expect(ast!.tune.length).to.equal(50)
+    expect(toJson(ast!)).to.equal(toJson(expected!))
+  })
+  it("should yield to the event loop between slices", async () => {
+    let ticks = 0
+    const timer = setInterval(() => ticks++, 0)
+    try {
+      await parseAsync(archive(200), { budgetMs: 0 })
+    } finally {
+      clearInterval(timer)
+    }
+    expect(ticks > 0).to.equal(true)
+  })
+  it("should stop once aborted", async () => {
+    const controller = new AbortController()
+    const parse = parseAsync(archive(200), {
+      budgetMs: 0,
+      signal: controller.signal,
+    })
+    controller.abort(new Error("superseded"))
+    let error: unknown
+    try {
+      await parse
+    } catch (e) {
+      error = e
+    }
+    expect((error as Error).message).to.equal("superseded")
+  })
+  it("should pause within the body of a tune", () => {
+    const source = long(500)
+    const tokens = new Scanner(source).scanTokens()
+    const steps = new Parser(tokens, source).parseSteps()
+    let pauses = 0
+    while (!steps.next().done) pauses++
+    expect(pauses > 10).to.equal(true)
+  })
+  it("should stop a single large tune once aborted", async () => {
+    const controller = new AbortController()
+    const parse = parseAsync(long(5000), {
+      budgetMs: 0,
+      signal: controller.signal,
+    })
+    setTimeout(() => controller.abort(new Error("superseded")), 0)
+    let error: unknown
+    try {
+      await parse
+    } catch (e) {
+      error = e
+    }
+    expect((error as Error).message).to.equal("superseded")
+  })
+})
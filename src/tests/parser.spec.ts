@@ -21,6 +21,7 @@ import {
   Rhythm,
   Rest,
   Decoration,
+  Tuplet,
   YSPACER,
 } from "../Expr"
 import chai from "chai"
@@ -415,6 +416,42 @@ describe("Parser", () => {
           }
         }
       })
+      it("should parse tuplets", () => {
+        const result = new Parser(
+          new Scanner("X:1\n(3:2:2abc").scanTokens()
+        ).parse()
+        const sequence = result?.tune[0].tune_body?.sequence
+        const tuplet = sequence?.[0]
+        expect(tuplet).to.be.an.instanceof(Tuplet)
+        if (tuplet instanceof Tuplet) {
+          expect(tuplet.p.lexeme).to.equal("(3")
+          expect(tuplet.q?.lexeme).to.equal("2")
+          expect(tuplet.r?.lexeme).to.equal("2")
+          // only the first r notes belong to the tuplet
+          const notes = sequence!.slice(1) as Array<Note>
+          expect(notes.map((note) => note.tuplet)).to.deep.equal([
+            tuplet,
+            tuplet,
+            undefined,
+          ])
+        }
+      })
+      it("should parse tuplets without ratio", () => {
+        const result = new Parser(
+          new Scanner("X:1\n(3::4 (ab)[ce]d").scanTokens()
+        ).parse()
+        const sequence = result?.tune[0].tune_body?.sequence
+        const tuplet = sequence?.[0]
+        expect(tuplet).to.be.an.instanceof(Tuplet)
+        if (tuplet instanceof Tuplet) {
+          expect(tuplet.q).to.not.exist
+          expect(tuplet.notes).to.equal(4)
+          const slur = sequence![2] as Slur_group
+          expect((slur.contents[1] as Note).tuplet).to.equal(tuplet)
+          expect((sequence![3] as Chord).tuplet).to.equal(tuplet)
+          expect((sequence![4] as Note).tuplet).to.equal(tuplet)
+        }
+      })
       it("should parse EOL", () => {
         const result = new Parser(
           new Scanner("X:1\n|\\\n\n").scanTokens()
@@ -0,0 +1,109 @@
+import chai from "chai"
+import { Worker } from "worker_threads"
+import { toJson } from "../JsonWriter"
+import { Parser } from "../Parser"
+import { encodeParse, ParseResult, ParserPool } from "../ParserPool"
+import Scanner from "../Scanner"
+import { TokenType } from "../types"
+const expect = chai.expect
+
+const source = "X:1\nT:Reel\nK:D\n|:A2FA dAFA|B2 !trill!B2 z4:|\n"
+
+describe("ParserPool", () => {
+  it("should encode the tokens and tree into arrays", () => {
+    const result = new ParseResult(encodeParse(source))
+    const tokens = new Scanner(source).scanTokens()
+    expect(result.ok).to.equal(true)
+    expect(result.length).to.equal(tokens.length)
+    expect(result.types[0]).to.equal(TokenType.LETTER_COLON)
+    expect(result.lexeme(3, source)).to.equal("T:")
+    expect(result.lines[3]).to.equal(2)
+    const ast = new Parser(tokens, source).parse()!
+    expect(result.tree()).to.deep.equal(JSON.parse(toJson(ast)))
+  })
+  it("should collect the errors", () => {
+    const result = new ParseResult(encodeParse("X:1\nK:C\nA B | ^ | c\n"))
+    expect(result.errors.length).to.equal(1)
+    expect(result.errors[0]).to.contain("Expected a note letter")
+  })
+  it("should parse the jobs in turn", async () => {
+    const pool = new ParserPool({ workers: 0 })
+    try {
+      const results = await Promise.all([pool.parse(source), pool.parse("")])
+      expect(results[0].ok).to.equal(true)
+      expect(results[1].length).to.equal(1)
+    } finally {
+      await pool.close()
+    }
+  })
+  it("should reject jobs over the queue's length", async () => {
+    const pool = new ParserPool({ workers: 0, maxQueue: 1 })
+    const running = pool.parse(source)
+    const queued = pool.parse(source)
+    let error: unknown
+    try {
+      await pool.parse(source)
+    } catch (e) {
+      error = e
+    }
+    expect((error as Error).message).to.equal("parser queue is full")
+    await Promise.all([running, queued])
+    await pool.close()
+  })
+  it("should cancel the jobs whose signal aborted", async () => {
+    const pool = new ParserPool({ workers: 0 })
+    const controller = new AbortController()
+    const running = pool.parse(source)
+    const queued = pool.parse(source, { signal: controller.signal })
+    controller.abort(new Error("superseded"))
+    let error: unknown
+    try {
+      await queued
+    } catch (e) {
+      error = e
+    }
+    expect((error as Error).message).to.equal("superseded")
+    expect((await running).ok).to.equal(true)
+    await pool.close()
+  })
+  it("should replace a worker that timed out", async function () {
+    // leaves time for the worker to load
+    this.timeout(20000)
+    const pool = new ParserPool({ workers: 1 })
+    try {
+      const large = new Array(5000).fill(source).join("\n")
+      let error: unknown
+      try {
+        await pool.parse(large, { timeoutMs: 1 })
+      } catch (e) {
+        error = e
+      }
+      expect((error as Error).message).to.equal("parse timed out")
+      const result = await pool.parse(source)
+      expect(result.ok).to.equal(true)
+      expect(result.lexeme(3, source)).to.equal("T:")
+    } finally {
+      await pool.close()
+    }
+  })
+  it("should reject the job of a worker that exited", async function () {
+    this.timeout(20000)
+    const pool = new ParserPool({ workers: 1 })
+    try {
+      const large = new Array(5000).fill(source).join("\n")
+      const parse = pool.parse(large)
+      const { workers } = pool as unknown as { workers: Array<Worker> }
+      workers[0].terminate()
+      let error: unknown
+      try {
+        await parse
+      } catch (e) {
+        error = e
+      }
+      expect((error as Error).message).to.contain("exited with code")
+      expect((await pool.parse(source)).ok).to.equal(true)
+    } finally {
+      await pool.close()
+    }
+  })
+})
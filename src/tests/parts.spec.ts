@@ -0,0 +1,52 @@
+import chai from "chai"
+import { Parser } from "../Parser"
+import { parsePartOrder, resolveParts } from "../Parts"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const parts = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return resolveParts(ast!.tune[0])
+}
+
+describe("Parts", () => {
+  it("should expand the part order", () => {
+    expect(parsePartOrder("ABAC").join("")).to.equal("ABAC")
+    expect(parsePartOrder("A2B").join("")).to.equal("AAB")
+    expect(parsePartOrder("(AB)3C").join("")).to.equal("ABABABC")
+    expect(parsePartOrder("((AB)2C)2").join("")).to.equal("ABABCABABC")
+    expect(parsePartOrder("A.B.C").join("")).to.equal("ABC")
+  })
+  it("should play the parts in the order of the header", () => {
+    const tune = parts(
+      "X:1\nL:1/4\nP:(AB)2A\nK:C\nP:A\nC D E F |\nP:B\nG A B c |\n"
+    )
+    expect(tune.sections.map((section) => section.label)).to.deep.equal([
+      "A",
+      "B",
+    ])
+    expect(Array.from(tune.order)).to.deep.equal([0, 1, 0, 1, 0])
+    expect(Array.from(tune.offsets)).to.deep.equal([0, 1, 2, 3, 4, 5])
+  })
+  it("should time parts with their repeats", () => {
+    const tune = parts(
+      "X:1\nL:1/4\nP:AB\nK:C\nP:A\n|: C D :|\nP:B\n|: E F | G A :|\n"
+    )
+    expect(tune.sections.map((section) => section.duration)).to.deep.equal([
+      1, 2,
+    ])
+    const onsets = Array.from(tune.performance(), (entry) => entry.offset)
+    expect(onsets).to.deep.equal([0, 1])
+  })
+  it("should reference the body instead of copying it", () => {
+    const source = "X:1\nP:AA\nK:C\nP:A\nCD|\n"
+    const tune = parts(source)
+    const [first, second] = Array.from(tune.performance())
+    expect(first.section).to.equal(second.section)
+    expect(first.section.start).to.equal(0)
+  })
+  it("should play the parts as written without a header order", () => {
+    const tune = parts("X:1\nK:C\nP:A\nCD|\nP:B\nEF|\n")
+    expect(Array.from(tune.order)).to.deep.equal([0, 1])
+  })
+})
@@ -0,0 +1,94 @@
+import chai from "chai"
+import { parseKey, signature } from "../Key"
+import { Parser } from "../Parser"
+import { resolvePitches } from "../PitchResolver"
+import Scanner from "../Scanner"
+const expect = chai.expect
+
+const pitches = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens()).parse()
+  return Array.from(resolvePitches(ast!.tune[0]).pitches)
+}
+const fifths = (key: string) => parseKey(key)!.fifths
+const alterations = (key: string) => Array.from(parseKey(key)!.alterations)
+
+describe("Pitch resolution", () => {
+  describe("keys", () => {
+    it("should parse major and minor keys", () => {
+      expect(fifths("G")).to.equal(1)
+      expect(fifths("Bb")).to.equal(-2)
+      expect(fifths("Em")).to.equal(1)
+      expect(fifths("F#min")).to.equal(3)
+      expect(fifths("C#")).to.equal(7)
+    })
+    it("should parse modes", () => {
+      expect(fifths("D Dorian")).to.equal(0)
+      expect(fifths("AMix")).to.equal(2)
+      expect(fifths("E phr")).to.equal(0)
+      expect(fifths("F lyd")).to.equal(0)
+      expect(fifths("B loc")).to.equal(0)
+    })
+    it("should ignore the rest of the field", () => {
+      expect(fifths("G clef=bass")).to.equal(1)
+      expect(fifths("none")).to.equal(0)
+    })
+    it("should set no key for fields that only change the clef", () => {
+      expect(parseKey("clef=bass")).to.equal(null)
+      expect(parseKey("")).to.equal(null)
+      expect(alterations("exp ^f")).to.deep.equal([0, 0, 0, 1, 0, 0, 0])
+    })
+    it("should build alteration tables", () => {
+      expect(alterations("D")).to.deep.equal([1, 0, 0, 1, 0, 0, 0])
+      expect(alterations("Eb")).to.deep.equal([0, 0, -1, 0, 0, -1, -1])
+      expect(alterations("Hp")).to.deep.equal([1, 0, 0, 1, 0, 0, 0])
+    })
+    it("should apply explicit accidentals", () => {
+      expect(alterations("D =c")).to.deep.equal([0, 0, 0, 1, 0, 0, 0])
+      expect(alterations("D exp ^g")).to.deep.equal([0, 0, 0, 0, 1, 0, 0])
+      // the shared table is left untouched
+      expect(alterations("D")).to.deep.equal([1, 0, 0, 1, 0, 0, 0])
+    })
+    it("should not read the values of other words as accidentals", () => {
+      expect(alterations("F clef=bass")).to.deep.equal(
+        Array.from(signature(-1))
+      )
+      expect(alterations("Eb clef=bass")).to.deep.equal(
+        Array.from(signature(-3))
+      )
+      expect(alterations("G middle=B")).to.deep.equal(Array.from(signature(1)))
+    })
+  })
+  describe("notes", () => {
+    it("should resolve octaves", () => {
+      expect(pitches("X:1\nK:C\nC, C c c' c''\n")).to.deep.equal([
+        48, 60, 72, 84, 96,
+      ])
+    })
+    it("should apply the key to every octave", () => {
+      expect(pitches("X:1\nK:Bb\nB b, E\n")).to.deep.equal([70, 70, 63])
+    })
+    it("should carry accidentals within the bar only", () => {
+      expect(pitches("X:1\nK:G\n=F F f | F\n")).to.deep.equal([
+        65, 65, 78, 66,
+      ])
+    })
+    it("should carry accidentals onto tied notes", () => {
+      expect(pitches("X:1\nK:C\n^F2-|F2 F|\n")).to.deep.equal([66, 66, 65])
+      expect(pitches("X:1\nK:D\n=F2-|F2 F|\n")).to.deep.equal([65, 65, 66])
+      // only onto the next note
+      expect(pitches("X:1\nK:C\n^F-G|F\n")).to.deep.equal([66, 67, 65])
+      expect(pitches("X:1\nK:C\n[^F-A]|[FA]\n")).to.deep.equal([
+        66, 69, 66, 69,
+      ])
+    })
+    it("should follow key changes", () => {
+      expect(pitches("X:1\nK:C\nF [K:F] B\n")).to.deep.equal([65, 70])
+      expect(pitches("X:1\nK:D\nF [K:clef=bass] F | f\n")).to.deep.equal([
+        66, 66, 78,
+      ])
+    })
+    it("should resolve chord and grace notes", () => {
+      expect(pitches("X:1\nK:D\n{c}[DF] z\n")).to.deep.equal([73, 62, 66])
+    })
+  })
+})
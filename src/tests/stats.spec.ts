@@ -0,0 +1,119 @@
+import chai from "chai"
+import { mkdtempSync, rmSync, writeFileSync } from "fs"
+import { tmpdir } from "os"
+import { join } from "path"
+import { error, setErrorListener } from "../error"
+import { HyperLogLog, TDigest } from "../sketches"
+import { collectStats, CorpusStats } from "../Stats"
+const expect = chai.expect
+
+const file = [
+  "X:1\nT:Reel\nM:4/4\nL:1/8\nK:D\n~A2 FA dAFA|B2 !trill!B2 z4|\n",
+  "X:2\nT:Jig\nM:6/8\nK:Ador\nA>BA [ce]2e|.a3 a2g|\n",
+  "X:3\nT:jig\nM:none\nK:Bbmaj\nB2 é c|\n",
+].join("\n")
+
+describe("Sketches", () => {
+  it("should estimate distinct values", () => {
+    const sketch = new HyperLogLog()
+    for (let i = 0; i < 20000; i++) sketch.add(`title ${i % 10000}`)
+    const error = Math.abs(sketch.estimate() - 10000) / 10000
+    expect(error < 0.05).to.equal(true)
+  })
+  it("should merge distinct values", () => {
+    const a = new HyperLogLog()
+    const b = new HyperLogLog()
+    for (let i = 0; i < 1000; i++) a.add(`a ${i}`)
+    for (let i = 0; i < 1000; i++) b.add(`b ${i}`)
+    a.merge(b)
+    expect(Math.abs(a.estimate() - 2000) < 100).to.equal(true)
+  })
+  it("should estimate quantiles", () => {
+    const digest = new TDigest()
+    for (let i = 0; i < 10000; i++) digest.add((i * 7919) % 10000)
+    expect(Math.abs(digest.quantile(0.5) - 5000) < 100).to.equal(true)
+    expect(Math.abs(digest.quantile(0.99) - 9900) < 20).to.equal(true)
+    expect(digest.quantile(0)).to.equal(0)
+    expect(digest.quantile(1)).to.equal(9999)
+  })
+  it("should merge quantiles across threads", () => {
+    const low = new TDigest()
+    const high = new TDigest()
+    for (let i = 0; i < 5000; i++) low.add(i)
+    for (let i = 5000; i < 10000; i++) high.add(i)
+    const merged = TDigest.deserialize(low.serialize())
+    merged.merge(TDigest.deserialize(high.serialize()))
+    expect(merged.count).to.equal(10000)
+    expect(Math.abs(merged.quantile(0.25) - 2500) < 100).to.equal(true)
+  })
+})
+
+describe("CorpusStats", () => {
+  it("should count the histograms", () => {
+    const stats = new CorpusStats()
+    stats.addSource(file)
+    const report = stats.report()
+    expect(report.files).to.equal(1)
+    expect(report.tunes).to.equal(3)
+    expect(report.failed).to.equal(1)
+    expect(report.distinctTitles).to.equal(2)
+    expect(report.keys).to.deep.equal({ D: 1, Ador: 1, Bb: 1 })
+    expect(report.meters).to.deep.equal({ "4/4": 1, "6/8": 1, none: 1 })
+    expect(report.decorations).to.deep.equal({ ".": 1, trill: 1, roll: 1 })
+    expect(report.noteLengths["2/1"]).to.equal(6)
+    expect(report.tokens.LETTER_COLON).to.equal(13)
+    expect(report.errors).to.deep.equal({ "unexpected character": 1 })
+    expect(report.tuneLength.max).to.equal(9)
+  })
+  it("should put back the error listener it replaced", () => {
+    const messages: Array<string> = []
+    const outer = (_: number, message: string) => messages.push(message)
+    setErrorListener(outer)
+    try {
+      new CorpusStats().addSource(file)
+      error(1, "after")
+      expect(messages).to.deep.equal(["after"])
+    } finally {
+      expect(setErrorListener(null)).to.equal(outer)
+    }
+  })
+  it("should merge the statistics of several threads", () => {
+    const one = new CorpusStats()
+    one.addSource(file)
+    const two = new CorpusStats()
+    two.addSource(file)
+    one.merge(CorpusStats.fromState(two.state()))
+    const report = one.report()
+    expect(report.files).to.equal(2)
+    expect(report.keys).to.deep.equal({ D: 2, Ador: 2, Bb: 2 })
+    expect(report.distinctTitles).to.equal(2)
+  })
+  it("should collect the statistics of files", async () => {
+    const directory = mkdtempSync(join(tmpdir(), "stats-"))
+    try {
+      const paths = [join(directory, "a.abc"), join(directory, "b.abc")]
+      for (const path of paths) writeFileSync(path, file)
+      const stats = await collectStats(paths, { workers: 0 })
+      expect(stats.report().tunes).to.equal(6)
+    } finally {
+      rmSync(directory, { recursive: true })
+    }
+  })
+  it("should collect the statistics on worker threads", async function () {
+    // leaves time for the workers to load
+    this.timeout(20000)
+    const directory = mkdtempSync(join(tmpdir(), "stats-"))
+    try {
+      const paths = ["a", "b", "c"].map((name) =>
+        join(directory, `${name}.abc`)
+      )
+      for (const path of paths) writeFileSync(path, file)
+      const threaded = await collectStats(paths, { workers: 2 })
+      const inline = await collectStats(paths, { workers: 0 })
+      expect(threaded.report()).to.deep.equal(inline.report())
+      expect(threaded.report().files).to.equal(3)
+    } finally {
+      rmSync(directory, { recursive: true })
+    }
+  })
+})
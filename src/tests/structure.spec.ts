@@ -0,0 +1,81 @@
+import chai from "chai"
+import { Note, Pitch } from "../Expr"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import {
+  analyzeStructure,
+  endingPasses,
+  REPEAT_END,
+  REPEAT_START,
+} from "../Structure"
+const expect = chai.expect
+
+const structure = (body: string) => {
+  const source = "X:1\nK:C\n" + body + "\n"
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return analyzeStructure(ast!.tune[0])
+}
+
+// the notes of each bar, in the order they are played
+const playback = (body: string) => {
+  const tune = structure(body)
+  const bars: Array<string> = []
+  for (const bar of tune.playback()) {
+    let notes = ""
+    for (const element of tune.elements(bar)) {
+      if (element instanceof Note && element.pitch instanceof Pitch) {
+        notes += element.pitch.noteLetter.lexeme
+      }
+    }
+    bars.push(notes)
+  }
+  return bars.join(" ")
+}
+
+describe("Structure", () => {
+  describe("bars", () => {
+    it("should split the body at bar lines", () => {
+      const tune = structure("ab cd | ef |]")
+      expect(tune.length).to.equal(2)
+      expect(tune.sequence[tune.ends[0]]).to.have.property("barline")
+    })
+    it("should merge bars without notes", () => {
+      const tune = structure("|: ab :|\n|: cd :|")
+      expect(tune.length).to.equal(2)
+      for (const flags of tune.flags) {
+        expect(flags & REPEAT_START).to.equal(REPEAT_START)
+        expect(flags & REPEAT_END).to.equal(REPEAT_END)
+      }
+    })
+    it("should parse endings", () => {
+      expect(endingPasses("1")).to.equal(1)
+      expect(endingPasses("[2")).to.equal(2)
+      expect(endingPasses("1,3")).to.equal(5)
+      expect(endingPasses("1-3")).to.equal(7)
+    })
+  })
+  describe("playback", () => {
+    it("should play repeats twice", () => {
+      expect(playback("|: a b :| c")).to.equal("ab ab c")
+      expect(playback("a | b :| c")).to.equal("a b a b c")
+    })
+    it("should play sections joined by a double repeat", () => {
+      expect(playback("a :: b :: c |")).to.equal("a a b b c")
+    })
+    it("should play each ending on its pass", () => {
+      expect(playback("|: a | b |[1 c d :|[2 e f |] g")).to.equal(
+        "a b cd a b ef g"
+      )
+      expect(playback("|: a |1 b :|2 c :|3 d ||")).to.equal("a b a c a d")
+    })
+    it("should start over after the endings", () => {
+      expect(playback("|: a |1 b :|2 c || d e :|")).to.equal(
+        "a b a c de de"
+      )
+    })
+    it("should find the bar lines within slurs", () => {
+      expect(playback("|: a (b :| c) d |")).to.equal("ab ab cd")
+      expect(playback("|: a (b |1 c :|2 d) e |")).to.equal("ab c ab de")
+    })
+  })
+})
@@ -0,0 +1,80 @@
+import chai from "chai"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import { compileTune, compileTunes } from "../Timeline"
+const expect = chai.expect
+
+const compile = (source: string) =>
+  compileTune(new Parser(new Scanner(source).scanTokens()).parse()!.tune[0])
+
+describe("Timeline", () => {
+  it("should lay out notes in time", () => {
+    const events = compile("X:1\nL:1/4\nK:C\nC D2 E/\n")
+    expect(events.length).to.equal(3)
+    expect(Array.from(events.onsets)).to.deep.equal([0, 0.25, 0.75])
+    expect(Array.from(events.durations)).to.deep.equal([0.25, 0.5, 0.125])
+  })
+  it("should resolve octaves and accidentals", () => {
+    const events = compile("X:1\nK:C\nC c c' C, ^C _B =c\n")
+    expect(Array.from(events.pitches)).to.deep.equal([
+      60, 72, 84, 48, 61, 70, 72,
+    ])
+  })
+  it("should apply the key signature", () => {
+    const events = compile("X:1\nK:D\nF C =F\n")
+    expect(Array.from(events.pitches)).to.deep.equal([66, 61, 65])
+  })
+  it("should carry accidentals until the end of the bar", () => {
+    const events = compile("X:1\nK:C\n^F F | F\n")
+    expect(Array.from(events.pitches)).to.deep.equal([66, 66, 65])
+  })
+  it("should merge tied notes", () => {
+    const events = compile("X:1\nL:1/4\nK:C\nC-C D\n")
+    expect(events.length).to.equal(2)
+    expect(Array.from(events.durations)).to.deep.equal([0.5, 0.25])
+  })
+  it("should merge notes tied across a bar line", () => {
+    const events = compile("X:1\nL:1/4\nK:C\n^F-|F G\n")
+    expect(events.length).to.equal(2)
+    expect(Array.from(events.pitches)).to.deep.equal([66, 67])
+    expect(Array.from(events.durations)).to.deep.equal([0.5, 0.25])
+  })
+  it("should give grace notes no duration", () => {
+    const events = compile("X:1\nL:1/4\nK:C\n{g}C\n")
+    expect(Array.from(events.onsets)).to.deep.equal([0, 0])
+    expect(Array.from(events.durations)).to.deep.equal([0, 0.25])
+  })
+  it("should skip rests and sound chords together", () => {
+    const events = compile("X:1\nL:1/4\nK:C\nz [CE]\n")
+    expect(Array.from(events.onsets)).to.deep.equal([0.25, 0.25])
+    expect(Array.from(events.pitches)).to.deep.equal([60, 64])
+  })
+  it("should order the voices' events by onset", () => {
+    const events = compile("X:1\nL:1/4\nK:C\nV:1\nC D\nV:2\nE F\n")
+    expect(events.voiceNames).to.deep.equal(["1", "2"])
+    expect(Array.from(events.pitches)).to.deep.equal([60, 64, 62, 65])
+    expect(Array.from(events.voices)).to.deep.equal([0, 1, 0, 1])
+  })
+  it("should follow dynamics", () => {
+    const events = compile("X:1\nK:C\nC !f!D\n")
+    expect(Array.from(events.velocities)).to.deep.equal([80, 105])
+  })
+  it("should attach decorations to the next note", () => {
+    const events = compile("X:1\nK:C\n~C !f!!trill!D E\n")
+    expect(events.decorationNames).to.deep.equal(["!roll!", "!f!", "!trill!"])
+    expect(Array.from(events.decorationStarts)).to.deep.equal([0, 1, 3, 3])
+    expect(Array.from(events.decorationIds)).to.deep.equal([0, 1, 2])
+  })
+  it("should count any number of decorations", () => {
+    const events = compile("X:1\nK:C\n" + "!trill!".repeat(300) + "C D\n")
+    expect(Array.from(events.decorationStarts)).to.deep.equal([0, 300, 300])
+  })
+  it("should point events to the source", () => {
+    const source = "X:1\nK:C\nC ^D\n\nX:2\nK:C\nE\n"
+    const tunes = Array.from(compileTunes(source))
+    expect(tunes.length).to.equal(2)
+    expect(tunes[0].offsets[1]).to.equal(source.indexOf("^D"))
+    expect(tunes[1].reference).to.equal("2")
+    expect(tunes[1].offsets[0]).to.equal(source.indexOf("E\n"))
+  })
+})
@@ -0,0 +1,60 @@
+import chai from "chai"
+import { applyEdits } from "../Formatter"
+import { transpose } from "../Transposer"
+const expect = chai.expect
+
+const transposed = (source: string, semitones: number) =>
+  applyEdits(source, transpose(source, semitones))
+
+describe("Transposer", () => {
+  it("should move the key and the notes", () => {
+    expect(transposed("X:1\nK:G\nGABc d^cde|\n", 2)).to.equal(
+      "X:1\nK:A\nABcd e^def|\n"
+    )
+  })
+  it("should cross octaves", () => {
+    expect(transposed("X:1\nK:C\nB,Bb'|\n", 1)).to.equal(
+      "X:1\nK:Db\nCcc''|\n"
+    )
+    expect(transposed("X:1\nK:C\nCc|\n", -12)).to.equal("X:1\nK:C\nC,C|\n")
+  })
+  it("should keep modes", () => {
+    expect(transposed("X:1\nK:Ador\nABcd|\n", 2)).to.equal(
+      "X:1\nK:Bdor\nBcde|\n"
+    )
+  })
+  it("should write the accidentals the new key needs", () => {
+    // C# in G becomes a G natural in Db
+    expect(transposed("X:1\nK:G\nd^cd|\n", 6)).to.equal("X:1\nK:Db\na=ga|\n")
+    // the B flat stays flat in the rest of the bar
+    expect(transposed("X:1\nK:C\nC_BB|B\n", 2)).to.equal(
+      "X:1\nK:D\nD=cc|c\n"
+    )
+  })
+  it("should transpose inline keys and chord symbols", () => {
+    expect(
+      transposed('X:1\nK:C\n"Am"A"G/B"B [K:F]"Bb"B\n', -2)
+    ).to.equal('X:1\nK:Bb\n"Gm"G"F/A"A [K:Eb]"Ab"A\n')
+  })
+  it("should keep the key through clef changes", () => {
+    expect(transposed("X:1\nK:D\nF [K:clef=bass] F|\n", 2)).to.equal(
+      "X:1\nK:E\nG [K:clef=bass] G|\n"
+    )
+  })
+  it("should leave other annotations alone", () => {
+    const source = 'X:1\nK:C\n"^fine"C\n'
+    expect(transposed(source, 0)).to.equal(source)
+    expect(transposed(source, 2)).to.equal('X:1\nK:D\n"^fine"D\n')
+  })
+  it("should only edit the characters that change", () => {
+    const edits = transpose("X:1\nK:C\nC c'|\n", 12)
+    expect(edits).to.deep.equal([
+      { start: 8, end: 9, text: "c" },
+      { start: 12, end: 12, text: "'" },
+    ])
+  })
+  it("should transpose every tune of an archive", () => {
+    const source = "X:1\nK:C\nC\n\nX:2\nK:F\nF\n"
+    expect(transposed(source, 7)).to.equal("X:1\nK:G\nG\n\nX:2\nK:C\nc\n")
+  })
+})
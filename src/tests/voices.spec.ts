@@ -0,0 +1,52 @@
+import chai from "chai"
+import { Note, Pitch } from "../Expr"
+import { Parser } from "../Parser"
+import Scanner from "../Scanner"
+import { demultiplex } from "../Voices"
+const expect = chai.expect
+
+const voicesOf = (source: string) => {
+  const ast = new Parser(new Scanner(source).scanTokens(), source).parse()
+  return demultiplex(ast!.tune[0])
+}
+
+const notes = (elements: Iterable<unknown>) => {
+  let letters = ""
+  for (const element of elements) {
+    if (element instanceof Note && element.pitch instanceof Pitch) {
+      letters += element.pitch.noteLetter.lexeme
+    }
+  }
+  return letters
+}
+
+describe("Voices", () => {
+  const source = [
+    "X:1\nV:T\nV:B\nK:C",
+    "V:T\nc d | e f |\nV:B\nC D | E F |",
+    "V:T\ng a |\nV:B\nG A |\n",
+  ].join("\n")
+  it("should separate the voices", () => {
+    const voices = voicesOf(source)
+    expect(voices.names).to.deep.equal(["T", "B"])
+    expect(notes(voices.elements(0))).to.equal("cdefga")
+    expect(notes(voices.elements(1))).to.equal("CDEFGA")
+    expect(Array.from(voices.voices)).to.deep.equal([0, 1, 0, 1])
+  })
+  it("should align the bars of the voices", () => {
+    const voices = voicesOf(source)
+    expect(voices.bars).to.equal(3)
+    const tenor = voices.barStart(2, 0)
+    const bass = voices.barStart(2, 1)
+    expect(tenor < bass).to.equal(true)
+    expect(notes(voices.sequence.slice(tenor, tenor + 4))).to.equal("ga")
+    expect(notes(voices.sequence.slice(bass, bass + 4))).to.equal("GA")
+  })
+  it("should follow inline voice fields", () => {
+    const voices = voicesOf("X:1\nK:C\n[V:1] ab | [V:2] AB |\n")
+    expect(voices.names).to.deep.equal(["1", "2"])
+    expect(notes(voices.elements(1))).to.equal("AB")
+    expect(voices.barStart(0, 1) > 0).to.equal(true)
+    expect(voices.barStart(1, 0)).to.equal(-1)
+  })
+})
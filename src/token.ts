@@ -6,6 +6,8 @@ export default class Token {
   public literal: any | null
   public line: number
   public position: number
+  // index of the token's first character in the source
+  public offset: number
   public toString = () => {
     return this.type + " " + this.lexeme + " " + this.literal
   }
@@ -14,7 +16,8 @@ export default class Token {
     lexeme: string,
     literal: any | null,
     line: number,
-    position: number
+    position: number,
+    offset: number = -1
   ) {
     this.type = type
     this.lexeme = lexeme
@@ -22,5 +25,6 @@ export default class Token {
     this.line = line
     this.toString = toString
     this.position = position
+    this.offset = offset
   }
 }
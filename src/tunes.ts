@@ -0,0 +1,158 @@
+import { Tune, Tune_header } from "./Expr"
+import { expandMacros, MacroTable, SourceMap } from "./Macros"
+import { Parser } from "./Parser"
+import Scanner from "./Scanner"
+import { SymbolTable } from "./Symbols"
+
+/**
+ * Returns the offset of the line break followed by an empty line,
+ * the first at or after `from`, or -1 if there is none.
+ * Line breaks are either LF or CRLF.
+ */
+const blankLine = (source: string, from: number) => {
+  let i = source.indexOf("\n", from)
+  while (i !== -1) {
+    let j = i + 1
+    if (source.charCodeAt(j) === 13) j++
+    if (source.charCodeAt(j) === 10) return i
+    i = source.indexOf("\n", i + 1)
+  }
+  return -1
+}
+
+// skips the line breaks of empty lines
+const skipBlankLines = (source: string, from: number) => {
+  let next = from
+  while (source.charCodeAt(next) === 10 || source.charCodeAt(next) === 13) {
+    next++
+  }
+  return next
+}
+
+/**
+ * Splits an archive into the source of each tune,
+ * along with the offset of that source in the archive.
+ * Tunes start with an `X:` line following an empty line,
+ * anything before the first tune is yielded as the file header.
+ *
+ * This allows processing large archives one tune at a time,
+ * instead of parsing them whole.
+ */
+export function* splitTunes(
+  source: string
+): Generator<{ source: string; offset: number }> {
+  let start = 0
+  let search = 0
+  while (true) {
+    const blank = blankLine(source, search)
+    if (blank === -1) break
+    const next = skipBlankLines(source, blank + 1)
+    if (source.startsWith("X:", next)) {
+      if (next > start) {
+        yield { source: source.substring(start, blank + 1), offset: start }
+      }
+      start = next
+    }
+    search = next
+  }
+  if (start < source.length) {
+    yield { source: source.substring(start), offset: start }
+  }
+}
+
+/**
+ * Splits an archive read from a stream the way `splitTunes` splits it
+ * whole, yielding each tune as soon as the start of the next one is read.
+ * The stream should be decoded into strings, e.g. with `setEncoding`.
+ */
+export async function* splitTuneStream(
+  input: AsyncIterable<string>
+): AsyncGenerator<{ source: string; offset: number }> {
+  let buffer = ""
+  // offset of the buffer in the archive
+  let base = 0
+  let start = 0
+  let search = 0
+  for await (const data of input) {
+    buffer += data
+    while (true) {
+      const blank = blankLine(buffer, search)
+      if (blank === -1) {
+        // the blank line may end in the next data
+        search = Math.max(search, buffer.length - 2)
+        break
+      }
+      const next = skipBlankLines(buffer, blank + 1)
+      // wait for what follows the blank lines
+      if (next + 2 > buffer.length) break
+      if (buffer.startsWith("X:", next)) {
+        if (next > start) {
+          yield {
+            source: buffer.substring(start, blank + 1),
+            offset: base + start,
+          }
+        }
+        start = next
+      }
+      search = next
+    }
+    // only keep the tune being read
+    buffer = buffer.substring(start)
+    base += start
+    search -= start
+    start = 0
+  }
+  if (buffer.length > 0) yield { source: buffer, offset: base }
+}
+
+/**
+ * Parses an archive one tune at a time,
+ * yielding each tune with the offset of its source in the archive.
+ *
+ * With `macros`, the `m:` macros are expanded before parsing,
+ * and each tune comes with the map from its expanded source
+ * back to the archive.
+ */
+export function* parseTunes(
+  source: string,
+  { macros = false } = {}
+): Generator<{ tune: Tune; offset: number; map?: SourceMap }> {
+  let header = new MacroTable()
+  // filled in by the file header's `U:` fields
+  const symbols = new SymbolTable()
+  for (const chunk of splitTunes(source)) {
+    let text = chunk.source
+    let map: SourceMap | undefined
+    if (macros) {
+      const expanded = expandMacros(text, header, chunk.offset)
+      text = expanded.source
+      map = expanded.map
+      header = expanded.macros
+    }
+    const tokens = new Scanner(text).scanTokens()
+    const ast = new Parser(tokens, text, symbols).parse()
+    if (!ast) continue
+    for (const tune of ast.tune) yield { tune, offset: chunk.offset, map }
+  }
+}
+
+/**
+ * Parses only the headers of an archive's tunes, up to their `K:` line,
+ * yielding each with the offset of its tune in the archive.
+ * The bodies are skipped without being scanned.
+ */
+export function* parseHeaders(
+  source: string
+): Generator<{ header: Tune_header; offset: number }> {
+  for (const chunk of splitTunes(source)) {
+    if (!chunk.source.startsWith("X:")) continue
+    const key = /^K:.*\n?/m.exec(chunk.source)
+    const text = key
+      ? chunk.source.substring(0, key.index + key[0].length)
+      : chunk.source
+    const tokens = new Scanner(text).scanTokens()
+    const ast = new Parser(tokens, text).parse()
+    if (!ast || ast.tune.length === 0) continue
+    yield { header: ast.tune[0].tune_header, offset: chunk.offset }
+  }
+}